@@ -42,8 +42,15 @@ func GetPackage() *denv.Package {
 	maintest.AddDependencies(cunittestpkg.GetMainLib())
 	maintest.AddDependency(testlib)
 
+	// benchmark project (source/benchmark/cpp), named after this repository since repo_name
+	// still carries the name of the package it was copied from
+	benchmark := denv.SetupCppAppProject(mainpkg, "chistogram_benchmark", "benchmark")
+	benchmark.AddDependencies(cbasepkg.GetMainLib())
+	benchmark.AddDependency(mainlib)
+
 	mainpkg.AddMainLib(mainlib)
 	mainpkg.AddTestLib(testlib)
 	mainpkg.AddUnittest(maintest)
+	mainpkg.AddMainApp(benchmark)
 	return mainpkg
 }
@@ -0,0 +1,476 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+
+#include "chistogram/c_histogram.h"
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Benchmarks of the histogram, one result per line as CSV (default) or JSON:
+//
+//   chistogram_benchmark [--json] [--baseline <file.csv>] [--threshold <percent>]
+//
+// With --baseline the results are compared against a CSV file written by an earlier
+// run, every result gets the baseline value and the change in percent, and the exit
+// code is 1 when any time or size grew by more than the threshold (default 10%).
+
+namespace ncore
+{
+    namespace nbench
+    {
+        const s32 VALUE_COUNT  = 1 << 16; // pre-generated values per distribution
+        const s32 RECORD_COUNT = 1 << 22; // records per timed run
+        const s32 RUNS         = 5;       // timed runs per benchmark, the fastest is reported
+        const s32 MAX_RESULTS  = 64;
+
+        struct result_t
+        {
+            char name[48];
+            char unit[8];
+            f64  value;
+            f64  baseline;
+            bool has_baseline;
+        };
+
+        static result_t gResults[MAX_RESULTS];
+        static s32      gResultCount = 0;
+        static volatile s64 gSink    = 0; // keeps the results of the measured calls alive
+
+        static void add_result(const char* name, const char* unit, f64 value)
+        {
+            if (gResultCount < MAX_RESULTS)
+            {
+                result_t& r = gResults[gResultCount++];
+                snprintf(r.name, sizeof(r.name), "%s", name);
+                snprintf(r.unit, sizeof(r.unit), "%s", unit);
+                r.value        = value;
+                r.baseline     = 0.0;
+                r.has_baseline = false;
+            }
+        }
+
+        // ----------------------------------------------------------------------------------------
+        // ----------------------------------------------------------------------------------------
+        //                                 value distributions
+        // ----------------------------------------------------------------------------------------
+        // ----------------------------------------------------------------------------------------
+
+        struct rng_t
+        {
+            u64 state;
+
+            u64 next()
+            {
+                // xorshift64*
+                state ^= state >> 12;
+                state ^= state << 25;
+                state ^= state >> 27;
+                return state * 2685821657736338717ULL;
+            }
+
+            f64 uniform() { return (f64)(next() >> 11) * (1.0 / 9007199254740992.0); }
+
+            f64 normal()
+            {
+                // Box-Muller, (0, 1] to keep the log finite
+                const f64 u = 1.0 - uniform();
+                const f64 v = uniform();
+                return sqrt(-2.0 * log(u)) * cos(6.283185307179586 * v);
+            }
+        };
+
+        enum distribution_t
+        {
+            UNIFORM,
+            LOGNORMAL,
+            BIMODAL,
+        };
+
+        // Latencies in microseconds up to an hour
+        const s64 LOWEST  = 1;
+        const s64 HIGHEST = 3600000000LL;
+        const s32 SIGFIGS = 3;
+
+        static s64 clamp_value(f64 v) { return v < 1.0 ? 1 : (v > (f64)HIGHEST ? HIGHEST : (s64)v); }
+
+        static void generate(distribution_t d, s64* values, s32 count)
+        {
+            rng_t rng = {0x9E3779B97F4A7C15ULL + (u64)d};
+            for (s32 i = 0; i < count; i++)
+            {
+                switch (d)
+                {
+                    case UNIFORM: values[i] = 1 + (s64)(rng.next() % 1000000); break;
+                    case LOGNORMAL: values[i] = clamp_value(exp(log(1000.0) + 1.0 * rng.normal())); break;
+                    case BIMODAL:
+                        // 90% fast path around 100us, 10% slow path around 20ms
+                        values[i] = (rng.uniform() < 0.9) ? clamp_value(100.0 + 10.0 * rng.normal()) : clamp_value(20000.0 + 2000.0 * rng.normal());
+                        break;
+                }
+            }
+        }
+
+        // ----------------------------------------------------------------------------------------
+        // ----------------------------------------------------------------------------------------
+        //                                      timing
+        // ----------------------------------------------------------------------------------------
+        // ----------------------------------------------------------------------------------------
+
+        typedef std::chrono::steady_clock bench_clock_t;
+
+        static f64 elapsed_ns(bench_clock_t::time_point start) { return (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock_t::now() - start).count(); }
+
+        // Runs 'body' RUNS times and reports the fastest run divided by 'ops'
+        template <typename F> static void measure(const char* name, s64 ops, F body)
+        {
+            f64 best = 0.0;
+            for (s32 run = 0; run < RUNS; run++)
+            {
+                const bench_clock_t::time_point start = bench_clock_t::now();
+                body();
+                const f64 ns = elapsed_ns(start);
+                best         = (run == 0 || ns < best) ? ns : best;
+            }
+            add_result(name, "ns", best / (f64)ops);
+        }
+
+        // ----------------------------------------------------------------------------------------
+        // ----------------------------------------------------------------------------------------
+        //                                    benchmarks
+        // ----------------------------------------------------------------------------------------
+        // ----------------------------------------------------------------------------------------
+
+        static void bench_record(nhdr::hdr_histogram* h, const char* name, const s64* values)
+        {
+            measure(name, RECORD_COUNT, [&]() {
+                nhdr::hdr_reset(h);
+                for (s32 i = 0; i < RECORD_COUNT; i++)
+                {
+                    nhdr::hdr_record_value(h, values[i & (VALUE_COUNT - 1)]);
+                }
+            });
+            gSink = gSink + h->total_count;
+        }
+
+        static void bench_queries(const nhdr::hdr_histogram* h)
+        {
+            const s32 QUERIES        = 1 << 14;
+            const f64 percentiles[7] = {50.0, 75.0, 90.0, 99.0, 99.9, 99.99, 100.0};
+
+            measure("value_at_percentile", QUERIES, [&]() {
+                s64 sum = 0;
+                for (s32 i = 0; i < QUERIES; i++)
+                {
+                    sum += nhdr::hdr_value_at_percentile(h, percentiles[i % 7]);
+                }
+                gSink = gSink + sum;
+            });
+
+            measure("value_at_percentiles_x7", QUERIES, [&]() {
+                s64 values[7];
+                s64 sum = 0;
+                for (s32 i = 0; i < QUERIES; i++)
+                {
+                    nhdr::hdr_value_at_percentiles(h, percentiles, values, 7);
+                    sum += values[i % 7];
+                }
+                gSink = gSink + sum;
+            });
+
+            measure("mean", QUERIES, [&]() {
+                f64 sum = 0.0;
+                for (s32 i = 0; i < QUERIES; i++)
+                {
+                    sum += nhdr::hdr_mean(h);
+                }
+                gSink = gSink + (s64)sum;
+            });
+
+            measure("stddev", QUERIES, [&]() {
+                f64 sum = 0.0;
+                for (s32 i = 0; i < QUERIES; i++)
+                {
+                    sum += nhdr::hdr_stddev(h);
+                }
+                gSink = gSink + (s64)sum;
+            });
+        }
+
+        static void bench_add(nhdr::hdr_histogram* to, const nhdr::hdr_histogram* from)
+        {
+            const s32 ADDS = 256;
+            measure("add", ADDS, [&]() {
+                for (s32 i = 0; i < ADDS; i++)
+                {
+                    nhdr::hdr_add(to, from);
+                }
+            });
+            gSink = gSink + to->total_count;
+        }
+
+        // One full iteration over the histogram per op
+        template <typename I> static void bench_iter(const char* name, I init)
+        {
+            const s32 ITERATIONS = 64;
+            measure(name, ITERATIONS, [&]() {
+                s64 sum = 0;
+                for (s32 i = 0; i < ITERATIONS; i++)
+                {
+                    nhdr::hdr_iter iter;
+                    init(&iter);
+                    while (nhdr::hdr_iter_next(&iter))
+                    {
+                        sum += iter.count;
+                    }
+                }
+                gSink = gSink + sum;
+            });
+        }
+
+        // One percentile distribution (5 ticks per half distance) written to a buffer per op
+        static void bench_write(const char* name, const nhdr::hdr_histogram* h, nhdr::format_type format)
+        {
+            const s32 WRITES = 64;
+            char      buffer[64 * 1024];
+            measure(name, WRITES, [&]() {
+                u64 sum = 0;
+                for (s32 i = 0; i < WRITES; i++)
+                {
+                    nhdr::hdr_writer w;
+                    nhdr::hdr_writer_init_buffer(&w, buffer, sizeof(buffer));
+                    nhdr::hdr_percentiles_write(h, &w, 5, 1.0, format);
+                    sum += w.length;
+                }
+                gSink = gSink + (s64)sum;
+            });
+        }
+
+        static void bench_memory_sizes()
+        {
+            struct config_t
+            {
+                const char* name;
+                s64         lowest;
+                s64         highest;
+                s32         sigfigs;
+            };
+            const config_t configs[] = {
+              {"memory_1us_1h_2sf", 1, 3600000000LL, 2},
+              {"memory_1us_1h_3sf", 1, 3600000000LL, 3},
+              {"memory_1us_1h_4sf", 1, 3600000000LL, 4},
+              {"memory_1us_1h_5sf", 1, 3600000000LL, 5},
+              {"memory_1ns_1h_3sf", 1, 3600000000000LL, 3},
+              {"memory_1ms_1y_3sf", 1000, 31536000000000LL, 3},
+            };
+
+            for (u32 i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+            {
+                nhdr::hdr_histogram* h = nullptr;
+                if (0 == nhdr::hdr_init(configs[i].lowest, configs[i].highest, configs[i].sigfigs, &h))
+                {
+                    add_result(configs[i].name, "bytes", (f64)nhdr::hdr_get_memory_size(h));
+                    nhdr::hdr_close(h);
+                }
+            }
+        }
+
+        static void run_all()
+        {
+            s64* values = (s64*)context_t::system_alloc()->allocate(sizeof(s64) * VALUE_COUNT * 3, 64);
+            s64* uniform   = values;
+            s64* lognormal = values + VALUE_COUNT;
+            s64* bimodal   = values + VALUE_COUNT * 2;
+            generate(UNIFORM, uniform, VALUE_COUNT);
+            generate(LOGNORMAL, lognormal, VALUE_COUNT);
+            generate(BIMODAL, bimodal, VALUE_COUNT);
+
+            nhdr::hdr_histogram* h     = nullptr;
+            nhdr::hdr_histogram* other = nullptr;
+            nhdr::hdr_init(LOWEST, HIGHEST, SIGFIGS, &h);
+            nhdr::hdr_init(LOWEST, HIGHEST, SIGFIGS, &other);
+
+            bench_record(h, "record_uniform", uniform);
+            bench_record(h, "record_bimodal", bimodal);
+            bench_record(h, "record_lognormal", lognormal);
+
+            // The queries, merges and iterations run on the lognormal histogram
+            bench_queries(h);
+
+            for (s32 i = 0; i < VALUE_COUNT; i++)
+            {
+                nhdr::hdr_record_value(other, bimodal[i]);
+            }
+            bench_add(other, h);
+
+            bench_iter("iter_all", [&](nhdr::hdr_iter* it) { nhdr::hdr_iter_init(it, h); });
+            bench_iter("iter_recorded", [&](nhdr::hdr_iter* it) { nhdr::hdr_iter_recorded_init(it, h); });
+            bench_iter("iter_percentile_5", [&](nhdr::hdr_iter* it) { nhdr::hdr_iter_percentile_init(it, h, 5); });
+            bench_iter("iter_linear_1000", [&](nhdr::hdr_iter* it) { nhdr::hdr_iter_linear_init(it, h, 1000); });
+            bench_iter("iter_log_2", [&](nhdr::hdr_iter* it) { nhdr::hdr_iter_log_init(it, h, 1, 2.0); });
+
+            bench_write("write_classic", h, nhdr::CLASSIC);
+            bench_write("write_csv", h, nhdr::CSV);
+            bench_write("write_json", h, nhdr::JSON);
+
+            bench_memory_sizes();
+
+            // Packed counts at 5 significant figures, the memory size after recording the lognormal values
+            nhdr::hdr_histogram* packed = nullptr;
+            if (0 == nhdr::hdr_init(LOWEST, HIGHEST, 5, context_t::system_alloc(), nhdr::HDR_COUNTS_PACKED, &packed))
+            {
+                bench_record(packed, "record_lognormal_packed_5sf", lognormal);
+                add_result("memory_1us_1h_5sf_packed", "bytes", (f64)nhdr::hdr_get_memory_size(packed));
+                nhdr::hdr_close(packed);
+            }
+
+            // Paged counts, the memory size after recording the bimodal values
+            nhdr::hdr_histogram* paged = nullptr;
+            if (0 == nhdr::hdr_init(LOWEST, HIGHEST, SIGFIGS, context_t::system_alloc(), nhdr::HDR_COUNTS_PAGED, &paged))
+            {
+                bench_record(paged, "record_bimodal_paged", bimodal);
+                add_result("memory_1us_1h_3sf_paged", "bytes", (f64)nhdr::hdr_get_memory_size(paged));
+                nhdr::hdr_close(paged);
+            }
+
+            nhdr::hdr_close(other);
+            nhdr::hdr_close(h);
+            context_t::system_alloc()->deallocate(values);
+        }
+
+        // ----------------------------------------------------------------------------------------
+        // ----------------------------------------------------------------------------------------
+        //                                      output
+        // ----------------------------------------------------------------------------------------
+        // ----------------------------------------------------------------------------------------
+
+        // Reads 'name,unit,value[,...]' lines of an earlier CSV run
+        static bool read_baseline(const char* path)
+        {
+            FILE* f = fopen(path, "r");
+            if (!f)
+            {
+                return false;
+            }
+
+            char line[256];
+            while (fgets(line, sizeof(line), f))
+            {
+                char* unit = strchr(line, ',');
+                char* value = unit ? strchr(unit + 1, ',') : nullptr;
+                if (!value)
+                {
+                    continue;
+                }
+                *unit = 0;
+                for (s32 i = 0; i < gResultCount; i++)
+                {
+                    if (0 == strcmp(gResults[i].name, line))
+                    {
+                        gResults[i].baseline     = strtod(value + 1, nullptr);
+                        gResults[i].has_baseline = true;
+                    }
+                }
+            }
+            fclose(f);
+            return true;
+        }
+
+        static f64 change_percent(const result_t& r) { return r.baseline > 0.0 ? 100.0 * (r.value - r.baseline) / r.baseline : 0.0; }
+
+        // Both times (ns) and sizes (bytes) are worse when larger
+        static bool is_regression(const result_t& r, f64 threshold) { return r.has_baseline && change_percent(r) > threshold; }
+
+        static void write_csv(bool with_baseline, f64 threshold)
+        {
+            printf(with_baseline ? "name,unit,value,baseline,change_percent,regression\n" : "name,unit,value\n");
+            for (s32 i = 0; i < gResultCount; i++)
+            {
+                const result_t& r = gResults[i];
+                if (with_baseline && r.has_baseline)
+                {
+                    printf("%s,%s,%.3f,%.3f,%.2f,%d\n", r.name, r.unit, r.value, r.baseline, change_percent(r), is_regression(r, threshold) ? 1 : 0);
+                }
+                else if (with_baseline)
+                {
+                    printf("%s,%s,%.3f,,,0\n", r.name, r.unit, r.value);
+                }
+                else
+                {
+                    printf("%s,%s,%.3f\n", r.name, r.unit, r.value);
+                }
+            }
+        }
+
+        static void write_json(bool with_baseline, f64 threshold)
+        {
+            printf("[\n");
+            for (s32 i = 0; i < gResultCount; i++)
+            {
+                const result_t& r = gResults[i];
+                printf("  {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.3f", r.name, r.unit, r.value);
+                if (with_baseline && r.has_baseline)
+                {
+                    printf(", \"baseline\": %.3f, \"change_percent\": %.2f, \"regression\": %s", r.baseline, change_percent(r), is_regression(r, threshold) ? "true" : "false");
+                }
+                printf("}%s\n", (i + 1 < gResultCount) ? "," : "");
+            }
+            printf("]\n");
+        }
+
+    } // namespace nbench
+} // namespace ncore
+
+int main(int argc, char** argv)
+{
+    using namespace ncore;
+
+    bool        json      = false;
+    const char* baseline  = nullptr;
+    f64         threshold = 10.0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "--json"))
+        {
+            json = true;
+        }
+        else if (0 == strcmp(argv[i], "--baseline") && i + 1 < argc)
+        {
+            baseline = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "--threshold") && i + 1 < argc)
+        {
+            threshold = strtod(argv[++i], nullptr);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--json] [--baseline <file.csv>] [--threshold <percent>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    cbase::init();
+    nbench::run_all();
+    cbase::exit();
+
+    if (baseline && !nbench::read_baseline(baseline))
+    {
+        fprintf(stderr, "can't read baseline '%s'\n", baseline);
+        return 2;
+    }
+
+    if (json)
+        nbench::write_json(baseline != nullptr, threshold);
+    else
+        nbench::write_csv(baseline != nullptr, threshold);
+
+    s32 regressions = 0;
+    for (s32 i = 0; i < nbench::gResultCount; i++)
+    {
+        regressions += nbench::is_regression(nbench::gResults[i], threshold) ? 1 : 0;
+    }
+    return regressions > 0 ? 1 : 0;
+}
@@ -1,30 +1,127 @@
 #include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
 #include "cbase/c_integer.h"
 #include "cbase/c_limits.h"
 #include "cbase/c_memory.h"
 //#include "cfile/c_file.h"
 
 #include "chistogram/c_histogram.h"
+#include "chistogram/private/c_histogram_atomic.h"
+#include "chistogram/private/c_histogram_common.h"
 
 #include <math.h>
+#include <stdio.h>
+#if defined(__AVX2__)
+#    include <immintrin.h>
+#endif
 
 namespace ncore
 {
     namespace nhdr
     {
-        const s32 EINVAL = -1;
-        const s32 ENOMEM = -2;
-        const s32 EIO = -3;
+        // A histogram is placed in a single allocation with each part starting at a cache line:
+        //   [hdr_histogram][side tables][counts]
+        // The side tables only exist for the features selected by the init flags.  When the
+        // counts array has to be replaceable (auto-promotion) it is allocated on its own and
+        // left out of the block.  Resizing moves the side tables and the counts out of the
+        // block into an allocation of their own: [side tables][counts].
+
+        // Internal flags, kept in the high bits of hdr_histogram::flags, marking the parts that
+        // live in an allocation of their own, and running sums that hold a negative count.
+        const u32 HDR_COUNTS_ALLOCATED = 0x80000000;
+        const u32 HDR_TABLES_ALLOCATED = 0x40000000;
+        const u32 HDR_SUMS_INVALID     = 0x20000000;
+        const u32 HDR_INTERNAL_FLAGS   = HDR_COUNTS_ALLOCATED | HDR_TABLES_ALLOCATED | HDR_SUMS_INVALID;
+
+        static u64 header_size() { return align_to_cache_line(sizeof(hdr_histogram)); }
+
+        // The allocator takes a 32 bit size, a larger block fails like an out of memory allocator.
+        static void* allocate_block(alloc_t* allocator, u64 size) { return size > 0xFFFFFFFF ? nullptr : allocator->allocate((u32)size, HDR_CACHE_LINE_SIZE); }
+
+        // Packed counts, see HDR_COUNTS_PACKED.  Block b holds the counts [64b, 64b + 64): bit i
+        // of 'populated' is set when count 64b + i is held, at the position given by the
+        // number of populated bits below bit i.  A held count may be zero.
+        struct hdr_packed_block
+        {
+            u64 populated;
+            u8* data;     // room for 'capacity' counts of 'width' bytes
+            u8  width;    // 1, 2, 4 or 8, 0 until the first count is held
+            u8  capacity;
+        };
+
+        static s32 packed_blocks(s32 counts_len) { return (counts_len + 63) >> 6; }
+
+        // Paged counts, see HDR_COUNTS_PAGED.  A page holds the 64 bit counts of a whole half
+        // bucket, or of an equal part of it for half buckets of more than 1024 counts, so the
+        // pages never straddle a bucket.  A page is allocated when a count in it is written.
+        const s32 HDR_PAGE_MAX_SHIFT = 10;
+
+        static s32 page_shift(s32 sub_bucket_half_count_magnitude) { return sub_bucket_half_count_magnitude < HDR_PAGE_MAX_SHIFT ? sub_bucket_half_count_magnitude : HDR_PAGE_MAX_SHIFT; }
+
+        // counts_word_size of the layouts that don't keep the counts in a plain array
+        const s32 HDR_WORD_SIZE_PACKED = 0;
+        const s32 HDR_WORD_SIZE_PAGED  = -1;
+
+        // The counts array of packed counts is the array of blocks, of paged counts the array of page pointers
+        static u64 counts_size(s32 counts_len, s32 word_size, s32 sub_bucket_half_count_magnitude)
+        {
+            switch (word_size)
+            {
+                case HDR_WORD_SIZE_PACKED: return (u64)packed_blocks(counts_len) * sizeof(hdr_packed_block);
+                case HDR_WORD_SIZE_PAGED: return (u64)(counts_len >> page_shift(sub_bucket_half_count_magnitude)) * sizeof(s64*);
+                default: return (u64)counts_len * (u64)word_size;
+            }
+        }
+
+        static s32 counts_word_size_for_flags(u32 flags)
+        {
+            if (flags & HDR_COUNTS_PACKED)
+            {
+                return HDR_WORD_SIZE_PACKED;
+            }
+            if (flags & HDR_COUNTS_PAGED)
+            {
+                return HDR_WORD_SIZE_PAGED;
+            }
+            if (flags & HDR_COUNTS_16_BIT)
+            {
+                return sizeof(s16);
+            }
+            if (flags & HDR_COUNTS_32_BIT)
+            {
+                return sizeof(s32);
+            }
+            return sizeof(s64);
+        }
 
-        void* hdr_calloc(s32 count, s32 size)
+        static s32 occupancy_words(s32 counts_len) { return (counts_len + 63) >> 6; }
+
+        static u64 tables_size(s32 counts_len, u32 flags)
         {
-            return nullptr;
+            u64 size = align_to_cache_line((u64)occupancy_words(counts_len) * sizeof(u64));
+            if (flags & HDR_PERCENTILE_INDEX)
+            {
+                size += align_to_cache_line((u64)counts_len * sizeof(s64));
+            }
+            return size;
         }
 
-        void hdr_free(void* ptr)
+        static u8* tables_bind(hdr_histogram* h, u8* mem)
         {
+            h->occupancy = (u64*)mem;
+            mem += align_to_cache_line((u64)occupancy_words(h->counts_len) * sizeof(u64));
+
+            h->percentile_index = nullptr;
+            if (h->flags & HDR_PERCENTILE_INDEX)
+            {
+                h->percentile_index = (s64*)mem;
+                mem += align_to_cache_line((u64)h->counts_len * sizeof(s64));
+            }
+            return mem;
         }
 
+
         /**
          * hdr_histogram.c
          * Written by Michael Barker and released to the public domain,
@@ -62,437 +159,2190 @@ namespace ncore
             return normalized_index + adjustment;
         }
 
-        static s64 counts_get_direct(const hdr_histogram* h, s32 index) { return h->counts[index]; }
+        static s32 count_bits_64(u64 value);
+        static s32 count_trailing_zeros_64(u64 value);
 
-        static s64 counts_get_normalised(const hdr_histogram* h, s32 index) { return counts_get_direct(h, normalize_index(h, index)); }
+        static s64 packed_load(const u8* data, s32 width, s32 slot)
+        {
+            switch (width)
+            {
+                case sizeof(s8): return ((const s8*)data)[slot];
+                case sizeof(s16): return ((const s16*)data)[slot];
+                case sizeof(s32): return ((const s32*)data)[slot];
+                default: return ((const s64*)data)[slot];
+            }
+        }
 
-        static void counts_inc_normalised(hdr_histogram* h, s32 index, s64 value)
+        static void packed_store(u8* data, s32 width, s32 slot, s64 count)
         {
-            s32 normalised_index = normalize_index(h, index);
-            h->counts[normalised_index] += value;
-            h->total_count += value;
+            switch (width)
+            {
+                case sizeof(s8): ((s8*)data)[slot] = (s8)count; break;
+                case sizeof(s16): ((s16*)data)[slot] = (s16)count; break;
+                case sizeof(s32): ((s32*)data)[slot] = (s32)count; break;
+                default: ((s64*)data)[slot] = count; break;
+            }
         }
 
-        static void update_min_max(hdr_histogram* h, s64 value)
+        static s32 packed_width_for(s64 count)
         {
-            h->min_value = (value < h->min_value && value != 0) ? value : h->min_value;
-            h->max_value = (value > h->max_value) ? value : h->max_value;
+            if (count >= limits_t<s8>::minimum() && count <= limits_t<s8>::maximum())
+            {
+                return sizeof(s8);
+            }
+            if (count >= limits_t<s16>::minimum() && count <= limits_t<s16>::maximum())
+            {
+                return sizeof(s16);
+            }
+            if (count >= limits_t<s32>::minimum() && count <= limits_t<s32>::maximum())
+            {
+                return sizeof(s32);
+            }
+            return sizeof(s64);
         }
 
-        /* ##     ## ######## #### ##       #### ######## ##    ## */
-        /* ##     ##    ##     ##  ##        ##     ##     ##  ##  */
-        /* ##     ##    ##     ##  ##        ##     ##      ####   */
-        /* ##     ##    ##     ##  ##        ##     ##       ##    */
-        /* ##     ##    ##     ##  ##        ##     ##       ##    */
-        /* ##     ##    ##     ##  ##        ##     ##       ##    */
-        /*  #######     ##    #### ######## ####    ##       ##    */
+        static s64 packed_get(const hdr_packed_block* blocks, s32 index)
+        {
+            const hdr_packed_block& block = blocks[index >> 6];
+            const u64               bit   = (u64)1 << (index & 63);
+            return (block.populated & bit) ? packed_load(block.data, block.width, count_bits_64(block.populated & (bit - 1))) : 0;
+        }
 
-        static s64 power(s64 base, s64 exp)
+        // Moves the held counts to a new array of 'capacity' counts of 'width' bytes, leaving
+        // the slot 'gap' free when it is >= 0.
+        static bool packed_reallocate(hdr_packed_block* block, alloc_t* allocator, s32 width, s32 capacity, s32 gap)
         {
-            s64 result = 1;
-            while (exp)
+            u8* data = (u8*)allocator->allocate((u32)(width * capacity), sizeof(s64));
+            if (!data)
             {
-                result *= base;
-                exp--;
+                return false;
             }
-            return result;
-        }
 
-#if defined(_MSC_VER) && !(defined(__clang__) && (defined(_M_ARM) || defined(_M_ARM64)))
-#    if defined(_WIN64)
-#        pragma intrinsic(_BitScanReverse64)
-#    else
-#        pragma intrinsic(_BitScanReverse)
-#    endif
-#endif
+            const s32 held = count_bits_64(block->populated);
+            for (s32 slot = 0; slot < held; slot++)
+            {
+                packed_store(data, width, (gap >= 0 && slot >= gap) ? slot + 1 : slot, packed_load(block->data, block->width, slot));
+            }
+            if (block->data)
+            {
+                allocator->deallocate(block->data);
+            }
+            block->data     = data;
+            block->width    = (u8)width;
+            block->capacity = (u8)capacity;
+            return true;
+        }
 
-        static s32 count_leading_zeros_64(s64 value)
+        // Fails when the block has to grow (or widen) and there is no allocator or it is out of memory
+        static bool packed_set(hdr_packed_block* blocks, alloc_t* allocator, s32 index, s64 count)
         {
-#if defined(_MSC_VER) && !(defined(__clang__) && (defined(_M_ARM) || defined(_M_ARM64)))
-            uint32_t leading_zero = 0;
-#    if defined(_WIN64)
-            _BitScanReverse64(&leading_zero, value);
-#    else
-            uint32_t high = value >> 32;
-            if (_BitScanReverse(&leading_zero, high))
+            hdr_packed_block* block = &blocks[index >> 6];
+            const u64         bit   = (u64)1 << (index & 63);
+            const s32         slot  = count_bits_64(block->populated & (bit - 1));
+            const s32         width = packed_width_for(count) > block->width ? packed_width_for(count) : block->width;
+
+            if (0 == (block->populated & bit))
             {
-                leading_zero += 32;
+                if (0 == count)
+                {
+                    return true;
+                }
+
+                const s32 held = count_bits_64(block->populated);
+                if (held == block->capacity || width != block->width)
+                {
+                    const s32 capacity = held < block->capacity ? block->capacity : (held < 4 ? 4 : (held < 32 ? held * 2 : 64));
+                    if (nullptr == allocator || !packed_reallocate(block, allocator, width, capacity, slot))
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    nmem::memmove(block->data + (slot + 1) * width, block->data + slot * width, (u64)(held - slot) * width);
+                }
+                block->populated |= bit;
             }
-            else
+            else if (width != block->width && (nullptr == allocator || !packed_reallocate(block, allocator, width, block->capacity, -1)))
             {
-                uint32_t low = value & 0x00000000FFFFFFFF;
-                _BitScanReverse(&leading_zero, low);
+                return false;
             }
-#    endif
-            return 63 - leading_zero; /* smallest power of 2 containing value */
-#else
-            return __builtin_clzll(value); /* smallest power of 2 containing value */
-#endif
+
+            packed_store(block->data, block->width, slot, count);
+            return true;
         }
 
-        static s32 get_bucket_index(const hdr_histogram* h, s64 value)
+        // Drops the counts in [begin, end), the arrays are kept for the counts held later on
+        static void packed_clear(hdr_packed_block* blocks, s32 begin, s32 end)
         {
-            s32 pow2ceiling = 64 - count_leading_zeros_64(value | h->sub_bucket_mask); /* smallest power of 2 containing value */
-            return pow2ceiling - h->unit_magnitude - (h->sub_bucket_half_count_magnitude + 1);
+            for (s32 b = begin >> 6; (b << 6) < end; b++)
+            {
+                hdr_packed_block* block = &blocks[b];
+                const s32         lo    = begin > (b << 6) ? begin - (b << 6) : 0;
+                const s32         hi    = end - (b << 6) < 64 ? end - (b << 6) : 64;
+                const u64         mask  = (64 == hi ? ~(u64)0 : ((u64)1 << hi) - 1) & (~(u64)0 << lo);
+                if (0 != (block->populated & ~mask))
+                {
+                    s32 to = 0, from = 0;
+                    for (u64 bits = block->populated; 0 != bits; bits &= bits - 1, from++)
+                    {
+                        if (0 == (bits & (~bits + 1) & mask))
+                        {
+                            packed_store(block->data, block->width, to++, packed_load(block->data, block->width, from));
+                        }
+                    }
+                }
+                block->populated &= ~mask;
+            }
         }
 
-        static s32 get_sub_bucket_index(s64 value, s32 bucket_index, s32 unit_magnitude) { return (s32)(value >> (bucket_index + unit_magnitude)); }
+        static void packed_release(hdr_packed_block* blocks, s32 counts_len, alloc_t* allocator)
+        {
+            for (s32 b = 0; b < packed_blocks(counts_len); b++)
+            {
+                if (blocks[b].data)
+                {
+                    allocator->deallocate(blocks[b].data);
+                }
+                blocks[b].populated = 0;
+                blocks[b].data      = nullptr;
+                blocks[b].width     = 0;
+                blocks[b].capacity  = 0;
+            }
+        }
 
-        static s32 counts_index(const hdr_histogram* h, s32 bucket_index, s32 sub_bucket_index)
+        static u64 packed_data_size(const hdr_packed_block* blocks, s32 counts_len)
         {
-            /* Calculate the index for the first entry in the bucket: */
-            /* (The following is the equivalent of ((bucket_index + 1) * subBucketHalfCount) ): */
-            s32 bucket_base_index = (bucket_index + 1) << h->sub_bucket_half_count_magnitude;
-            /* Calculate the offset in the bucket: */
-            s32 offset_in_bucket = sub_bucket_index - h->sub_bucket_half_count;
-            /* The following is the equivalent of ((sub_bucket_index  - subBucketHalfCount) + bucketBaseIndex; */
-            return bucket_base_index + offset_in_bucket;
+            u64 size = 0;
+            for (s32 b = 0; b < packed_blocks(counts_len); b++)
+            {
+                size += (u64)blocks[b].width * blocks[b].capacity;
+            }
+            return size;
         }
 
-        static s64 value_from_index(s32 bucket_index, s32 sub_bucket_index, s32 unit_magnitude) { return ((s64)sub_bucket_index) << (bucket_index + unit_magnitude); }
+        static s64 paged_get(s64* const* pages, s32 shift, s32 index)
+        {
+            const s64* page = pages[index >> shift];
+            return page ? page[index & ((1 << shift) - 1)] : 0;
+        }
 
-        s32 counts_index_for(const hdr_histogram* h, s64 value)
+        // Fails when the page has to be allocated and there is no allocator or it is out of memory
+        static bool paged_set(s64** pages, s32 shift, alloc_t* allocator, s32 index, s64 count)
         {
-            s32 bucket_index     = get_bucket_index(h, value);
-            s32 sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
+            s64** page = &pages[index >> shift];
+            if (nullptr == *page)
+            {
+                if (0 == count)
+                {
+                    return true;
+                }
+                s64* mem = allocator ? (s64*)allocator->allocate((u32)(sizeof(s64) << shift), HDR_CACHE_LINE_SIZE) : nullptr;
+                if (!mem)
+                {
+                    return false;
+                }
+                nmem::memset(mem, 0, sizeof(s64) << shift);
+                *page = mem;
+            }
+            (*page)[index & ((1 << shift) - 1)] = count;
+            return true;
+        }
 
-            return counts_index(h, bucket_index, sub_bucket_index);
+        // Fails when the page is not allocated yet
+        static bool paged_inc(s64** pages, s32 shift, s32 index, s64 value)
+        {
+            s64* page = pages[index >> shift];
+            if (page)
+            {
+                page[index & ((1 << shift) - 1)] += value;
+            }
+            return nullptr != page;
         }
 
-        s64 hdr_value_at_index(const hdr_histogram* h, s32 index)
+        // Zeroes the counts in [begin, end), the pages are kept for the counts written later on
+        static void paged_clear(s64** pages, s32 shift, s32 begin, s32 end)
         {
-            s32 bucket_index     = (index >> h->sub_bucket_half_count_magnitude) - 1;
-            s32 sub_bucket_index = (index & (h->sub_bucket_half_count - 1)) + h->sub_bucket_half_count;
+            for (s32 p = begin >> shift; (p << shift) < end; p++)
+            {
+                if (pages[p])
+                {
+                    const s32 lo = begin > (p << shift) ? begin - (p << shift) : 0;
+                    const s32 hi = end - (p << shift) < (1 << shift) ? end - (p << shift) : (1 << shift);
+                    nmem::memset(pages[p] + lo, 0, (u64)(hi - lo) * sizeof(s64));
+                }
+            }
+        }
 
-            if (bucket_index < 0)
+        static void paged_release(s64** pages, s32 counts_len, s32 shift, alloc_t* allocator)
+        {
+            for (s32 p = 0; p < (counts_len >> shift); p++)
             {
-                sub_bucket_index -= h->sub_bucket_half_count;
-                bucket_index = 0;
+                if (pages[p])
+                {
+                    allocator->deallocate(pages[p]);
+                    pages[p] = nullptr;
+                }
             }
+        }
 
-            return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude);
+        static u64 paged_data_size(s64* const* pages, s32 counts_len, s32 shift)
+        {
+            u64 size = 0;
+            for (s32 p = 0; p < (counts_len >> shift); p++)
+            {
+                size += pages[p] ? sizeof(s64) << shift : 0;
+            }
+            return size;
         }
 
-        s64 hdr_size_of_equivalent_value_range(const hdr_histogram* h, s64 value)
+        static s64 counts_get_direct(const hdr_histogram* h, s32 index)
         {
-            s32 bucket_index     = get_bucket_index(h, value);
-            s32 sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
-            s32 adjusted_bucket  = (sub_bucket_index >= h->sub_bucket_count) ? (bucket_index + 1) : bucket_index;
-            return (s64)(1) << (h->unit_magnitude + adjusted_bucket);
+            switch (h->counts_word_size)
+            {
+                case HDR_WORD_SIZE_PACKED: return packed_get(h->packed, index);
+                case HDR_WORD_SIZE_PAGED: return paged_get(h->pages, page_shift(h->sub_bucket_half_count_magnitude), index);
+                case sizeof(s16): return h->counts16[index];
+                case sizeof(s32): return h->counts32[index];
+                default: return h->counts[index];
+            }
         }
 
-        static s64 size_of_equivalent_value_range_given_bucket_indices(const hdr_histogram* h, s32 bucket_index, s32 sub_bucket_index)
+        static s64 counts_get_normalised(const hdr_histogram* h, s32 index) { return counts_get_direct(h, normalize_index(h, index)); }
+
+        static void counts_set_direct(hdr_histogram* h, s32 index, s64 count)
         {
-            const s32 adjusted_bucket = (sub_bucket_index >= h->sub_bucket_count) ? (bucket_index + 1) : bucket_index;
-            return (s64)(1) << (h->unit_magnitude + adjusted_bucket);
+            switch (h->counts_word_size)
+            {
+                case HDR_WORD_SIZE_PACKED: packed_set(h->packed, h->allocator, index, count); break;
+                case HDR_WORD_SIZE_PAGED: paged_set(h->pages, page_shift(h->sub_bucket_half_count_magnitude), h->allocator, index, count); break;
+                case sizeof(s16): h->counts16[index] = (s16)count; break;
+                case sizeof(s32): h->counts32[index] = (s32)count; break;
+                default: h->counts[index] = count; break;
+            }
         }
 
-        static s64 lowest_equivalent_value(const hdr_histogram* h, s64 value)
+        static bool count_fits_word(s64 count, s32 word_size)
         {
-            s32 bucket_index     = get_bucket_index(h, value);
-            s32 sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
-            return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude);
+            switch (word_size)
+            {
+                case sizeof(s16): return count >= limits_t<s16>::minimum() && count <= limits_t<s16>::maximum();
+                case sizeof(s32): return count >= limits_t<s32>::minimum() && count <= limits_t<s32>::maximum();
+                default: return true;
+            }
         }
 
-        static s64 lowest_equivalent_value_given_bucket_indices(const hdr_histogram* h, s32 bucket_index, s32 sub_bucket_index) { return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude); }
+        static bool counts_promote(hdr_histogram* h, s64 required_count);
+        static bool counts_resize(hdr_histogram* h, s64 value);
+        static void running_sums_add(hdr_histogram* h, s32 index, s64 count);
+        static void running_sums_add_atomic(hdr_histogram* h, s32 index, s64 count);
+        static s32  count_leading_zeros_64(s64 value);
 
-        s64 hdr_next_non_equivalent_value(const hdr_histogram* h, s64 value) { return lowest_equivalent_value(h, value) + hdr_size_of_equivalent_value_range(h, value); }
+        // The dirty range holds the lowest and highest logical counts index written since the
+        // last reset, the dirty pages split the counts into 64 pages of at least 64 counts (a
+        // whole occupancy word) and flag the pages written since the last reset.
+        static s32 dirty_page_shift(s32 counts_len)
+        {
+            const s32 shift = counts_len > 1 ? 64 - count_leading_zeros_64((s64)counts_len - 1) - 6 : 0;
+            return shift > 6 ? shift : 6;
+        }
 
-        static s64 highest_equivalent_value(const hdr_histogram* h, s64 value) { return hdr_next_non_equivalent_value(h, value) - 1; }
+        static void dirty_clear(hdr_histogram* h)
+        {
+            h->dirty_lo    = h->counts_len;
+            h->dirty_hi    = -1;
+            h->dirty_pages = 0;
+        }
 
-        s64 hdr_median_equivalent_value(const hdr_histogram* h, s64 value) { return lowest_equivalent_value(h, value) + (hdr_size_of_equivalent_value_range(h, value) >> 1); }
+        static void dirty_mark(hdr_histogram* h, s32 index)
+        {
+            h->dirty_lo = index < h->dirty_lo ? index : h->dirty_lo;
+            h->dirty_hi = index > h->dirty_hi ? index : h->dirty_hi;
+            h->dirty_pages |= (u64)1 << (index >> dirty_page_shift(h->counts_len));
+        }
 
-        static s64 non_zero_min(const hdr_histogram* h)
+        static void dirty_mark_range(hdr_histogram* h, s32 lo, s32 hi)
         {
-            if (limits_t<s64>::maximum() == h->min_value)
+            if (lo > hi)
             {
-                return limits_t<s64>::maximum();
+                return;
             }
+            h->dirty_lo = lo < h->dirty_lo ? lo : h->dirty_lo;
+            h->dirty_hi = hi > h->dirty_hi ? hi : h->dirty_hi;
 
-            return lowest_equivalent_value(h, h->min_value);
+            const s32 shift = dirty_page_shift(h->counts_len);
+            const s32 last  = hi >> shift;
+            h->dirty_pages |= (63 == last ? ~(u64)0 : ((u64)1 << (last + 1)) - 1) & (~(u64)0 << (lo >> shift));
         }
 
-        void hdr_reset_internal_counters(hdr_histogram* h)
+        // Concurrent writers widen the range to the whole page when they flag a page, so an
+        // already flagged page is known to be covered by the range.
+        static void dirty_mark_atomic(hdr_histogram* h, s32 index)
         {
-            s32 min_non_zero_index   = -1;
-            s32 max_index            = -1;
-            s64 observed_total_count = 0;
-            s32 i;
-
-            for (i = 0; i < h->counts_len; i++)
+            const s32 shift = dirty_page_shift(h->counts_len);
+            const u64 bit   = (u64)1 << (index >> shift);
+            if (0 != ((u64)hdr_atomic_load_64((volatile s64*)&h->dirty_pages) & bit))
             {
-                s64 count_at_index;
-
-                if ((count_at_index = counts_get_direct(h, i)) > 0)
-                {
-                    observed_total_count += count_at_index;
-                    max_index = i;
-                    if (min_non_zero_index == -1 && i != 0)
-                    {
-                        min_non_zero_index = i;
-                    }
-                }
+                return;
             }
 
-            if (max_index == -1)
+            const s32 lo      = (index >> shift) << shift;
+            const s32 hi      = lo + (1 << shift) <= h->counts_len ? lo + (1 << shift) - 1 : h->counts_len - 1;
+            s32       current = h->counts_len; // refreshed by every failed exchange
+            while (lo < current && !hdr_atomic_compare_exchange_32(&h->dirty_lo, &current, lo))
             {
-                h->max_value = 0;
             }
-            else
+            current = -1;
+            while (hi > current && !hdr_atomic_compare_exchange_32(&h->dirty_hi, &current, hi))
             {
-                s64 max_value = hdr_value_at_index(h, max_index);
-                h->max_value  = highest_equivalent_value(h, max_value);
             }
+            hdr_atomic_or_64((volatile s64*)&h->dirty_pages, (s64)bit);
+        }
 
-            if (min_non_zero_index == -1)
+        // The occupancy bitmap holds one bit per (logical) counts index, a bit is set when
+        // the count at that index may be non-zero.  A cleared bit guarantees a zero count.
+        static void occupancy_set(hdr_histogram* h, s32 index) { h->occupancy[index >> 6] |= (u64)1 << (index & 63); }
+
+        static void occupancy_set_atomic(hdr_histogram* h, s32 index)
+        {
+            const u64 bit = (u64)1 << (index & 63);
+            if (0 == ((u64)hdr_atomic_load_64((volatile s64*)&h->occupancy[index >> 6]) & bit))
             {
-                h->min_value = limits_t<s64>::maximum();
+                hdr_atomic_or_64((volatile s64*)&h->occupancy[index >> 6], (s64)bit);
             }
-            else
+        }
+
+        // The percentile index is a Fenwick tree over the (logical) counts indices, node i
+        // holds the sum of the counts in (i - lowbit(i), i] using 1 based indices.
+        static void percentile_index_add(hdr_histogram* h, s32 index, s64 value)
+        {
+            for (s32 i = index + 1; i <= h->counts_len; i += i & -i)
             {
-                h->min_value = hdr_value_at_index(h, min_non_zero_index);
+                h->percentile_index[i - 1] += value;
             }
-
-            h->total_count = observed_total_count;
         }
 
-        static s32 buckets_needed_to_cover_value(s64 value, s32 sub_bucket_count, s32 unit_magnitude)
+        static void percentile_index_add_atomic(hdr_histogram* h, s32 index, s64 value)
         {
-            s64 smallest_untrackable_value = ((s64)sub_bucket_count) << unit_magnitude;
-            s32 buckets_needed             = 1;
-            while (smallest_untrackable_value <= value)
+            for (s32 i = index + 1; i <= h->counts_len; i += i & -i)
             {
-                if (smallest_untrackable_value > limits_t<s64>::maximum() / 2)
-                {
-                    return buckets_needed + 1;
-                }
-                smallest_untrackable_value <<= 1;
-                buckets_needed++;
+                hdr_atomic_add_fetch_64(&h->percentile_index[i - 1], value);
             }
-
-            return buckets_needed;
         }
 
-        /* ##     ## ######## ##     ##  #######  ########  ##    ## */
-        /* ###   ### ##       ###   ### ##     ## ##     ##  ##  ##  */
-        /* #### #### ##       #### #### ##     ## ##     ##   ####   */
-        /* ## ### ## ######   ## ### ## ##     ## ########     ##    */
-        /* ##     ## ##       ##     ## ##     ## ##   ##      ##    */
-        /* ##     ## ##       ##     ## ##     ## ##    ##     ##    */
-        /* ##     ## ######## ##     ##  #######  ##     ##    ##    */
+        static bool counts_inc_narrow(hdr_histogram* h, s32 normalised_index, s64 value)
+        {
+            const s64 count = counts_get_direct(h, normalised_index) + value;
+            if (HDR_WORD_SIZE_PACKED == h->counts_word_size)
+            {
+                return packed_set(h->packed, h->allocator, normalised_index, count);
+            }
+            if (HDR_WORD_SIZE_PAGED == h->counts_word_size)
+            {
+                return paged_set(h->pages, page_shift(h->sub_bucket_half_count_magnitude), h->allocator, normalised_index, count);
+            }
+            if (!count_fits_word(count, h->counts_word_size) && !counts_promote(h, count))
+            {
+                return false;
+            }
 
-        s32 hdr_calculate_bucket_config(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, struct hdr_histogram_bucket_config* cfg)
+            counts_set_direct(h, normalised_index, count);
+            return true;
+        }
+
+        static bool counts_inc_normalised(hdr_histogram* h, s32 index, s64 value)
         {
-            s32 sub_bucket_count_magnitude;
-            s64 largest_value_with_single_unit_resolution;
+            s32 normalised_index = normalize_index(h, index);
+            if (h->counts_word_size == sizeof(s64))
+            {
+                h->counts[normalised_index] += value;
+            }
+            else if (HDR_WORD_SIZE_PAGED == h->counts_word_size && paged_inc(h->pages, page_shift(h->sub_bucket_half_count_magnitude), normalised_index, value))
+            {
+                // Added to an allocated page
+            }
+            else if (!counts_inc_narrow(h, normalised_index, value))
+            {
+                return false;
+            }
+            h->total_count += value;
+            if (value < 0)
+            {
+                // A removal followed by a record leaves the total as it was, see hdr_summary
+                h->version++;
+            }
+            dirty_mark(h, index);
+            if (h->occupancy)
+            {
+                occupancy_set(h, index);
+            }
+            if (h->percentile_index)
+            {
+                percentile_index_add(h, index, value);
+            }
+            if (h->flags & HDR_RUNNING_SUMS)
+            {
+                running_sums_add(h, index, value);
+            }
+            return true;
+        }
 
-            if (lowest_discernible_value < 1 || significant_figures < 1 || 5 < significant_figures || lowest_discernible_value * 2 > highest_trackable_value)
+        static bool counts_inc_normalised_atomic(hdr_histogram* h, s32 index, s64 value)
+        {
+            s32 normalised_index = normalize_index(h, index);
+            switch (h->counts_word_size)
             {
-                return EINVAL;
+                case HDR_WORD_SIZE_PACKED:
+                case HDR_WORD_SIZE_PAGED:
+                {
+                    // Packed counts move around when a block grows, pages are allocated when
+                    // first written, neither can be done safely while other threads record.
+                    return false;
+                }
+                case sizeof(s16):
+                {
+                    // Narrow counts can not be promoted while other threads are recording,
+                    // a count that would overflow is rejected instead.
+                    s16 current = h->counts16[normalised_index];
+                    do
+                    {
+                        if (!count_fits_word((s64)current + value, sizeof(s16)))
+                        {
+                            return false;
+                        }
+                    } while (!hdr_atomic_compare_exchange_16(&h->counts16[normalised_index], &current, (s16)(current + value)));
+                    break;
+                }
+                case sizeof(s32):
+                {
+                    s32 current = h->counts32[normalised_index];
+                    do
+                    {
+                        if (!count_fits_word((s64)current + value, sizeof(s32)))
+                        {
+                            return false;
+                        }
+                    } while (!hdr_atomic_compare_exchange_32(&h->counts32[normalised_index], &current, (s32)(current + value)));
+                    break;
+                }
+                default: hdr_atomic_add_fetch_64(&h->counts[normalised_index], value); break;
+            }
+            hdr_atomic_add_fetch_64(&h->total_count, value);
+            if (value < 0)
+            {
+                hdr_atomic_add_fetch_64(&h->version, 1);
+            }
+            dirty_mark_atomic(h, index);
+            if (h->occupancy)
+            {
+                occupancy_set_atomic(h, index);
+            }
+            if (h->percentile_index)
+            {
+                percentile_index_add_atomic(h, index, value);
+            }
+            if (h->flags & HDR_RUNNING_SUMS)
+            {
+                running_sums_add_atomic(h, index, value);
             }
+            return true;
+        }
 
-            cfg->lowest_discernible_value = lowest_discernible_value;
-            cfg->significant_figures      = significant_figures;
-            cfg->highest_trackable_value  = highest_trackable_value;
+        static void update_min_max(hdr_histogram* h, s64 value)
+        {
+            h->min_value = (value < h->min_value && value != 0) ? value : h->min_value;
+            h->max_value = (value > h->max_value) ? value : h->max_value;
+        }
 
-            largest_value_with_single_unit_resolution = 2 * power(10, significant_figures);
-            sub_bucket_count_magnitude                = (s32)ceil(log((f64)largest_value_with_single_unit_resolution) / log(2));
-            cfg->sub_bucket_half_count_magnitude      = ((sub_bucket_count_magnitude > 1) ? sub_bucket_count_magnitude : 1) - 1;
+        static void update_min_max_atomic(hdr_histogram* h, s64 value)
+        {
+            // Only attempt the CAS when the value actually widens the range, the common
+            // case of a value inside [min, max] is a plain load for each bound.
+            s64 current_min_value = hdr_atomic_load_64(&h->min_value);
+            while (0 != value && value < current_min_value)
+            {
+                if (hdr_atomic_compare_exchange_64(&h->min_value, &current_min_value, value))
+                {
+                    break;
+                }
+            }
 
-            f64 unit_magnitude = log((f64)lowest_discernible_value) / log(2);
-            if (limits_t<s32>::maximum() < unit_magnitude)
+            s64 current_max_value = hdr_atomic_load_64(&h->max_value);
+            while (value > current_max_value)
             {
-                return EINVAL;
+                if (hdr_atomic_compare_exchange_64(&h->max_value, &current_max_value, value))
+                {
+                    break;
+                }
             }
+        }
 
-            cfg->unit_magnitude        = (s32)unit_magnitude;
-            cfg->sub_bucket_count      = (s32)pow(2, (cfg->sub_bucket_half_count_magnitude + 1));
-            cfg->sub_bucket_half_count = cfg->sub_bucket_count / 2;
-            cfg->sub_bucket_mask       = ((s64)cfg->sub_bucket_count - 1) << cfg->unit_magnitude;
+        /* ##     ## ######## #### ##       #### ######## ##    ## */
+        /* ##     ##    ##     ##  ##        ##     ##     ##  ##  */
+        /* ##     ##    ##     ##  ##        ##     ##      ####   */
+        /* ##     ##    ##     ##  ##        ##     ##       ##    */
+        /* ##     ##    ##     ##  ##        ##     ##       ##    */
+        /* ##     ##    ##     ##  ##        ##     ##       ##    */
+        /*  #######     ##    #### ######## ####    ##       ##    */
 
-            if (cfg->unit_magnitude + cfg->sub_bucket_half_count_magnitude > 61)
+        static s64 power(s64 base, s64 exp)
+        {
+            s64 result = 1;
+            while (exp)
             {
-                return EINVAL;
+                result *= base;
+                exp--;
             }
+            return result;
+        }
 
-            cfg->bucket_count = buckets_needed_to_cover_value(highest_trackable_value, cfg->sub_bucket_count, (s32)cfg->unit_magnitude);
-            cfg->counts_len   = (cfg->bucket_count + 1) * (cfg->sub_bucket_count / 2);
+#if defined(_MSC_VER) && !(defined(__clang__) && (defined(_M_ARM) || defined(_M_ARM64)))
+#    if defined(_WIN64)
+#        pragma intrinsic(_BitScanReverse64)
+#        pragma intrinsic(_BitScanForward64)
+#    else
+#        pragma intrinsic(_BitScanReverse)
+#        pragma intrinsic(_BitScanForward)
+#    endif
+#endif
 
-            return 0;
+        static s32 count_leading_zeros_64(s64 value)
+        {
+#if defined(_MSC_VER) && !(defined(__clang__) && (defined(_M_ARM) || defined(_M_ARM64)))
+            uint32_t leading_zero = 0;
+#    if defined(_WIN64)
+            _BitScanReverse64(&leading_zero, value);
+#    else
+            uint32_t high = value >> 32;
+            if (_BitScanReverse(&leading_zero, high))
+            {
+                leading_zero += 32;
+            }
+            else
+            {
+                uint32_t low = value & 0x00000000FFFFFFFF;
+                _BitScanReverse(&leading_zero, low);
+            }
+#    endif
+            return 63 - leading_zero; /* smallest power of 2 containing value */
+#else
+            return __builtin_clzll(value); /* smallest power of 2 containing value */
+#endif
         }
 
-        void hdr_init_preallocated(hdr_histogram* h, struct hdr_histogram_bucket_config* cfg)
+        static s32 count_trailing_zeros_64(u64 value)
         {
-            h->lowest_discernible_value        = cfg->lowest_discernible_value;
-            h->highest_trackable_value         = cfg->highest_trackable_value;
-            h->unit_magnitude                  = (s32)cfg->unit_magnitude;
-            h->significant_figures             = (s32)cfg->significant_figures;
-            h->sub_bucket_half_count_magnitude = cfg->sub_bucket_half_count_magnitude;
-            h->sub_bucket_half_count           = cfg->sub_bucket_half_count;
-            h->sub_bucket_mask                 = cfg->sub_bucket_mask;
-            h->sub_bucket_count                = cfg->sub_bucket_count;
-            h->min_value                       = limits_t<s64>::maximum();
-            h->max_value                       = 0;
-            h->normalizing_index_offset        = 0;
-            h->conversion_ratio                = 1.0;
-            h->bucket_count                    = cfg->bucket_count;
-            h->counts_len                      = cfg->counts_len;
-            h->total_count                     = 0;
+#if defined(_MSC_VER) && !(defined(__clang__) && (defined(_M_ARM) || defined(_M_ARM64)))
+            unsigned long trailing_zero = 0;
+#    if defined(_WIN64)
+            _BitScanForward64(&trailing_zero, value);
+#    else
+            unsigned long low = (unsigned long)(value & 0x00000000FFFFFFFF);
+            if (!_BitScanForward(&trailing_zero, low))
+            {
+                _BitScanForward(&trailing_zero, (unsigned long)(value >> 32));
+                trailing_zero += 32;
+            }
+#    endif
+            return (s32)trailing_zero;
+#else
+            return __builtin_ctzll(value);
+#endif
         }
 
-        s32 hdr_init(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, hdr_histogram** result)
+        static s32 count_bits_64(u64 value)
         {
-            s64*                               counts;
-            struct hdr_histogram_bucket_config cfg;
-            hdr_histogram*                     histogram;
+#if defined(_MSC_VER) && !defined(__clang__)
+            value = value - ((value >> 1) & 0x5555555555555555ULL);
+            value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+            value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+            return (s32)((value * 0x0101010101010101ULL) >> 56);
+#else
+            return __builtin_popcountll(value);
+#endif
+        }
 
-            s32 r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
-            if (r)
+        // Returns the first index >= 'index' whose occupancy bit is set, or counts_len when
+        // there is none.  Without an occupancy bitmap every index is a candidate.
+        static s32 next_occupied_index(const hdr_histogram* h, s32 index)
+        {
+            if (nullptr == h->occupancy || index >= h->counts_len)
             {
-                return r;
+                return index < h->counts_len ? index : h->counts_len;
             }
 
-            counts = (s64*)hdr_calloc((u64)cfg.counts_len, sizeof(s64));
-            if (!counts)
+            const s32 words = occupancy_words(h->counts_len);
+            s32       word  = index >> 6;
+            u64       bits  = h->occupancy[word] & (~(u64)0 << (index & 63));
+            while (0 == bits)
             {
-                return ENOMEM;
+                if (++word >= words)
+                {
+                    return h->counts_len;
+                }
+                bits = h->occupancy[word];
             }
+            return (word << 6) + count_trailing_zeros_64(bits);
+        }
 
-            histogram = (hdr_histogram*)hdr_calloc(1, sizeof(struct hdr_histogram));
-            if (!histogram)
+        static void occupancy_rebuild(hdr_histogram* h)
+        {
+            nmem::memset(h->occupancy, 0, (u64)occupancy_words(h->counts_len) * sizeof(u64));
+            for (s32 i = h->dirty_lo; i <= h->dirty_hi; i++)
             {
-                hdr_free(counts);
-                return ENOMEM;
+                if (0 != counts_get_normalised(h, i))
+                {
+                    occupancy_set(h, i);
+                }
             }
-
-            histogram->counts = counts;
-
-            hdr_init_preallocated(histogram, &cfg);
-            *result = histogram;
-
-            return 0;
         }
 
-        void hdr_close(hdr_histogram* h)
+        // Moves every occupancy bit from index i to index i + shift, bits that end up outside
+        // of [0, counts_len) are dropped.
+        static void occupancy_shift(hdr_histogram* h, s32 shift)
         {
-            if (h)
+            const s32 words      = occupancy_words(h->counts_len);
+            const s32 word_shift = (shift < 0 ? -shift : shift) >> 6;
+            const s32 bit_shift  = (shift < 0 ? -shift : shift) & 63;
+            if (shift > 0)
+            {
+                for (s32 word = words - 1; word >= 0; word--)
+                {
+                    const s32 from     = word - word_shift;
+                    const u64 high     = from >= 0 ? h->occupancy[from] : 0;
+                    const u64 low      = from >= 1 ? h->occupancy[from - 1] : 0;
+                    h->occupancy[word] = bit_shift ? (high << bit_shift) | (low >> (64 - bit_shift)) : high;
+                }
+            }
+            else
+            {
+                for (s32 word = 0; word < words; word++)
+                {
+                    const s32 from     = word + word_shift;
+                    const u64 low      = from < words ? h->occupancy[from] : 0;
+                    const u64 high     = from + 1 < words ? h->occupancy[from + 1] : 0;
+                    h->occupancy[word] = bit_shift ? (low >> bit_shift) | (high << (64 - bit_shift)) : low;
+                }
+            }
+            if (h->counts_len & 63)
             {
-                hdr_free(h->counts);
-                hdr_free(h);
+                h->occupancy[words - 1] &= ((u64)1 << (h->counts_len & 63)) - 1;
             }
         }
 
-        s32 hdr_alloc(s64 highest_trackable_value, s32 significant_figures, hdr_histogram** result) { return hdr_init(1, highest_trackable_value, significant_figures, result); }
+        static s32 get_bucket_index(const hdr_histogram* h, s64 value)
+        {
+            s32 pow2ceiling = 64 - count_leading_zeros_64(value | h->sub_bucket_mask); /* smallest power of 2 containing value */
+            return pow2ceiling - h->unit_magnitude - (h->sub_bucket_half_count_magnitude + 1);
+        }
 
-        /* reset a histogram to zero. */
-        void hdr_reset(hdr_histogram* h)
+        static s32 get_sub_bucket_index(s64 value, s32 bucket_index, s32 unit_magnitude) { return (s32)(value >> (bucket_index + unit_magnitude)); }
+
+        static s32 counts_index(const hdr_histogram* h, s32 bucket_index, s32 sub_bucket_index)
         {
-            h->total_count = 0;
-            h->min_value   = limits_t<s64>::maximum();
-            h->max_value   = 0;
-            nmem::memset(h->counts, 0, (sizeof(s64) * h->counts_len));
+            /* Calculate the index for the first entry in the bucket: */
+            /* (The following is the equivalent of ((bucket_index + 1) * subBucketHalfCount) ): */
+            s32 bucket_base_index = (bucket_index + 1) << h->sub_bucket_half_count_magnitude;
+            /* Calculate the offset in the bucket: */
+            s32 offset_in_bucket = sub_bucket_index - h->sub_bucket_half_count;
+            /* The following is the equivalent of ((sub_bucket_index  - subBucketHalfCount) + bucketBaseIndex; */
+            return bucket_base_index + offset_in_bucket;
         }
 
-        u64 hdr_get_memory_size(hdr_histogram* h) { return (u64)sizeof(struct hdr_histogram) + (u64)h->counts_len * (u64)sizeof(s64); }
+        static s64 value_from_index(s32 bucket_index, s32 sub_bucket_index, s32 unit_magnitude) { return ((s64)sub_bucket_index) << (bucket_index + unit_magnitude); }
 
-        /* ##     ## ########  ########     ###    ######## ########  ######  */
-        /* ##     ## ##     ## ##     ##   ## ##      ##    ##       ##    ## */
-        /* ##     ## ##     ## ##     ##  ##   ##     ##    ##       ##       */
-        /* ##     ## ########  ##     ## ##     ##    ##    ######    ######  */
-        /* ##     ## ##        ##     ## #########    ##    ##             ## */
-        /* ##     ## ##        ##     ## ##     ##    ##    ##       ##    ## */
-        /*  #######  ##        ########  ##     ##    ##    ########  ######  */
+        static s32 counts_index_for(const hdr_histogram* h, s64 value)
+        {
+            s32 bucket_index     = get_bucket_index(h, value);
+            s32 sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
 
-        bool hdr_record_value(hdr_histogram* h, s64 value) { return hdr_record_values(h, value, 1); }
+            return counts_index(h, bucket_index, sub_bucket_index);
+        }
 
-        bool hdr_record_values(hdr_histogram* h, s64 value, s64 count)
+        s32 hdr_counts_index_for(const hdr_histogram* h, s64 value) { return counts_index_for(h, value); }
+
+        s64 hdr_value_at_index(const hdr_histogram* h, s32 index)
         {
-            s32 counts_index;
+            s32 bucket_index     = (index >> h->sub_bucket_half_count_magnitude) - 1;
+            s32 sub_bucket_index = (index & (h->sub_bucket_half_count - 1)) + h->sub_bucket_half_count;
 
-            if (value < 0)
+            if (bucket_index < 0)
             {
-                return false;
+                sub_bucket_index -= h->sub_bucket_half_count;
+                bucket_index = 0;
             }
 
-            counts_index = counts_index_for(h, value);
+            return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude);
+        }
 
-            if (counts_index < 0 || h->counts_len <= counts_index)
+        // Equal to hdr_median_equivalent_value(h, hdr_value_at_index(h, index))
+        static s64 median_equivalent_value_at_index(const hdr_histogram* h, s32 index)
+        {
+            s32 bucket_index     = (index >> h->sub_bucket_half_count_magnitude) - 1;
+            s32 sub_bucket_index = (index & (h->sub_bucket_half_count - 1)) + h->sub_bucket_half_count;
+
+            if (bucket_index < 0)
             {
-                return false;
+                sub_bucket_index -= h->sub_bucket_half_count;
+                bucket_index = 0;
             }
 
-            counts_inc_normalised(h, counts_index, count);
-            update_min_max(h, value);
+            return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude) + (((s64)1 << (h->unit_magnitude + bucket_index)) >> 1);
+        }
 
-            return true;
+        // The running sums are kept in 128 bits, wrapping around like the native types do.
+        static void u128_add(hdr_u128* a, hdr_u128 b)
+        {
+            const u64 lo = a->lo + b.lo;
+            a->hi += b.hi + (lo < b.lo ? 1 : 0);
+            a->lo = lo;
         }
 
-        bool hdr_record_corrected_value(hdr_histogram* h, s64 value, s64 expected_interval) { return hdr_record_corrected_values(h, value, 1, expected_interval); }
+        static void u128_sub(hdr_u128* a, hdr_u128 b)
+        {
+            const u64 lo = a->lo - b.lo;
+            a->hi -= b.hi + (a->lo < b.lo ? 1 : 0);
+            a->lo = lo;
+        }
+
+        static hdr_u128 u128_mul_64(u64 a, u64 b)
+        {
+            const u64 p0     = (a & 0xffffffff) * (b & 0xffffffff);
+            const u64 p1     = (a & 0xffffffff) * (b >> 32);
+            const u64 p2     = (a >> 32) * (b & 0xffffffff);
+            const u64 p3     = (a >> 32) * (b >> 32);
+            const u64 middle = (p0 >> 32) + (p1 & 0xffffffff) + (p2 & 0xffffffff);
+
+            hdr_u128 r;
+            r.lo = (middle << 32) | (p0 & 0xffffffff);
+            r.hi = p3 + (p1 >> 32) + (p2 >> 32) + (middle >> 32);
+            return r;
+        }
+
+        static hdr_u128 u128_mul(hdr_u128 a, u64 b)
+        {
+            hdr_u128 r = u128_mul_64(a.lo, b);
+            r.hi += a.hi * b;
+            return r;
+        }
+
+        static f64 u128_to_f64(hdr_u128 a) { return (f64)a.hi * 18446744073709551616.0 + (f64)a.lo; }
+
+        // Reads the wrapped around sum of a subtraction as the negative value it stands for
+        static f64 u128_to_f64_signed(hdr_u128 a)
+        {
+            if (0 == (a.hi >> 63))
+            {
+                return u128_to_f64(a);
+            }
+            hdr_u128 negated = {0, 0};
+            u128_sub(&negated, a);
+            return -u128_to_f64(negated);
+        }
+
+        static void running_sums_of(const hdr_histogram* h, s32 index, s64 count, hdr_u128* sum, hdr_u128* sum_squares)
+        {
+            const u64 median = (u64)median_equivalent_value_at_index(h, index);
+            *sum             = u128_mul_64((u64)(count < 0 ? -count : count), median);
+            *sum_squares     = u128_mul(*sum, median);
+        }
+
+        // The deviation of the sums assumes that every count is positive, once a count drops
+        // below zero the mean and the deviation are taken from the buckets until a reset.
+        static void running_sums_add(hdr_histogram* h, s32 index, s64 count)
+        {
+            hdr_u128 sum, sum_squares;
+            running_sums_of(h, index, count, &sum, &sum_squares);
+            if (count < 0)
+            {
+                u128_sub(&h->running_sum, sum);
+                u128_sub(&h->running_sum_squares, sum_squares);
+                if (counts_get_normalised(h, index) < 0)
+                {
+                    h->flags |= HDR_SUMS_INVALID;
+                }
+            }
+            else
+            {
+                u128_add(&h->running_sum, sum);
+                u128_add(&h->running_sum_squares, sum_squares);
+            }
+        }
+
+        // Adds the low words first and carries into the high words, the sums are consistent
+        // once all concurrent writers are done.
+        static void u128_add_atomic(hdr_u128* a, hdr_u128 b)
+        {
+            const u64 lo = (u64)hdr_atomic_add_fetch_64((volatile s64*)&a->lo, (s64)b.lo);
+            const u64 hi = b.hi + (lo < b.lo ? 1 : 0);
+            if (0 != hi)
+            {
+                hdr_atomic_add_fetch_64((volatile s64*)&a->hi, (s64)hi);
+            }
+        }
+
+        static void running_sums_add_atomic(hdr_histogram* h, s32 index, s64 count)
+        {
+            hdr_u128 sum, sum_squares;
+            running_sums_of(h, index, count, &sum, &sum_squares);
+            if (count < 0)
+            {
+                // a - b == a + (~b + 1)
+                sum.hi         = ~sum.hi + (0 == sum.lo ? 1 : 0);
+                sum.lo         = ~sum.lo + 1;
+                sum_squares.hi = ~sum_squares.hi + (0 == sum_squares.lo ? 1 : 0);
+                sum_squares.lo = ~sum_squares.lo + 1;
+
+                // Other threads may move the count either way, any removal gives up on the sums
+                s32 flags = (s32)h->flags;
+                while (0 == (flags & (s32)HDR_SUMS_INVALID) && !hdr_atomic_compare_exchange_32((volatile s32*)&h->flags, &flags, flags | (s32)HDR_SUMS_INVALID))
+                {
+                }
+            }
+            u128_add_atomic(&h->running_sum, sum);
+            u128_add_atomic(&h->running_sum_squares, sum_squares);
+        }
+
+        static void running_sums_rebuild(hdr_histogram* h)
+        {
+            h->flags &= ~HDR_SUMS_INVALID;
+            h->running_sum.lo = h->running_sum.hi = 0;
+            h->running_sum_squares.lo = h->running_sum_squares.hi = 0;
+            for (s32 i = next_occupied_index(h, h->dirty_lo); i <= h->dirty_hi; i = next_occupied_index(h, i + 1))
+            {
+                const s64 count = counts_get_normalised(h, i);
+                if (0 != count)
+                {
+                    running_sums_add(h, i, count);
+                }
+            }
+        }
+
+        s64 hdr_size_of_equivalent_value_range(const hdr_histogram* h, s64 value)
+        {
+            s32 bucket_index     = get_bucket_index(h, value);
+            s32 sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
+            s32 adjusted_bucket  = (sub_bucket_index >= h->sub_bucket_count) ? (bucket_index + 1) : bucket_index;
+            return (s64)(1) << (h->unit_magnitude + adjusted_bucket);
+        }
+
+        static s64 size_of_equivalent_value_range_given_bucket_indices(const hdr_histogram* h, s32 bucket_index, s32 sub_bucket_index)
+        {
+            const s32 adjusted_bucket = (sub_bucket_index >= h->sub_bucket_count) ? (bucket_index + 1) : bucket_index;
+            return (s64)(1) << (h->unit_magnitude + adjusted_bucket);
+        }
+
+        static s64 lowest_equivalent_value(const hdr_histogram* h, s64 value)
+        {
+            s32 bucket_index     = get_bucket_index(h, value);
+            s32 sub_bucket_index = get_sub_bucket_index(value, bucket_index, h->unit_magnitude);
+            return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude);
+        }
+
+        static s64 lowest_equivalent_value_given_bucket_indices(const hdr_histogram* h, s32 bucket_index, s32 sub_bucket_index) { return value_from_index(bucket_index, sub_bucket_index, h->unit_magnitude); }
+
+        s64 hdr_next_non_equivalent_value(const hdr_histogram* h, s64 value) { return lowest_equivalent_value(h, value) + hdr_size_of_equivalent_value_range(h, value); }
+
+        static s64 highest_equivalent_value(const hdr_histogram* h, s64 value) { return hdr_next_non_equivalent_value(h, value) - 1; }
+
+        s64 hdr_median_equivalent_value(const hdr_histogram* h, s64 value) { return lowest_equivalent_value(h, value) + (hdr_size_of_equivalent_value_range(h, value) >> 1); }
+
+        static s64 non_zero_min(const hdr_histogram* h)
+        {
+            if (limits_t<s64>::maximum() == h->min_value)
+            {
+                return limits_t<s64>::maximum();
+            }
+
+            return lowest_equivalent_value(h, h->min_value);
+        }
+
+        static s64 percentile_index_prefix_sum(const hdr_histogram* h, s32 index)
+        {
+            s64 sum = 0;
+            for (s32 i = index + 1; i > 0; i -= i & -i)
+            {
+                sum += h->percentile_index[i - 1];
+            }
+            return sum;
+        }
+
+        // Returns the first index at which the cumulative count reaches 'count', or
+        // counts_len when the histogram holds less than 'count' values.
+        static s32 percentile_index_search(const hdr_histogram* h, s64 count)
+        {
+            s32 index = 0;
+            for (s32 step = (s32)1 << (63 - count_leading_zeros_64(h->counts_len)); step != 0; step >>= 1)
+            {
+                const s32 next = index + step;
+                if (next <= h->counts_len && h->percentile_index[next - 1] < count)
+                {
+                    index = next;
+                    count -= h->percentile_index[next - 1];
+                }
+            }
+            return index;
+        }
+
+        static void percentile_index_rebuild(hdr_histogram* h)
+        {
+            for (s32 i = 0; i < h->counts_len; i++)
+            {
+                h->percentile_index[i] = counts_get_normalised(h, i);
+            }
+            for (s32 i = 1; i <= h->counts_len; i++)
+            {
+                const s32 parent = i + (i & -i);
+                if (parent <= h->counts_len)
+                {
+                    h->percentile_index[parent - 1] += h->percentile_index[i - 1];
+                }
+            }
+        }
+
+        void hdr_reset_internal_counters(hdr_histogram* h)
+        {
+            s32 min_non_zero_index   = -1;
+            s32 min_index            = -1;
+            s32 max_index            = -1;
+            s64 observed_total_count = 0;
+            s32 i;
+
+            // The counts may have been written directly, all of them are scanned and the dirty
+            // range is rebuilt from what is found.
+            for (i = 0; i < h->counts_len; i++)
+            {
+                s64 count_at_index;
+
+                if ((count_at_index = counts_get_normalised(h, i)) > 0)
+                {
+                    observed_total_count += count_at_index;
+                    min_index = min_index == -1 ? i : min_index;
+                    max_index = i;
+                    if (min_non_zero_index == -1 && i != 0)
+                    {
+                        min_non_zero_index = i;
+                    }
+                }
+            }
+
+            if (max_index == -1)
+            {
+                h->max_value = 0;
+            }
+            else
+            {
+                s64 max_value = hdr_value_at_index(h, max_index);
+                h->max_value  = highest_equivalent_value(h, max_value);
+            }
+
+            if (min_non_zero_index == -1)
+            {
+                h->min_value = limits_t<s64>::maximum();
+            }
+            else
+            {
+                h->min_value = hdr_value_at_index(h, min_non_zero_index);
+            }
+
+            h->total_count = observed_total_count;
+            h->version++;
+
+            dirty_clear(h);
+            if (0 != h->normalizing_index_offset)
+            {
+                dirty_mark_range(h, 0, h->counts_len - 1);
+            }
+            else if (max_index >= 0)
+            {
+                dirty_mark_range(h, min_index, max_index);
+            }
+
+            if (h->occupancy)
+            {
+                occupancy_rebuild(h);
+            }
+            if (h->percentile_index)
+            {
+                percentile_index_rebuild(h);
+            }
+            if (h->flags & HDR_RUNNING_SUMS)
+            {
+                running_sums_rebuild(h);
+            }
+        }
+
+        static s32 buckets_needed_to_cover_value(s64 value, s32 sub_bucket_count, s32 unit_magnitude)
+        {
+            s64 smallest_untrackable_value = ((s64)sub_bucket_count) << unit_magnitude;
+            s32 buckets_needed             = 1;
+            while (smallest_untrackable_value <= value)
+            {
+                if (smallest_untrackable_value > limits_t<s64>::maximum() / 2)
+                {
+                    return buckets_needed + 1;
+                }
+                smallest_untrackable_value <<= 1;
+                buckets_needed++;
+            }
+
+            return buckets_needed;
+        }
+
+        /* ##     ## ######## ##     ##  #######  ########  ##    ## */
+        /* ###   ### ##       ###   ### ##     ## ##     ##  ##  ##  */
+        /* #### #### ##       #### #### ##     ## ##     ##   ####   */
+        /* ## ### ## ######   ## ### ## ##     ## ########     ##    */
+        /* ##     ## ##       ##     ## ##     ## ##   ##      ##    */
+        /* ##     ## ##       ##     ## ##     ## ##    ##     ##    */
+        /* ##     ## ######## ##     ##  #######  ##     ##    ##    */
+
+        s32 hdr_calculate_bucket_config(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, struct hdr_histogram_bucket_config* cfg)
+        {
+            s32 sub_bucket_count_magnitude;
+            s64 largest_value_with_single_unit_resolution;
+
+            if (lowest_discernible_value < 1 || significant_figures < 1 || 5 < significant_figures || lowest_discernible_value * 2 > highest_trackable_value)
+            {
+                return EINVAL;
+            }
+
+            cfg->lowest_discernible_value = lowest_discernible_value;
+            cfg->significant_figures      = significant_figures;
+            cfg->highest_trackable_value  = highest_trackable_value;
+
+            largest_value_with_single_unit_resolution = 2 * power(10, significant_figures);
+            sub_bucket_count_magnitude                = (s32)ceil(log((f64)largest_value_with_single_unit_resolution) / log(2));
+            cfg->sub_bucket_half_count_magnitude      = ((sub_bucket_count_magnitude > 1) ? sub_bucket_count_magnitude : 1) - 1;
+
+            f64 unit_magnitude = log((f64)lowest_discernible_value) / log(2);
+            if (limits_t<s32>::maximum() < unit_magnitude)
+            {
+                return EINVAL;
+            }
+
+            cfg->unit_magnitude        = (s32)unit_magnitude;
+            cfg->sub_bucket_count      = (s32)pow(2, (cfg->sub_bucket_half_count_magnitude + 1));
+            cfg->sub_bucket_half_count = cfg->sub_bucket_count / 2;
+            cfg->sub_bucket_mask       = ((s64)cfg->sub_bucket_count - 1) << cfg->unit_magnitude;
+
+            if (cfg->unit_magnitude + cfg->sub_bucket_half_count_magnitude > 61)
+            {
+                return EINVAL;
+            }
+
+            cfg->bucket_count = buckets_needed_to_cover_value(highest_trackable_value, cfg->sub_bucket_count, (s32)cfg->unit_magnitude);
+            cfg->counts_len   = (cfg->bucket_count + 1) * (cfg->sub_bucket_count / 2);
+
+            return 0;
+        }
+
+        void hdr_init_preallocated(hdr_histogram* h, struct hdr_histogram_bucket_config* cfg)
+        {
+            h->lowest_discernible_value        = cfg->lowest_discernible_value;
+            h->highest_trackable_value         = cfg->highest_trackable_value;
+            h->unit_magnitude                  = (s32)cfg->unit_magnitude;
+            h->significant_figures             = (s32)cfg->significant_figures;
+            h->sub_bucket_half_count_magnitude = cfg->sub_bucket_half_count_magnitude;
+            h->sub_bucket_half_count           = cfg->sub_bucket_half_count;
+            h->sub_bucket_mask                 = cfg->sub_bucket_mask;
+            h->sub_bucket_count                = cfg->sub_bucket_count;
+            h->min_value                       = limits_t<s64>::maximum();
+            h->max_value                       = 0;
+            h->normalizing_index_offset        = 0;
+            h->conversion_ratio                = 1.0;
+            h->bucket_count                    = cfg->bucket_count;
+            h->counts_len                      = cfg->counts_len;
+            h->total_count                     = 0;
+            h->version                         = 0;
+            h->counts_word_size                = sizeof(s64);
+            h->flags                           = 0;
+            h->occupancy                       = nullptr;
+            h->percentile_index                = nullptr;
+            h->allocator                       = nullptr;
+            dirty_clear(h);
+        }
+
+        u64 hdr_get_preallocated_size(const struct hdr_histogram_bucket_config* cfg) { return hdr_get_preallocated_size(cfg, 0); }
+
+        u64 hdr_get_preallocated_size(const struct hdr_histogram_bucket_config* cfg, u32 flags) { return header_size() + tables_size(cfg->counts_len, flags) + counts_size(cfg->counts_len, counts_word_size_for_flags(flags), cfg->sub_bucket_half_count_magnitude); }
+
+        hdr_histogram* hdr_init_preallocated(void* mem, u64 mem_size, struct hdr_histogram_bucket_config* cfg) { return hdr_init_preallocated(mem, mem_size, cfg, 0); }
+
+        // Places the histogram in 'mem', the packed and paged counts of a histogram placed by
+        // hdr_init are left to grow from its allocator.
+        static hdr_histogram* place_histogram(void* mem, u64 mem_size, struct hdr_histogram_bucket_config* cfg, u32 flags)
+        {
+            const u64 size = hdr_get_preallocated_size(cfg, flags);
+            if (nullptr == mem || mem_size < size || 0 != ((u64)mem & (sizeof(s64) - 1)))
+            {
+                return nullptr;
+            }
+
+            nmem::memset(mem, 0, size);
+
+            hdr_histogram* h = (hdr_histogram*)mem;
+            hdr_init_preallocated(h, cfg);
+            h->flags            = flags & ~HDR_INTERNAL_FLAGS;
+            h->counts           = (s64*)tables_bind(h, (u8*)mem + header_size());
+            h->counts_word_size = counts_word_size_for_flags(flags);
+            return h;
+        }
+
+        hdr_histogram* hdr_init_preallocated(void* mem, u64 mem_size, struct hdr_histogram_bucket_config* cfg, u32 flags)
+        {
+            // Packed blocks and count pages grow from the allocator, a caller provided buffer has none
+            if (flags & (HDR_COUNTS_PACKED | HDR_COUNTS_PAGED))
+            {
+                return nullptr;
+            }
+            return place_histogram(mem, mem_size, cfg, flags);
+        }
+
+        void hdr_bind_preallocated(hdr_histogram* h, void* mem)
+        {
+            h->counts    = (s64*)tables_bind(h, (u8*)mem + header_size());
+            h->allocator = nullptr;
+        }
+
+        s32 hdr_init(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, hdr_histogram** result)
+        {
+            return hdr_init(lowest_discernible_value, highest_trackable_value, significant_figures, context_t::system_alloc(), result);
+        }
+
+        s32 hdr_init(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, alloc_t* allocator, hdr_histogram** result)
+        {
+            return hdr_init(lowest_discernible_value, highest_trackable_value, significant_figures, allocator, 0, result);
+        }
+
+        s32 hdr_init(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, alloc_t* allocator, u32 flags, hdr_histogram** result)
+        {
+            struct hdr_histogram_bucket_config cfg;
+
+            s32 r = hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg);
+            if (r)
+            {
+                return r;
+            }
+
+            if (0 == (flags & HDR_AUTO_PROMOTE))
+            {
+                const u64 size = hdr_get_preallocated_size(&cfg, flags);
+                void*     mem  = allocate_block(allocator, size);
+                if (!mem)
+                {
+                    return ENOMEM;
+                }
+
+                hdr_histogram* histogram = place_histogram(mem, size, &cfg, flags);
+                histogram->allocator     = allocator;
+                *result                  = histogram;
+                return 0;
+            }
+
+            const s32 word_size = counts_word_size_for_flags(flags);
+            void*     counts    = allocate_block(allocator, counts_size(cfg.counts_len, word_size, cfg.sub_bucket_half_count_magnitude));
+            if (!counts)
+            {
+                return ENOMEM;
+            }
+
+            const u64      size      = header_size() + tables_size(cfg.counts_len, flags);
+            hdr_histogram* histogram = (hdr_histogram*)allocate_block(allocator, size);
+            if (!histogram)
+            {
+                allocator->deallocate(counts);
+                return ENOMEM;
+            }
+
+            nmem::memset(counts, 0, counts_size(cfg.counts_len, word_size, cfg.sub_bucket_half_count_magnitude));
+            nmem::memset(histogram, 0, size);
+            hdr_init_preallocated(histogram, &cfg);
+            histogram->flags = (flags & ~HDR_INTERNAL_FLAGS) | HDR_COUNTS_ALLOCATED;
+            tables_bind(histogram, (u8*)histogram + header_size());
+            histogram->counts           = (s64*)counts;
+            histogram->counts_word_size = word_size;
+            histogram->allocator        = allocator;
+            *result                     = histogram;
+
+            return 0;
+        }
+
+        s32 hdr_init_copy(const hdr_histogram* from, alloc_t* allocator, u32 flags, hdr_histogram** result)
+        {
+            hdr_histogram* h = nullptr;
+            s32            r = hdr_init(from->lowest_discernible_value, from->highest_trackable_value, from->significant_figures, allocator, flags, &h);
+            if (r)
+            {
+                return r;
+            }
+
+            if (0 != hdr_add(h, from))
+            {
+                hdr_close(h);
+                return (flags & (HDR_COUNTS_PACKED | HDR_COUNTS_PAGED)) ? ENOMEM : EINVAL;
+            }
+            *result = h;
+            return 0;
+        }
+
+        void hdr_close(hdr_histogram* h)
+        {
+            if (h && h->allocator)
+            {
+                if (HDR_WORD_SIZE_PACKED == h->counts_word_size)
+                {
+                    packed_release(h->packed, h->counts_len, h->allocator);
+                }
+                if (HDR_WORD_SIZE_PAGED == h->counts_word_size)
+                {
+                    paged_release(h->pages, h->counts_len, page_shift(h->sub_bucket_half_count_magnitude), h->allocator);
+                }
+                if (h->flags & HDR_COUNTS_ALLOCATED)
+                {
+                    h->allocator->deallocate(h->counts);
+                }
+                if (h->flags & HDR_TABLES_ALLOCATED)
+                {
+                    h->allocator->deallocate(h->occupancy);
+                }
+                h->allocator->deallocate(h);
+            }
+        }
+
+        static bool counts_promote(hdr_histogram* h, s64 required_count)
+        {
+            if (0 == (h->flags & HDR_AUTO_PROMOTE) || nullptr == h->allocator)
+            {
+                return false;
+            }
+
+            s32 word_size = h->counts_word_size;
+            while (!count_fits_word(required_count, word_size))
+            {
+                word_size *= 2;
+            }
+
+            s64* counts = (s64*)allocate_block(h->allocator, counts_size(h->counts_len, word_size, h->sub_bucket_half_count_magnitude));
+            if (!counts)
+            {
+                return false;
+            }
+
+            nmem::memset(counts, 0, counts_size(h->counts_len, word_size, h->sub_bucket_half_count_magnitude));
+            for (s32 i = h->dirty_lo; i <= h->dirty_hi; i++)
+            {
+                const s32 normalised_index = normalize_index(h, i);
+                const s64 count            = counts_get_direct(h, normalised_index);
+                switch (word_size)
+                {
+                    case sizeof(s32): ((s32*)counts)[normalised_index] = (s32)count; break;
+                    default: counts[normalised_index] = count; break;
+                }
+            }
+
+            if (h->flags & HDR_COUNTS_ALLOCATED)
+            {
+                h->allocator->deallocate(h->counts);
+            }
+            h->counts           = counts;
+            h->counts_word_size = word_size;
+            h->flags |= HDR_COUNTS_ALLOCATED;
+            return true;
+        }
+
+        // Grows the counts, and the side tables, so that 'value' can be recorded.  The counts
+        // are copied in logical order which leaves the resized histogram without an offset.
+        static bool counts_resize(hdr_histogram* h, s64 value)
+        {
+            if (0 == (h->flags & HDR_AUTO_RESIZE) || nullptr == h->allocator)
+            {
+                return false;
+            }
+
+            struct hdr_histogram_bucket_config cfg;
+            if (0 != hdr_calculate_bucket_config(h->lowest_discernible_value, value, h->significant_figures, &cfg))
+            {
+                return false;
+            }
+
+            const u64 tables = tables_size(cfg.counts_len, h->flags);
+            const u64 size   = tables + counts_size(cfg.counts_len, h->counts_word_size, cfg.sub_bucket_half_count_magnitude);
+            u8*       mem    = (u8*)allocate_block(h->allocator, size);
+            if (!mem)
+            {
+                return false;
+            }
+            nmem::memset(mem, 0, size);
+
+            u8* counts = mem + tables;
+            for (s32 i = h->dirty_lo; i <= h->dirty_hi; i++)
+            {
+                const s64 count = counts_get_normalised(h, i);
+                switch (h->counts_word_size)
+                {
+                    case HDR_WORD_SIZE_PACKED:
+                        if (!packed_set((hdr_packed_block*)counts, h->allocator, i, count))
+                        {
+                            packed_release((hdr_packed_block*)counts, cfg.counts_len, h->allocator);
+                            h->allocator->deallocate(mem);
+                            return false;
+                        }
+                        break;
+                    case HDR_WORD_SIZE_PAGED:
+                        if (!paged_set((s64**)counts, page_shift(cfg.sub_bucket_half_count_magnitude), h->allocator, i, count))
+                        {
+                            paged_release((s64**)counts, cfg.counts_len, page_shift(cfg.sub_bucket_half_count_magnitude), h->allocator);
+                            h->allocator->deallocate(mem);
+                            return false;
+                        }
+                        break;
+                    case sizeof(s16): ((s16*)counts)[i] = (s16)count; break;
+                    case sizeof(s32): ((s32*)counts)[i] = (s32)count; break;
+                    default: ((s64*)counts)[i] = count; break;
+                }
+            }
+
+            if (HDR_WORD_SIZE_PACKED == h->counts_word_size)
+            {
+                packed_release(h->packed, h->counts_len, h->allocator);
+            }
+            if (HDR_WORD_SIZE_PAGED == h->counts_word_size)
+            {
+                paged_release(h->pages, h->counts_len, page_shift(h->sub_bucket_half_count_magnitude), h->allocator);
+            }
+            if (h->flags & HDR_COUNTS_ALLOCATED)
+            {
+                h->allocator->deallocate(h->counts);
+            }
+            if (h->flags & HDR_TABLES_ALLOCATED)
+            {
+                h->allocator->deallocate(h->occupancy);
+            }
+
+            h->flags                    = (h->flags & ~HDR_COUNTS_ALLOCATED) | HDR_TABLES_ALLOCATED;
+            h->highest_trackable_value  = cfg.highest_trackable_value;
+            h->bucket_count             = cfg.bucket_count;
+            h->counts_len               = cfg.counts_len;
+            h->normalizing_index_offset = 0;
+            h->counts                   = (s64*)tables_bind(h, mem);
+
+            // The pages are a fraction of counts_len, the range is flagged again at the new size
+            const s32 dirty_lo = h->dirty_lo;
+            const s32 dirty_hi = h->dirty_hi;
+            dirty_clear(h);
+            dirty_mark_range(h, dirty_lo, dirty_hi);
+
+            occupancy_rebuild(h);
+            if (h->percentile_index)
+            {
+                percentile_index_rebuild(h);
+            }
+            return true;
+        }
+
+        s32 hdr_alloc(s64 highest_trackable_value, s32 significant_figures, hdr_histogram** result) { return hdr_init(1, highest_trackable_value, significant_figures, result); }
+
+        /* reset a histogram to zero. */
+        static void counts_zero(hdr_histogram* h, s32 begin, s32 end)
+        {
+            if (HDR_WORD_SIZE_PACKED == h->counts_word_size)
+            {
+                packed_clear(h->packed, begin, end);
+            }
+            else if (HDR_WORD_SIZE_PAGED == h->counts_word_size)
+            {
+                paged_clear(h->pages, page_shift(h->sub_bucket_half_count_magnitude), begin, end);
+            }
+            else
+            {
+                nmem::memset((u8*)h->counts + (u64)begin * h->counts_word_size, 0, (u64)(end - begin) * h->counts_word_size);
+            }
+        }
+
+        // Clears the counts in [begin, end), skipping the chunks of 64 counts that the
+        // occupancy bitmap guarantees to be zero.  Without an offset only.
+        static void counts_clear_range(hdr_histogram* h, s32 begin, s32 end)
+        {
+            if (nullptr == h->occupancy)
+            {
+                counts_zero(h, begin, end);
+                return;
+            }
+
+            for (s32 word = begin >> 6; (word << 6) < end; word++)
+            {
+                if (0 != h->occupancy[word])
+                {
+                    const s32 chunk_begin = (word << 6) > begin ? (word << 6) : begin;
+                    const s32 chunk_end   = (word << 6) + 64 < end ? (word << 6) + 64 : end;
+                    counts_zero(h, chunk_begin, chunk_end);
+                    h->occupancy[word] = 0;
+                }
+            }
+        }
+
+        void hdr_reset(hdr_histogram* h)
+        {
+            if (0 == h->normalizing_index_offset)
+            {
+                // Only the dirty pages, clipped to the dirty range, can hold a non-zero count
+                const s32 shift = dirty_page_shift(h->counts_len);
+                for (u64 pages = h->dirty_pages; 0 != pages; pages &= pages - 1)
+                {
+                    const s32 page  = count_trailing_zeros_64(pages);
+                    const s32 begin = (page << shift) > h->dirty_lo ? (page << shift) : h->dirty_lo;
+                    const s32 end   = (page << shift) + (1 << shift) <= h->dirty_hi ? (page << shift) + (1 << shift) : h->dirty_hi + 1;
+                    if (begin < end)
+                    {
+                        counts_clear_range(h, begin, end);
+                    }
+                }
+            }
+            else
+            {
+                counts_zero(h, 0, h->counts_len);
+                if (h->occupancy)
+                {
+                    nmem::memset(h->occupancy, 0, (u64)occupancy_words(h->counts_len) * sizeof(u64));
+                }
+            }
+
+            h->total_count              = 0;
+            h->min_value                = limits_t<s64>::maximum();
+            h->max_value                = 0;
+            h->normalizing_index_offset = 0;
+            h->version++;
+            if (h->percentile_index && h->dirty_lo < h->counts_len)
+            {
+                // A count at index i only ever adds to the tree nodes at i and above
+                nmem::memset(h->percentile_index + h->dirty_lo, 0, (u64)(h->counts_len - h->dirty_lo) * sizeof(s64));
+            }
+            dirty_clear(h);
+            h->flags &= ~HDR_SUMS_INVALID;
+            h->running_sum.lo = h->running_sum.hi = 0;
+            h->running_sum_squares.lo = h->running_sum_squares.hi = 0;
+        }
+
+        u64 hdr_get_memory_size(hdr_histogram* h)
+        {
+            const u64 size = header_size() + tables_size(h->counts_len, h->flags) + counts_size(h->counts_len, h->counts_word_size, h->sub_bucket_half_count_magnitude);
+            switch (h->counts_word_size)
+            {
+                case HDR_WORD_SIZE_PACKED: return size + packed_data_size(h->packed, h->counts_len);
+                case HDR_WORD_SIZE_PAGED: return size + paged_data_size(h->pages, h->counts_len, page_shift(h->sub_bucket_half_count_magnitude));
+                default: return size;
+            }
+        }
+
+        /* ##     ## ########  ########     ###    ######## ########  ######  */
+        /* ##     ## ##     ## ##     ##   ## ##      ##    ##       ##    ## */
+        /* ##     ## ##     ## ##     ##  ##   ##     ##    ##       ##       */
+        /* ##     ## ########  ##     ## ##     ##    ##    ######    ######  */
+        /* ##     ## ##        ##     ## #########    ##    ##             ## */
+        /* ##     ## ##        ##     ## ##     ##    ##    ##       ##    ## */
+        /*  #######  ##        ########  ##     ##    ##    ########  ######  */
+
+        bool hdr_record_value(hdr_histogram* h, s64 value) { return hdr_record_values(h, value, 1); }
+
+        bool hdr_record_values(hdr_histogram* h, s64 value, s64 count)
+        {
+            s32 counts_index;
+
+            if (value < 0)
+            {
+                return false;
+            }
+
+            counts_index = counts_index_for(h, value);
+
+            if (counts_index < 0 || (h->counts_len <= counts_index && !counts_resize(h, value)))
+            {
+                return false;
+            }
+
+            if (!counts_inc_normalised(h, counts_index, count))
+            {
+                return false;
+            }
+            update_min_max(h, value);
+
+            return true;
+        }
+
+        bool hdr_record_value_atomic(hdr_histogram* h, s64 value) { return hdr_record_values_atomic(h, value, 1); }
+
+        bool hdr_record_values_atomic(hdr_histogram* h, s64 value, s64 count)
+        {
+            s32 counts_index;
+
+            if (value < 0)
+            {
+                return false;
+            }
+
+            counts_index = counts_index_for(h, value);
+
+            if (counts_index < 0 || h->counts_len <= counts_index)
+            {
+                return false;
+            }
+
+            if (!counts_inc_normalised_atomic(h, counts_index, count))
+            {
+                return false;
+            }
+            update_min_max_atomic(h, value);
+
+            return true;
+        }
+
+        // Batch recording computes the counts index for a block of values up front, then
+        // applies the counts and reduces min/max once per block.
+        static const s32 HDR_BATCH_BLOCK_SIZE = 64;
+
+        static void batch_counts_index_scalar(const hdr_histogram* h, const s64* values, s64* indices, s32 n)
+        {
+            for (s32 i = 0; i < n; i++)
+            {
+                indices[i] = (values[i] < 0) ? -1 : counts_index_for(h, values[i]);
+            }
+        }
+
+#if defined(__AVX2__)
+        // AVX2 has no 64-bit lzcnt, the bucket index is taken from the exponent of the value
+        // converted to a double instead.  The conversion (x | 2^52 as double bits) - 2^52 is
+        // exact for 0 <= x < 2^52, groups containing values outside that range use the scalar path.
+        static void batch_counts_index_avx2(const hdr_histogram* h, const s64* values, s64* indices, s32 n)
+        {
+            const __m256i mask          = _mm256_set1_epi64x(h->sub_bucket_mask);
+            const __m256i magic         = _mm256_set1_epi64x(0x4330000000000000LL);
+            const __m256d magic_d       = _mm256_set1_pd(4503599627370496.0);
+            const __m256i limit         = _mm256_set1_epi64x((1LL << 52) - 1);
+            const __m256i minus_one     = _mm256_set1_epi64x(-1);
+            const __m256i exponent_bias = _mm256_set1_epi64x(1023 + h->unit_magnitude + h->sub_bucket_half_count_magnitude);
+            const __m256i unit          = _mm256_set1_epi64x(h->unit_magnitude);
+            const __m256i one           = _mm256_set1_epi64x(1);
+            const __m256i half_count    = _mm256_set1_epi64x(h->sub_bucket_half_count);
+            const __m128i half_mag      = _mm_cvtsi32_si128(h->sub_bucket_half_count_magnitude);
+
+            s32 i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                const __m256i v            = _mm256_loadu_si256((const __m256i*)(values + i));
+                const __m256i out_of_range = _mm256_or_si256(_mm256_cmpgt_epi64(v, limit), _mm256_cmpgt_epi64(_mm256_setzero_si256(), v));
+                if (!_mm256_testz_si256(out_of_range, out_of_range))
+                {
+                    batch_counts_index_scalar(h, values + i, indices + i, 4);
+                    continue;
+                }
+
+                const __m256i x            = _mm256_or_si256(v, mask);
+                const __m256d d            = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(x, magic)), magic_d);
+                const __m256i bucket_index = _mm256_sub_epi64(_mm256_srli_epi64(_mm256_castpd_si256(d), 52), exponent_bias);
+                const __m256i sub_bucket   = _mm256_srlv_epi64(v, _mm256_add_epi64(bucket_index, unit));
+                const __m256i base_index   = _mm256_sll_epi64(_mm256_add_epi64(bucket_index, one), half_mag);
+                const __m256i index        = _mm256_sub_epi64(_mm256_add_epi64(base_index, sub_bucket), half_count);
+                _mm256_storeu_si256((__m256i*)(indices + i), _mm256_blendv_epi8(index, minus_one, out_of_range));
+            }
+
+            batch_counts_index_scalar(h, values + i, indices + i, n - i);
+        }
+#endif
+
+        static s64 record_values_batch(hdr_histogram* h, const s64* values, const s64* counts, u64 length)
+        {
+            s64 indices[HDR_BATCH_BLOCK_SIZE];
+            s64 dropped = 0;
+
+            for (u64 block = 0; block < length; block += HDR_BATCH_BLOCK_SIZE)
+            {
+                const s32 n = (length - block) < (u64)HDR_BATCH_BLOCK_SIZE ? (s32)(length - block) : HDR_BATCH_BLOCK_SIZE;
+                const s64* block_values = values + block;
+                const s64* block_counts = counts ? counts + block : nullptr;
+
+#if defined(__AVX2__)
+                batch_counts_index_avx2(h, block_values, indices, n);
+#else
+                batch_counts_index_scalar(h, block_values, indices, n);
+#endif
+
+                s64  block_min = limits_t<s64>::maximum();
+                s64  block_max = 0;
+                bool recorded  = false;
+                for (s32 i = 0; i < n; i++)
+                {
+                    const s64 value = block_values[i];
+                    const s64 index = indices[i];
+                    const s64 count = block_counts ? block_counts[i] : 1;
+                    if (index < 0 || (h->counts_len <= index && !counts_resize(h, value)) || !counts_inc_normalised(h, (s32)index, count))
+                    {
+                        dropped += count;
+                        continue;
+                    }
+                    block_min = (value < block_min && value != 0) ? value : block_min;
+                    block_max = (value > block_max) ? value : block_max;
+                    recorded  = true;
+                }
+
+                // A block of zeros and dropped values has no minimum, nor a maximum when all were dropped
+                if (block_min != limits_t<s64>::maximum())
+                {
+                    update_min_max(h, block_min);
+                }
+                if (recorded)
+                {
+                    update_min_max(h, block_max);
+                }
+            }
+
+            return dropped;
+        }
+
+        s64 hdr_record_values_batch(hdr_histogram* h, const s64* values, u64 length) { return record_values_batch(h, values, nullptr, length); }
+
+        s64 hdr_record_values_batch(hdr_histogram* h, const s64* values, const s64* counts, u64 length) { return record_values_batch(h, values, counts, length); }
+
+        // Records the series value - expected_interval, value - 2 * expected_interval, ... down
+        // to expected_interval.  The series values that fall into the same bucket are added with
+        // a single increment, the cost is the number of buckets the series passes through.
+        static bool record_missing_values(hdr_histogram* h, s64 value, s64 count, s64 expected_interval, bool atomic)
+        {
+            s64 missing_value = value - expected_interval;
+            while (missing_value >= expected_interval)
+            {
+                const s32 counts_index  = counts_index_for(h, missing_value);
+                s64       bucket_lowest = lowest_equivalent_value(h, missing_value);
+                bucket_lowest           = bucket_lowest > expected_interval ? bucket_lowest : expected_interval;
+
+                const s64 n                    = (missing_value - bucket_lowest) / expected_interval + 1;
+                const s64 lowest_missing_value = missing_value - (n - 1) * expected_interval;
+                if (atomic ? counts_inc_normalised_atomic(h, counts_index, n * count) : counts_inc_normalised(h, counts_index, n * count))
+                {
+                    if (atomic)
+                    {
+                        update_min_max_atomic(h, lowest_missing_value);
+                    }
+                    else
+                    {
+                        update_min_max(h, lowest_missing_value);
+                    }
+                    missing_value = lowest_missing_value - expected_interval;
+                    continue;
+                }
+
+                // The (narrow) count can't take the bucket total, record one value at a time
+                // so the values up to the one that overflows are recorded, as they were before.
+                for (; missing_value >= lowest_missing_value; missing_value -= expected_interval)
+                {
+                    if (!(atomic ? hdr_record_values_atomic(h, missing_value, count) : hdr_record_values(h, missing_value, count)))
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool hdr_record_corrected_value(hdr_histogram* h, s64 value, s64 expected_interval) { return hdr_record_corrected_values(h, value, 1, expected_interval); }
+
+        bool hdr_record_corrected_values(hdr_histogram* h, s64 value, s64 count, s64 expected_interval)
+        {
+            if (!hdr_record_values(h, value, count))
+            {
+                return false;
+            }
+
+            if (expected_interval <= 0 || value <= expected_interval)
+            {
+                return true;
+            }
+
+            return record_missing_values(h, value, count, expected_interval, false);
+        }
+
+        bool hdr_record_corrected_value_atomic(hdr_histogram* h, s64 value, s64 expected_interval) { return hdr_record_corrected_values_atomic(h, value, 1, expected_interval); }
+
+        bool hdr_record_corrected_values_atomic(hdr_histogram* h, s64 value, s64 count, s64 expected_interval)
+        {
+            if (!hdr_record_values_atomic(h, value, count))
+            {
+                return false;
+            }
+
+            if (expected_interval <= 0 || value <= expected_interval)
+            {
+                return true;
+            }
+
+            return record_missing_values(h, value, count, expected_interval, true);
+        }
+
+        // Histograms with the same bucket layout and normalizing offset map a value to the
+        // same counts index, their counts can then be added index by index.  A 'from' with
+        // fewer counts is added as a prefix of 'h', but only when unshifted since a shifted
+        // counts array wraps around at counts_len.
+        static bool counts_layout_matches(const hdr_histogram* h, const hdr_histogram* from)
+        {
+            if (h->unit_magnitude != from->unit_magnitude || h->sub_bucket_half_count_magnitude != from->sub_bucket_half_count_magnitude || h->normalizing_index_offset != from->normalizing_index_offset)
+            {
+                return false;
+            }
+            if (from->counts_len > h->counts_len)
+            {
+                return false;
+            }
+            return from->counts_len == h->counts_len || 0 == h->normalizing_index_offset;
+        }
+
+        // Branch free so the compiler can vectorize it for every source count width,
+        // 'sign' is +1 to add and -1 to subtract the source counts.
+        template <s64 sign, typename T> static s64 counts_add_range(s64* dst, const T* src, s32 begin, s32 end)
+        {
+            s64 added = 0;
+            for (s32 i = begin; i < end; i++)
+            {
+                dst[i] += sign * src[i];
+                added += src[i];
+            }
+            return added;
+        }
+
+        template <s64 sign> static s64 counts_add_range(s64* dst, const hdr_packed_block* src, s32 begin, s32 end)
+        {
+            s64 added = 0;
+            for (s32 b = begin >> 6; (b << 6) < end; b++)
+            {
+                s32 slot = 0;
+                for (u64 bits = src[b].populated; 0 != bits; bits &= bits - 1, slot++)
+                {
+                    const s32 i = (b << 6) + count_trailing_zeros_64(bits);
+                    if (i >= begin && i < end)
+                    {
+                        const s64 count = packed_load(src[b].data, src[b].width, slot);
+                        dst[i] += sign * count;
+                        added += count;
+                    }
+                }
+            }
+            return added;
+        }
+
+        template <s64 sign> static s64 counts_add_range(s64* dst, s64* const* pages, s32 shift, s32 begin, s32 end)
+        {
+            s64 added = 0;
+            for (s32 p = begin >> shift; (p << shift) < end; p++)
+            {
+                const s64* page = pages[p];
+                if (page)
+                {
+                    const s32 lo = begin > (p << shift) ? begin : (p << shift);
+                    const s32 hi = end < ((p + 1) << shift) ? end : ((p + 1) << shift);
+                    for (s32 i = lo; i < hi; i++)
+                    {
+                        dst[i] += sign * page[i - (p << shift)];
+                        added += page[i - (p << shift)];
+                    }
+                }
+            }
+            return added;
+        }
+
+        template <s64 sign> static s64 counts_add_range(hdr_histogram* h, const hdr_histogram* from, s32 begin, s32 end)
+        {
+            switch (from->counts_word_size)
+            {
+                case HDR_WORD_SIZE_PACKED: return counts_add_range<sign>(h->counts, from->packed, begin, end);
+                case HDR_WORD_SIZE_PAGED: return counts_add_range<sign>(h->counts, from->pages, page_shift(from->sub_bucket_half_count_magnitude), begin, end);
+                case sizeof(s16): return counts_add_range<sign>(h->counts, from->counts16, begin, end);
+                case sizeof(s32): return counts_add_range<sign>(h->counts, from->counts32, begin, end);
+                default: return counts_add_range<sign>(h->counts, from->counts, begin, end);
+            }
+        }
+
+        // A subtraction may remove the lowest or highest value, only then are they searched
+        // for again, scanning in from the ends of the counts.
+        static void min_max_after_subtract(hdr_histogram* h, const hdr_histogram* from)
+        {
+            if (0 == from->total_count)
+            {
+                return;
+            }
+            if (h->total_count <= 0)
+            {
+                h->min_value = limits_t<s64>::maximum();
+                h->max_value = 0;
+                return;
+            }
+
+            if (limits_t<s64>::maximum() != from->min_value && counts_index_for(h, from->min_value) <= counts_index_for(h, h->min_value))
+            {
+                s32 i = next_occupied_index(h, h->dirty_lo > 1 ? h->dirty_lo : 1);
+                while (i <= h->dirty_hi && 0 >= counts_get_normalised(h, i))
+                {
+                    i = next_occupied_index(h, i + 1);
+                }
+                h->min_value = i <= h->dirty_hi ? hdr_value_at_index(h, i) : limits_t<s64>::maximum();
+            }
+
+            if (counts_index_for(h, from->max_value) >= counts_index_for(h, h->max_value))
+            {
+                s32 i = h->dirty_hi;
+                while (i >= 0 && 0 >= counts_get_normalised(h, i))
+                {
+                    if (h->occupancy && 63 == (i & 63) && 0 == h->occupancy[i >> 6])
+                    {
+                        i -= 64;
+                    }
+                    else
+                    {
+                        i--;
+                    }
+                }
+                h->max_value = i >= 0 ? highest_equivalent_value(h, hdr_value_at_index(h, i)) : 0;
+            }
+        }
+
+        template <s64 sign> static void counts_add(hdr_histogram* h, const hdr_histogram* from)
+        {
+            const s32 counts_len = from->counts_len;
+            s64       added      = 0;
+            h->version++;
+            if (from->occupancy && 0 == from->normalizing_index_offset)
+            {
+                // Only add the chunks of 64 counts in the dirty range that may hold a non-zero count
+                for (s32 word = from->dirty_lo >> 6; (word << 6) <= from->dirty_hi; word++)
+                {
+                    if (0 != from->occupancy[word])
+                    {
+                        const s32 begin = word << 6;
+                        const s32 end   = begin + 64 < counts_len ? begin + 64 : counts_len;
+                        added += counts_add_range<sign>(h, from, begin, end);
+                    }
+                }
+            }
+            else if (0 == from->normalizing_index_offset)
+            {
+                added = counts_add_range<sign>(h, from, from->dirty_lo, from->dirty_hi + 1);
+            }
+            else
+            {
+                added = counts_add_range<sign>(h, from, 0, counts_len);
+            }
+            // Subtracting writes counts too, negative ones where 'from' is not a subset of 'h',
+            // hdr_reset only clears what the dirty range covers
+            dirty_mark_range(h, from->dirty_lo, from->dirty_hi);
+
+            h->total_count += sign * added;
+            if (sign > 0)
+            {
+                h->min_value = from->min_value < h->min_value ? from->min_value : h->min_value;
+                h->max_value = from->max_value > h->max_value ? from->max_value : h->max_value;
+            }
+            else
+            {
+                min_max_after_subtract(h, from);
+            }
+
+            // A subtraction leaves the occupancy bits set, they only have to cover the non-zero
+            // counts, but it writes a negative count where 'from' is not a subset of 'h'
+            if (h->occupancy)
+            {
+                if (from->occupancy)
+                {
+                    const s32 words = occupancy_words(counts_len);
+                    for (s32 word = 0; word < words; word++)
+                    {
+                        h->occupancy[word] |= from->occupancy[word];
+                    }
+                }
+                else
+                {
+                    occupancy_rebuild(h);
+                }
+            }
+
+            if (h->percentile_index)
+            {
+                // The tree is linear in the counts, trees over the same number of counts add up
+                if (from->percentile_index && from->counts_len == h->counts_len)
+                {
+                    counts_add_range<sign>(h->percentile_index, from->percentile_index, from->dirty_lo, counts_len);
+                }
+                else
+                {
+                    percentile_index_rebuild(h);
+                }
+            }
+
+            if (h->flags & HDR_RUNNING_SUMS)
+            {
+                // Adding positive counts keeps every count positive, a subtraction may not and
+                // has the sums rebuilt, which also finds out whether a count went negative
+                if (sign > 0 && (from->flags & HDR_RUNNING_SUMS) && 0 == ((h->flags | from->flags) & HDR_SUMS_INVALID))
+                {
+                    u128_add(&h->running_sum, from->running_sum);
+                    u128_add(&h->running_sum_squares, from->running_sum_squares);
+                }
+                else
+                {
+                    running_sums_rebuild(h);
+                }
+            }
+        }
+
+        s64 hdr_add(hdr_histogram* h, const hdr_histogram* from)
+        {
+            if (h->counts_word_size == sizeof(s64) && counts_layout_matches(h, from))
+            {
+                counts_add<1>(h, from);
+                return 0;
+            }
+
+            // The counts may change without changing the total, see hdr_summary
+            h->version++;
+
+            struct hdr_iter iter;
+            s64             dropped = 0;
+            hdr_iter_recorded_init(&iter, from);
+
+            while (hdr_iter_next(&iter))
+            {
+                s64 value = iter.value;
+                s64 count = iter.count;
+
+                if (!hdr_record_values(h, value, count))
+                {
+                    dropped += count;
+                }
+            }
+
+            return dropped;
+        }
+
+        s64 hdr_subtract(hdr_histogram* h, const hdr_histogram* from)
+        {
+            if (h->counts_word_size == sizeof(s64) && counts_layout_matches(h, from))
+            {
+                counts_add<-1>(h, from);
+                return 0;
+            }
+
+            // The counts may change without changing the total, see hdr_summary
+            h->version++;
+
+            struct hdr_iter iter;
+            s64             dropped = 0;
+            hdr_iter_recorded_init(&iter, from);
+
+            while (hdr_iter_next(&iter))
+            {
+                s64 value = iter.value;
+                s64 count = iter.count;
+
+                if (!hdr_record_values(h, value, -count))
+                {
+                    dropped += count;
+                }
+            }
+
+            min_max_after_subtract(h, from);
+            return dropped;
+        }
+
+        // False when a count of 'older' is larger than the same count in 'newer'
+        static bool counts_contained(const hdr_histogram* newer, const hdr_histogram* older)
+        {
+            if (older->total_count > newer->total_count)
+            {
+                return false;
+            }
+
+            struct hdr_iter iter;
+            hdr_iter_recorded_init(&iter, older);
+            while (hdr_iter_next(&iter))
+            {
+                if (iter.count > hdr_count_at_value(newer, iter.value))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        s64 hdr_delta(hdr_histogram* out, const hdr_histogram* newer, const hdr_histogram* older)
+        {
+            hdr_reset(out);
+            if (!counts_contained(newer, older))
+            {
+                // 'newer' was reset after 'older' was taken, all of it is new
+                return hdr_add(out, newer);
+            }
+            return hdr_add(out, newer) + hdr_subtract(out, older);
+        }
+
+        s64 hdr_add_atomic(hdr_histogram* h, const hdr_histogram* from)
+        {
+            struct hdr_iter iter;
+            s64             dropped = 0;
+            hdr_iter_recorded_init(&iter, from);
+
+            while (hdr_iter_next(&iter))
+            {
+                s64 value = iter.value;
+                s64 count = iter.count;
+
+                if (!hdr_record_values_atomic(h, value, count))
+                {
+                    dropped += count;
+                }
+            }
+
+            return dropped;
+        }
+
+        s64 hdr_add_while_correcting_for_coordinated_omission(hdr_histogram* h, hdr_histogram* from, s64 expected_interval)
+        {
+            struct hdr_iter iter;
+            s64             dropped = 0;
+            hdr_iter_recorded_init(&iter, from);
+
+            while (hdr_iter_next(&iter))
+            {
+                s64 value = iter.value;
+                s64 count = iter.count;
+
+                if (!hdr_record_corrected_values(h, value, count, expected_interval))
+                {
+                    dropped += count;
+                }
+            }
+
+            return dropped;
+        }
+
+        // Shifting by n binary orders of magnitude moves every value n buckets up or down,
+        // which is the same as moving its counts index by n half buckets.  Instead of moving
+        // the counts the normalizing index offset is changed, only the count of the zero
+        // value (which does not move) and the counts in the lowest half bucket (which has
+        // a finer resolution than any other half bucket) are moved.
+        static void shift_normalizing_index_offset(hdr_histogram* h, s32 shift_amount, bool lowest_half_bucket_populated, s32 binary_orders_of_magnitude)
+        {
+            h->version++;
+            dirty_mark_range(h, 0, h->counts_len - 1);
+
+            const s64 zero_count = counts_get_normalised(h, 0);
+            counts_set_direct(h, normalize_index(h, 0), 0);
+            const s32 pre_shift_zero_index = normalize_index(h, 0);
+
+            h->normalizing_index_offset = (h->normalizing_index_offset + shift_amount) % h->counts_len;
+            if (h->occupancy)
+            {
+                occupancy_shift(h, shift_amount);
+            }
+
+            if (lowest_half_bucket_populated)
+            {
+                // Re-record the lowest half bucket at the new scale, the index a value moves
+                // to is always below the index it moves from so a single ascending pass works.
+                for (s32 from_index = 1; from_index < h->sub_bucket_half_count; from_index++)
+                {
+                    const s32 from_normalised = (pre_shift_zero_index + from_index) % h->counts_len;
+                    const s64 count           = counts_get_direct(h, from_normalised);
+                    const s32 to_index        = counts_index_for(h, hdr_value_at_index(h, from_index) << binary_orders_of_magnitude);
+                    counts_set_direct(h, normalize_index(h, to_index), count);
+                    counts_set_direct(h, from_normalised, 0);
+                    if (h->occupancy && 0 != count)
+                    {
+                        occupancy_set(h, to_index);
+                    }
+                }
+            }
+
+            counts_set_direct(h, normalize_index(h, 0), zero_count);
+            if (h->occupancy && 0 != zero_count)
+            {
+                occupancy_set(h, 0);
+            }
+            if (h->percentile_index)
+            {
+                percentile_index_rebuild(h);
+            }
+            if (h->flags & HDR_RUNNING_SUMS)
+            {
+                running_sums_rebuild(h);
+            }
+        }
 
-        bool hdr_record_corrected_values(hdr_histogram* h, s64 value, s64 count, s64 expected_interval)
+        s32 hdr_shift_values_left(hdr_histogram* h, s32 binary_orders_of_magnitude)
         {
-            s64 missing_value;
-
-            if (!hdr_record_values(h, value, count))
+            if (binary_orders_of_magnitude < 0 || 63 <= binary_orders_of_magnitude)
             {
-                return false;
+                return EINVAL;
+            }
+            if (0 == binary_orders_of_magnitude || h->total_count == counts_get_normalised(h, 0))
+            {
+                return 0;
             }
 
-            if (expected_interval <= 0 || value <= expected_interval)
+            if (highest_equivalent_value(h, h->max_value) > (limits_t<s64>::maximum() >> binary_orders_of_magnitude))
             {
-                return true;
+                return EINVAL;
             }
 
-            missing_value = value - expected_interval;
-            for (; missing_value >= expected_interval; missing_value -= expected_interval)
+            // The values must not wrap around the end of the counts, unless the histogram can grow
+            const s32 shift_amount    = binary_orders_of_magnitude << h->sub_bucket_half_count_magnitude;
+            const s32 max_value_index = counts_index_for(h, h->max_value);
+            if (max_value_index >= h->counts_len - shift_amount && !counts_resize(h, hdr_value_at_index(h, max_value_index + shift_amount)))
             {
-                if (!hdr_record_values(h, missing_value, count))
-                {
-                    return false;
-                }
+                return EINVAL;
             }
 
-            return true;
-        }
+            const s64  max_value_before_shift       = h->max_value;
+            const s64  min_value_before_shift       = h->min_value;
+            const bool lowest_half_bucket_populated = min_value_before_shift < ((s64)h->sub_bucket_half_count << h->unit_magnitude);
 
-        s64 hdr_add(hdr_histogram* h, const hdr_histogram* from)
-        {
-            struct hdr_iter iter;
-            s64             dropped = 0;
-            hdr_iter_recorded_init(&iter, from);
+            shift_normalizing_index_offset(h, shift_amount, lowest_half_bucket_populated, binary_orders_of_magnitude);
 
-            while (hdr_iter_next(&iter))
+            h->max_value = 0;
+            h->min_value = limits_t<s64>::maximum();
+            update_min_max(h, max_value_before_shift << binary_orders_of_magnitude);
+            if (min_value_before_shift < limits_t<s64>::maximum())
             {
-                s64 value = iter.value;
-                s64 count = iter.count;
-
-                if (!hdr_record_values(h, value, count))
-                {
-                    dropped += count;
-                }
+                update_min_max(h, min_value_before_shift << binary_orders_of_magnitude);
             }
-
-            return dropped;
+            return 0;
         }
 
-        s64 hdr_add_while_correcting_for_coordinated_omission(hdr_histogram* h, hdr_histogram* from, s64 expected_interval)
+        s32 hdr_shift_values_right(hdr_histogram* h, s32 binary_orders_of_magnitude)
         {
-            struct hdr_iter iter;
-            s64             dropped = 0;
-            hdr_iter_recorded_init(&iter, from);
-
-            while (hdr_iter_next(&iter))
+            if (binary_orders_of_magnitude < 0 || 63 <= binary_orders_of_magnitude)
             {
-                s64 value = iter.value;
-                s64 count = iter.count;
+                return EINVAL;
+            }
+            if (0 == binary_orders_of_magnitude || h->total_count == counts_get_normalised(h, 0))
+            {
+                return 0;
+            }
 
-                if (!hdr_record_corrected_values(h, value, count, expected_interval))
-                {
-                    dropped += count;
-                }
+            // A value shifted into the lowest half bucket would lose precision, that would make
+            // the shift irreversible and is rejected.
+            const s32 shift_amount = binary_orders_of_magnitude << h->sub_bucket_half_count_magnitude;
+            if (counts_index_for(h, h->min_value) < shift_amount + h->sub_bucket_half_count)
+            {
+                return EINVAL;
             }
 
-            return dropped;
+            const s64 max_value_before_shift = h->max_value;
+            const s64 min_value_before_shift = h->min_value;
+
+            shift_normalizing_index_offset(h, -shift_amount, false, binary_orders_of_magnitude);
+
+            h->max_value = 0;
+            h->min_value = limits_t<s64>::maximum();
+            update_min_max(h, max_value_before_shift >> binary_orders_of_magnitude);
+            update_min_max(h, min_value_before_shift >> binary_orders_of_magnitude);
+            return 0;
         }
 
         /* ##     ##    ###    ##       ##     ## ########  ######  */
@@ -528,9 +2378,15 @@ namespace ncore
             s64 count_to_idx = 0;
 
             count_at_percentile = 0 < count_at_percentile ? count_at_percentile : 1;
+            if (h->percentile_index)
+            {
+                const s32 idx = percentile_index_search(h, count_at_percentile);
+                return idx < h->counts_len ? hdr_value_at_index(h, idx) : 0;
+            }
+
             for (s32 idx = 0; idx < h->counts_len; idx++)
             {
-                count_to_idx += h->counts[idx];
+                count_to_idx += counts_get_normalised(h, idx);
                 if (count_to_idx >= count_at_percentile)
                 {
                     return hdr_value_at_index(h, idx);
@@ -570,7 +2426,17 @@ namespace ncore
                 values[i]                      = count_at_percentile > 1 ? count_at_percentile : 1;
             }
 
-            hdr_iter_init(&iter, h);
+            if (h->percentile_index)
+            {
+                for (u64 i = 0; i < length; i++)
+                {
+                    const s32 idx = percentile_index_search(h, values[i]);
+                    values[i]     = idx < h->counts_len ? highest_equivalent_value(h, hdr_value_at_index(h, idx)) : 0;
+                }
+                return 0;
+            }
+
+            hdr_iter_recorded_init(&iter, h);
             s64 total  = 0;
             u64 at_pos = 0;
             while (hdr_iter_next(&iter) && at_pos < length)
@@ -585,21 +2451,41 @@ namespace ncore
             return 0;
         }
 
+        // The running sum gives the bucket walk total directly as long as it fits in an s64 and
+        // no count is negative
+        static bool running_sum_fits(const hdr_histogram* h) { return HDR_RUNNING_SUMS == (h->flags & (HDR_RUNNING_SUMS | HDR_SUMS_INVALID)) && 0 == h->running_sum.hi && h->running_sum.lo <= (u64)limits_t<s64>::maximum(); }
+
+        // With q = sum / n and r = sum % n the deviation total is
+        // sum_squares - q * (sum + r) - r * r / n, all but the last term exact.
+        static f64 stddev_of_sums(u64 sum, hdr_u128 sum_squares, s64 total_count)
+        {
+            const u64 n           = (u64)total_count;
+            const u64 q           = sum / n;
+            const u64 r           = sum % n;
+            hdr_u128  dev_squares = sum_squares;
+            u128_sub(&dev_squares, u128_mul_64(q, sum + r));
+
+            const f64 geometric_dev_total = u128_to_f64(dev_squares) - ((f64)r * (f64)r) / (f64)n;
+            return sqrt(geometric_dev_total / total_count);
+        }
+
         f64 hdr_mean(const hdr_histogram* h)
         {
+            if (running_sum_fits(h))
+            {
+                return ((s64)h->running_sum.lo * 1.0) / h->total_count;
+            }
+
             struct hdr_iter iter;
             s64             total = 0, count = 0;
             s64             total_count = h->total_count;
 
-            hdr_iter_init(&iter, h);
+            hdr_iter_recorded_init(&iter, h);
 
             while (hdr_iter_next(&iter) && count < total_count)
             {
-                if (0 != iter.count)
-                {
-                    count += iter.count;
-                    total += iter.count * hdr_median_equivalent_value(h, iter.value);
-                }
+                count += iter.count;
+                total += iter.count * iter.median_equivalent_value;
             }
 
             return (total * 1.0) / total_count;
@@ -607,22 +2493,121 @@ namespace ncore
 
         f64 hdr_stddev(const hdr_histogram* h)
         {
+            if (running_sum_fits(h) && 0 < h->total_count)
+            {
+                return stddev_of_sums(h->running_sum.lo, h->running_sum_squares, h->total_count);
+            }
+
             f64 mean                = hdr_mean(h);
             f64 geometric_dev_total = 0.0;
 
             struct hdr_iter iter;
-            hdr_iter_init(&iter, h);
+            hdr_iter_recorded_init(&iter, h);
+
+            while (hdr_iter_next(&iter))
+            {
+                f64 dev = (iter.median_equivalent_value * 1.0) - mean;
+                geometric_dev_total += (dev * dev) * iter.count;
+            }
+
+            return sqrt(geometric_dev_total / h->total_count);
+        }
+
+        void hdr_stats_init(struct hdr_stats* stats)
+        {
+            nmem::memset(stats, 0, sizeof(struct hdr_stats));
+            stats->version = -1;
+        }
+
+        s32 hdr_summary(const hdr_histogram* h, const f64* percentiles, u64 length, struct hdr_stats* out)
+        {
+            if (HDR_STATS_MAX_PERCENTILES < length || (nullptr == percentiles && 0 != length))
+            {
+                return EINVAL;
+            }
+
+            if (out->h == h && out->version == h->version && out->total_count == h->total_count && out->length == length && (0 == length || 0 == nmem::memcmp(out->percentiles, percentiles, length * sizeof(f64))))
+            {
+                return 0;
+            }
+
+            // Visit the percentiles in ascending order
+            s32 order[HDR_STATS_MAX_PERCENTILES];
+            s64 count_at_percentile[HDR_STATS_MAX_PERCENTILES];
+            for (u64 i = 0; i < length; i++)
+            {
+                const f64 requested_percentile = percentiles[i] < 100.0 ? percentiles[i] : 100.0;
+                const s64 count                = (s64)(((requested_percentile / 100) * h->total_count) + 0.5);
+                count_at_percentile[i]         = count > 1 ? count : 1;
+                out->percentiles[i]            = percentiles[i];
+                out->values[i]                 = 0;
+
+                s32 j = (s32)i;
+                for (; j > 0 && count_at_percentile[order[j - 1]] > count_at_percentile[i]; j--)
+                {
+                    order[j] = order[j - 1];
+                }
+                order[j] = (s32)i;
+            }
 
+            // The mean is computed exactly as hdr_mean, the standard deviation uses Welford's
+            // update so it does not need the mean up front.
+            struct hdr_iter iter;
+            s64             total      = 0;
+            s64             cumulative = 0;
+            f64             mean       = 0.0;
+            f64             m2         = 0.0;
+            u64             at_pos     = 0;
+            hdr_iter_recorded_init(&iter, h);
             while (hdr_iter_next(&iter))
             {
-                if (0 != iter.count)
+                const f64 value = (f64)iter.median_equivalent_value;
+                total += iter.count * iter.median_equivalent_value;
+                cumulative += iter.count;
+
+                const f64 delta = value - mean;
+                mean += delta * iter.count / cumulative;
+                m2 += iter.count * delta * (value - mean);
+
+                while (at_pos < length && cumulative >= count_at_percentile[order[at_pos]])
                 {
-                    f64 dev = (hdr_median_equivalent_value(h, iter.value) * 1.0) - mean;
-                    geometric_dev_total += (dev * dev) * iter.count;
+                    const s32 i    = order[at_pos++];
+                    out->values[i] = (percentiles[i] == 0.0) ? lowest_equivalent_value(h, iter.value) : highest_equivalent_value(h, iter.value);
                 }
             }
 
-            return sqrt(geometric_dev_total / h->total_count);
+            out->h           = h;
+            out->version     = h->version;
+            out->total_count = h->total_count;
+            out->min         = hdr_min(h);
+            out->max         = hdr_max(h);
+            out->mean        = (total * 1.0) / h->total_count;
+            out->stddev      = sqrt(m2 / h->total_count);
+            out->length      = length;
+            return 0;
+        }
+
+        s64 hdr_count_between_values(const hdr_histogram* h, s64 low_value, s64 high_value)
+        {
+            const s32 low_index  = counts_index_for(h, low_value < 0 ? 0 : low_value);
+            s32       high_index = counts_index_for(h, high_value < 0 ? 0 : high_value);
+            high_index           = high_index < h->counts_len ? high_index : h->counts_len - 1;
+            if (high_index < low_index)
+            {
+                return 0;
+            }
+
+            if (h->percentile_index)
+            {
+                return percentile_index_prefix_sum(h, high_index) - (low_index > 0 ? percentile_index_prefix_sum(h, low_index - 1) : 0);
+            }
+
+            s64 count = 0;
+            for (s32 i = low_index; i <= high_index; i++)
+            {
+                count += counts_get_normalised(h, i);
+            }
+            return count;
         }
 
         bool hdr_values_are_equivalent(const hdr_histogram* h, s64 a, s64 b) { return lowest_equivalent_value(h, a) == lowest_equivalent_value(h, b); }
@@ -645,9 +2630,9 @@ namespace ncore
 
         static bool has_next(hdr_iter* iter) { return iter->cumulative_count < iter->total_count; }
 
-        static bool move_next(hdr_iter* iter)
+        static bool move_to(hdr_iter* iter, s32 counts_index)
         {
-            iter->counts_index++;
+            iter->counts_index = counts_index;
 
             if (!has_buckets(iter))
             {
@@ -669,6 +2654,26 @@ namespace ncore
             return true;
         }
 
+        static bool move_next(hdr_iter* iter) { return move_to(iter, iter->counts_index + 1); }
+
+        // Moves to the next index that may hold a non-zero count, the counts that are
+        // skipped are all zero so the cumulative count is unaffected.
+        static bool move_next_occupied(hdr_iter* iter) { return move_to(iter, next_occupied_index(iter->h, iter->counts_index + 1)); }
+
+        // Moves to the next index that may hold a non-zero count, but no further than the
+        // index holding 'reporting_level_lowest_equivalent'.
+        static bool move_next_occupied_up_to(hdr_iter* iter, s64 reporting_level_lowest_equivalent)
+        {
+            s32 counts_index = next_occupied_index(iter->h, iter->counts_index + 1);
+            if (reporting_level_lowest_equivalent < hdr_value_at_index(iter->h, counts_index))
+            {
+                const s32 level_index = counts_index_for(iter->h, reporting_level_lowest_equivalent);
+                counts_index          = level_index > iter->counts_index ? level_index : iter->counts_index + 1;
+                counts_index          = counts_index < iter->h->counts_len ? counts_index : iter->h->counts_len;
+            }
+            return move_to(iter, counts_index);
+        }
+
         static s64 peek_next_value_from_index(hdr_iter* iter) { return hdr_value_at_index(iter->h, iter->counts_index + 1); }
 
         static bool next_value_greater_than_reporting_level_upper_bound(hdr_iter* iter, s64 reporting_level_upper_bound)
@@ -688,7 +2693,7 @@ namespace ncore
                 return false;
             }
 
-            move_next(iter);
+            move_next_occupied(iter);
 
             return true;
         }
@@ -737,10 +2742,22 @@ namespace ncore
         /* ##        ##       ##    ##  ##    ## ##       ##   ###    ##     ##  ##       ##       ##    ## */
         /* ##        ######## ##     ##  ######  ######## ##    ##    ##    #### ######## ########  ######  */
 
-        static bool percentile_iter_next(hdr_iter* iter)
+        // The percentile reported after 'percentile', ticks_per_half_distance steps are taken each
+        // time the distance to 100% halves.  'half_distance' is the smallest power of two above
+        // 100 / (100 - percentile), the percentiles only go up so it is doubled where the
+        // previous step left it instead of recomputing it with log and pow.
+        static f64 next_percentile_tick(f64 percentile, s32 ticks_per_half_distance, s64* half_distance)
         {
-            s64 temp, half_distance, percentile_reporting_ticks;
+            const f64 distance = 100.0 / (100.0 - percentile);
+            while ((f64)*half_distance <= distance && *half_distance < ((s64)1 << 62))
+            {
+                *half_distance <<= 1;
+            }
+            return percentile + 100.0 / (f64)(ticks_per_half_distance * *half_distance);
+        }
 
+        static bool percentile_iter_next(hdr_iter* iter)
+        {
             struct hdr_iter_percentiles* percentiles = &iter->specifics.percentiles;
 
             if (!has_next(iter))
@@ -768,11 +2785,8 @@ namespace ncore
                 {
                     update_iterated_values(iter, highest_equivalent_value(iter->h, iter->value));
 
-                    percentiles->percentile    = percentiles->percentile_to_iterate_to;
-                    temp                       = (s64)(log(100 / (100.0 - (percentiles->percentile_to_iterate_to))) / log(2)) + 1;
-                    half_distance              = (s64)pow(2, (f64)temp);
-                    percentile_reporting_ticks = percentiles->ticks_per_half_distance * half_distance;
-                    percentiles->percentile_to_iterate_to += 100.0 / percentile_reporting_ticks;
+                    percentiles->percentile               = percentiles->percentile_to_iterate_to;
+                    percentiles->percentile_to_iterate_to = next_percentile_tick(percentiles->percentile_to_iterate_to, percentiles->ticks_per_half_distance, &percentiles->half_distance);
 
                     return true;
                 }
@@ -789,33 +2803,13 @@ namespace ncore
 
             iter->specifics.percentiles.seen_last_value          = false;
             iter->specifics.percentiles.ticks_per_half_distance  = ticks_per_half_distance;
+            iter->specifics.percentiles.half_distance            = 1;
             iter->specifics.percentiles.percentile_to_iterate_to = 0.0;
             iter->specifics.percentiles.percentile               = 0.0;
 
             iter->_next_fp = percentile_iter_next;
         }
 
-        static void format_line_string(char* str, u64 len, s32 significant_figures, format_type format)
-        {
-#if defined(_MSC_VER)
-#    define snprintf _snprintf
-#    pragma warning(push)
-#    pragma warning(disable : 4996)
-#endif
-            const char* format_str = "%s%d%s";
-
-            switch (format)
-            {
-                case CSV: snprintf(str, len, format_str, "%.", significant_figures, "f,%f,%d,%.2f\n"); break;
-                case CLASSIC: snprintf(str, len, format_str, "%12.", significant_figures, "f %12f %12d %12.2f\n"); break;
-                default: snprintf(str, len, format_str, "%12.", significant_figures, "f %12f %12d %12.2f\n");
-            }
-#if defined(_MSC_VER)
-#    undef snprintf
-#    pragma warning(pop)
-#endif
-        }
-
         /* ########  ########  ######   #######  ########  ########  ######## ########   */
         /* ##     ## ##       ##    ## ##     ## ##     ## ##     ## ##       ##     ##  */
         /* ##     ## ##       ##       ##     ## ##     ## ##     ## ##       ##     ##  */
@@ -877,7 +2871,7 @@ namespace ncore
                         return true;
                     }
 
-                    if (!move_next(iter))
+                    if (!move_next_occupied_up_to(iter, linear->next_value_reporting_level_lowest_equivalent))
                     {
                         return true;
                     }
@@ -929,7 +2923,7 @@ namespace ncore
                         return true;
                     }
 
-                    if (!move_next(iter))
+                    if (!move_next_occupied_up_to(iter, logarithmic->next_value_reporting_level_lowest_equivalent))
                     {
                         return true;
                     }
@@ -954,69 +2948,370 @@ namespace ncore
 
         /* Printing. */
 
-        static const char* format_head_string(format_type format)
+        void hdr_writer_init_buffer(hdr_writer* w, char* buffer, u32 capacity) { hdr_writer_init_sink(w, buffer, capacity, nullptr, nullptr); }
+
+        void hdr_writer_init_sink(hdr_writer* w, char* buffer, u32 capacity, hdr_sink_fn sink, void* user)
         {
-            switch (format)
+            w->buffer   = buffer;
+            w->capacity = capacity;
+            w->length   = 0;
+            w->written  = 0;
+            w->sink     = sink;
+            w->user     = user;
+            w->error    = 0;
+        }
+
+        s32 hdr_writer_flush(hdr_writer* w)
+        {
+            if (nullptr != w->sink && 0 != w->length && 0 == w->error)
             {
-                case CSV: return "%s,%s,%s,%s\n";
-                case CLASSIC:
-                default: return "%12s %12s %12s %12s\n\n";
+                if (0 != w->sink(w->user, w->buffer, w->length))
+                {
+                    w->error = EIO;
+                }
+                w->length = 0;
             }
+            return w->error;
         }
 
-        static const char CLASSIC_FOOTER[] = "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n"
-                                             "#[Max     = %12.3f, Total count    = %12" PRIu64 "]\n"
-                                             "#[Buckets = %12d, SubBuckets     = %12d]\n";
+        static void writer_put(hdr_writer* w, const char* data, u32 length)
+        {
+            while (0 != length && 0 == w->error)
+            {
+                if (w->length == w->capacity)
+                {
+                    if (nullptr == w->sink || 0 == w->capacity)
+                    {
+                        w->error = ENOMEM;
+                        return;
+                    }
+                    hdr_writer_flush(w);
+                    continue;
+                }
 
-        s32 hdr_percentiles_print(hdr_histogram* h, FILE* stream, s32 ticks_per_half_distance, f64 value_scale, format_type format)
+                const u32 n = (w->capacity - w->length) < length ? (w->capacity - w->length) : length;
+                nmem::memcpy(w->buffer + w->length, data, n);
+                w->length += n;
+                w->written += n;
+                data += n;
+                length -= n;
+            }
+        }
+
+        static void writer_put_string(hdr_writer* w, const char* str)
+        {
+            u32 length = 0;
+            while (0 != str[length])
+            {
+                length++;
+            }
+            writer_put(w, str, length);
+        }
+
+        // Right aligns 'str' in a field of 'width' characters (at most 16), like printf's %12s
+        static void writer_put_field(hdr_writer* w, const char* str, u32 length, u32 width)
+        {
+            static const char spaces[] = "                ";
+            if (length < width)
+            {
+                writer_put(w, spaces, width - length);
+            }
+            writer_put(w, str, length);
+        }
+
+        // Writes the digits of 'value' backwards ending at 'end', returns the first character
+        static char* format_u64(char* end, u64 value)
+        {
+            do
+            {
+                *--end = (char)('0' + (value % 10));
+                value /= 10;
+            } while (0 != value);
+            return end;
+        }
+
+        static const f64 s_powers_of_10[] = {1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+        // Formats 'value' like printf's %.*f with 'precision' in [0, 9], the fraction is rounded
+        // on its exact value with ties to even.  Values of 1e18 and above keep their leading
+        // 18 digits followed by zeros.
+        static u32 format_fixed(char* str, f64 value, s32 precision)
+        {
+            char        digits[64];
+            char* const end = digits + sizeof(digits);
+            char*       p   = end;
+
+            const bool negative = value < 0.0;
+            value               = negative ? -value : value;
+
+            if (value != value)
+            {
+                p -= 3;
+                nmem::memcpy(p, "nan", 3);
+            }
+            else if (value > 1.7976931348623157e308)
+            {
+                p -= 3;
+                nmem::memcpy(p, "inf", 3);
+            }
+            else
+            {
+                s32 zeros = 0;
+                while (value >= 1e18)
+                {
+                    value /= 10.0;
+                    zeros++;
+                }
+
+                u64 integer  = (u64)value;
+                u64 fraction = 0;
+                if (0 == zeros)
+                {
+                    // The product is rounded, its error (exact with fma) decides a tie
+                    const f64 exact_fraction = value - (f64)integer;
+                    const f64 scaled         = exact_fraction * s_powers_of_10[precision];
+                    const f64 error          = fma(exact_fraction, s_powers_of_10[precision], -scaled);
+                    fraction                 = (u64)scaled;
+
+                    const f64 rest = scaled - (f64)fraction;
+                    if (rest > 0.5 || (rest == 0.5 && (error > 0.0 || (error == 0.0 && 0 != (fraction & 1)))))
+                    {
+                        fraction++;
+                    }
+                    if (fraction == (u64)s_powers_of_10[precision])
+                    {
+                        fraction = 0;
+                        integer++;
+                    }
+                }
+
+                if (0 < precision)
+                {
+                    for (s32 i = 0; i < precision; i++)
+                    {
+                        *--p = (char)('0' + (fraction % 10));
+                        fraction /= 10;
+                    }
+                    *--p = '.';
+                }
+                for (; 0 < zeros; zeros--)
+                {
+                    *--p = '0';
+                }
+                p = format_u64(p, integer);
+            }
+
+            if (negative)
+            {
+                *--p = '-';
+            }
+
+            const u32 length = (u32)(end - p);
+            nmem::memcpy(str, p, length);
+            return length;
+        }
+
+        static void write_fixed(hdr_writer* w, f64 value, s32 precision, u32 width, format_type format)
+        {
+            // JSON has no representation for inf and nan
+            if (JSON == format && (value != value || value > 1.7976931348623157e308 || value < -1.7976931348623157e308))
+            {
+                writer_put_field(w, "null", 4, width);
+                return;
+            }
+
+            char      str[64];
+            const u32 length = format_fixed(str, value, precision);
+            writer_put_field(w, str, length, width);
+        }
+
+        static void write_integer(hdr_writer* w, s64 value, u32 width)
         {
-            char                         line_format[25];
-            const char*                  head_format;
-            s32                          rc = 0;
-            struct hdr_iter              iter;
-            struct hdr_iter_percentiles* percentiles;
+            char        digits[24];
+            char* const end = digits + sizeof(digits);
+            char*       p   = format_u64(end, value < 0 ? (u64)0 - (u64)value : (u64)value);
+            if (value < 0)
+            {
+                *--p = '-';
+            }
+            writer_put_field(w, p, (u32)(end - p), width);
+        }
 
-            format_line_string(line_format, 25, h->significant_figures, format);
-            head_format = format_head_string(format);
+        static void write_head(hdr_writer* w, format_type format)
+        {
+            switch (format)
+            {
+                case CSV: writer_put_string(w, "Value,Percentile,TotalCount,1/(1-Percentile)\n"); break;
+                case JSON: writer_put_string(w, "{\"percentiles\":["); break;
+                case CLASSIC:
+                default:
+                    writer_put_field(w, "Value", 5, 12);
+                    writer_put_field(w, " ", 1, 0);
+                    writer_put_field(w, "Percentile", 10, 12);
+                    writer_put_field(w, " ", 1, 0);
+                    writer_put_field(w, "TotalCount", 10, 12);
+                    writer_put_field(w, " ", 1, 0);
+                    writer_put_field(w, "1/(1-Percentile)", 16, 12);
+                    writer_put_string(w, "\n\n");
+            }
+        }
 
-            hdr_iter_percentile_init(&iter, h, ticks_per_half_distance);
+        static void write_line(hdr_writer* w, format_type format, s32 significant_figures, f64 value, f64 percentile, s64 total_count, s64 line)
+        {
+            const f64 inverted_percentile = 1.0 / (1.0 - percentile);
+            switch (format)
+            {
+                case CSV:
+                    write_fixed(w, value, significant_figures, 0, format);
+                    writer_put_string(w, ",");
+                    write_fixed(w, percentile, 6, 0, format);
+                    writer_put_string(w, ",");
+                    write_integer(w, total_count, 0);
+                    writer_put_string(w, ",");
+                    write_fixed(w, inverted_percentile, 2, 0, format);
+                    writer_put_string(w, "\n");
+                    break;
+                case JSON:
+                    writer_put_string(w, 0 == line ? "\n{\"value\":" : ",\n{\"value\":");
+                    write_fixed(w, value, significant_figures, 0, format);
+                    writer_put_string(w, ",\"percentile\":");
+                    write_fixed(w, percentile, 6, 0, format);
+                    writer_put_string(w, ",\"total_count\":");
+                    write_integer(w, total_count, 0);
+                    writer_put_string(w, "}");
+                    break;
+                case CLASSIC:
+                default:
+                    write_fixed(w, value, significant_figures, 12, format);
+                    writer_put_string(w, " ");
+                    write_fixed(w, percentile, 6, 12, format);
+                    writer_put_string(w, " ");
+                    write_integer(w, total_count, 12);
+                    writer_put_string(w, " ");
+                    write_fixed(w, inverted_percentile, 2, 12, format);
+                    writer_put_string(w, "\n");
+            }
+        }
 
-            if (fprintf(stream, head_format, "Value", "Percentile", "TotalCount", "1/(1-Percentile)") < 0)
+        static void write_footer(hdr_writer* w, const hdr_histogram* h, format_type format, f64 mean, f64 stddev, f64 max)
+        {
+            switch (format)
             {
-                rc = EIO;
-                goto cleanup;
+                case CSV: break;
+                case JSON:
+                    writer_put_string(w, "\n],\"mean\":");
+                    write_fixed(w, mean, 3, 0, format);
+                    writer_put_string(w, ",\"stddev\":");
+                    write_fixed(w, stddev, 3, 0, format);
+                    writer_put_string(w, ",\"max\":");
+                    write_fixed(w, max, 3, 0, format);
+                    writer_put_string(w, ",\"total_count\":");
+                    write_integer(w, h->total_count, 0);
+                    writer_put_string(w, ",\"buckets\":");
+                    write_integer(w, h->bucket_count, 0);
+                    writer_put_string(w, ",\"sub_buckets\":");
+                    write_integer(w, h->sub_bucket_count, 0);
+                    writer_put_string(w, "}\n");
+                    break;
+                case CLASSIC:
+                default:
+                    writer_put_string(w, "#[Mean    = ");
+                    write_fixed(w, mean, 3, 12, format);
+                    writer_put_string(w, ", StdDeviation   = ");
+                    write_fixed(w, stddev, 3, 12, format);
+                    writer_put_string(w, "]\n#[Max     = ");
+                    write_fixed(w, max, 3, 12, format);
+                    writer_put_string(w, ", Total count    = ");
+                    write_integer(w, h->total_count, 12);
+                    writer_put_string(w, "]\n#[Buckets = ");
+                    write_integer(w, h->bucket_count, 12);
+                    writer_put_string(w, ", SubBuckets     = ");
+                    write_integer(w, h->sub_bucket_count, 12);
+                    writer_put_string(w, "]\n");
             }
+        }
 
-            percentiles = &iter.specifics.percentiles;
+        s32 hdr_percentiles_write(const hdr_histogram* h, hdr_writer* w, s32 ticks_per_half_distance, f64 value_scale, format_type format)
+        {
+            write_head(w, format);
+
+            // Emits the same lines as the percentile iterator (see percentile_iter_next) while
+            // summing the values for the mean and the standard deviation of the footer.  The
+            // recorded iterator skips the empty buckets through the occupancy bitmap.
+            struct hdr_iter iter;
+            hdr_iter_recorded_init(&iter, h);
+
+            hdr_u128 sum                      = {0, 0};
+            hdr_u128 sum_squares              = {0, 0};
+            bool     negative                 = false;
+            f64      percentile_to_iterate_to = 0.0;
+            s64      half_distance            = 1;
+            s64      line                     = 0;
             while (hdr_iter_next(&iter))
             {
-                f64 value               = iter.highest_equivalent_value / value_scale;
-                f64 percentile          = percentiles->percentile / 100.0;
-                s64 total_count         = iter.cumulative_count;
-                f64 inverted_percentile = (1.0 / (1.0 - percentile));
+                const hdr_u128 count_sum = u128_mul_64((u64)(iter.count < 0 ? -iter.count : iter.count), (u64)iter.median_equivalent_value);
+                if (iter.count < 0)
+                {
+                    u128_sub(&sum, count_sum);
+                    u128_sub(&sum_squares, u128_mul(count_sum, (u64)iter.median_equivalent_value));
+                    negative = true;
+                }
+                else
+                {
+                    u128_add(&sum, count_sum);
+                    u128_add(&sum_squares, u128_mul(count_sum, (u64)iter.median_equivalent_value));
+                }
 
-                if (fprintf(stream, line_format, value, percentile, total_count, inverted_percentile) < 0)
+                const f64 current_percentile = (100.0 * (f64)iter.cumulative_count) / h->total_count;
+                while (percentile_to_iterate_to <= current_percentile)
                 {
-                    rc = EIO;
-                    goto cleanup;
+                    write_line(w, format, h->significant_figures, iter.highest_equivalent_value / value_scale, percentile_to_iterate_to / 100.0, iter.cumulative_count, line++);
+                    percentile_to_iterate_to = next_percentile_tick(percentile_to_iterate_to, ticks_per_half_distance, &half_distance);
+                    if (!has_next(&iter))
+                    {
+                        break;
+                    }
                 }
             }
+            write_line(w, format, h->significant_figures, iter.highest_equivalent_value / value_scale, 1.0, iter.cumulative_count, line);
 
-            if (CLASSIC == format)
+            if (CSV != format)
             {
-                f64 mean   = hdr_mean(h) / value_scale;
-                f64 stddev = hdr_stddev(h) / value_scale;
-                f64 max    = hdr_max(h) / value_scale;
-
-                if (fprintf(stream, CLASSIC_FOOTER, mean, stddev, max, h->total_count, h->bucket_count, h->sub_bucket_count) < 0)
+                f64 mean, stddev;
+                if (0 < h->total_count && !negative && 0 == sum.hi && sum.lo <= (u64)limits_t<s64>::maximum())
+                {
+                    mean   = ((s64)sum.lo * 1.0) / h->total_count;
+                    stddev = stddev_of_sums(sum.lo, sum_squares, h->total_count);
+                }
+                else
                 {
-                    rc = EIO;
-                    goto cleanup;
+                    // The squares of the deviations are summed in a second pass, subtracting the
+                    // squared mean from the mean of the squares cancels out at these magnitudes
+                    mean                    = u128_to_f64_signed(sum) / h->total_count;
+                    f64 geometric_dev_total = 0.0;
+                    hdr_iter_recorded_init(&iter, h);
+                    while (hdr_iter_next(&iter))
+                    {
+                        const f64 dev = (iter.median_equivalent_value * 1.0) - mean;
+                        geometric_dev_total += (dev * dev) * iter.count;
+                    }
+                    stddev = sqrt(geometric_dev_total / h->total_count);
                 }
+
+                write_footer(w, h, format, mean / value_scale, stddev / value_scale, hdr_max(h) / value_scale);
             }
 
-        cleanup:
-            return rc;
+            return hdr_writer_flush(w);
+        }
+
+        static s32 file_sink(void* user, const char* data, u32 length) { return fwrite(data, 1, length, (FILE*)user) == length ? 0 : EIO; }
+
+        s32 hdr_percentiles_print(hdr_histogram* h, FILE* stream, s32 ticks_per_half_distance, f64 value_scale, format_type format)
+        {
+            char       buffer[512];
+            hdr_writer w;
+            hdr_writer_init_sink(&w, buffer, sizeof(buffer), file_sink, stream);
+            return hdr_percentiles_write(h, &w, ticks_per_half_distance, value_scale, format);
         }
     } // namespace nhdr
 };    // namespace ncore
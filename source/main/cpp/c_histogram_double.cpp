@@ -0,0 +1,313 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_double.h"
+#include "chistogram/private/c_histogram_common.h"
+
+#include <math.h>
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        // Values are never allowed to get within a couple of binary orders of magnitude of
+        // the largest double, the covered range could otherwise shift up into infinity.
+        static const f64 HDR_DBL_HIGHEST_ALLOWED_VALUE = 2.2471164185778949e+307; // 2^1021
+
+        // The initial range is far above any sensible value, the first value recorded shifts
+        // the covered range down towards it and leaves the higher end of the range empty.
+        static const f64 HDR_DBL_INITIAL_LOWEST_VALUE = 6.668014432879854e+240; // 2^800
+
+        // The number of bits needed to hold 'value', i.e. the smallest n with 2^n > value.
+        static s32 containing_binary_order_of_magnitude(s64 value)
+        {
+            s32 order = 0;
+            while (order < 63 && ((s64)1 << order) <= value)
+            {
+                order++;
+            }
+            return order;
+        }
+
+        static s32 capped_containing_binary_order_of_magnitude(const hdr_dbl_histogram* h, f64 value)
+        {
+            if (value > (f64)h->highest_to_lowest_value_ratio)
+            {
+                return (s32)(log((f64)h->highest_to_lowest_value_ratio) / log(2.0));
+            }
+            if (value > 1125899906842624.0) // 2^50
+            {
+                return 50;
+            }
+            return containing_binary_order_of_magnitude((s64)ceil(value));
+        }
+
+        static void set_trackable_value_range(hdr_dbl_histogram* h, f64 lowest_value, f64 highest_value_limit)
+        {
+            h->current_lowest_value         = lowest_value;
+            h->current_highest_value_limit  = highest_value_limit;
+            h->int_to_dbl_conversion_ratio  = lowest_value / h->values->sub_bucket_half_count;
+            h->dbl_to_int_conversion_ratio  = 1.0 / h->int_to_dbl_conversion_ratio;
+            h->values->conversion_ratio     = h->int_to_dbl_conversion_ratio;
+        }
+
+        // Covering lower values, the integer values are shifted up so they keep converting to
+        // the same double values.
+        static bool shift_covered_range_to_the_right(hdr_dbl_histogram* h, s32 binary_orders_of_magnitude)
+        {
+            if (0 != hdr_shift_values_left(h->values, binary_orders_of_magnitude))
+            {
+                return false;
+            }
+            const f64 shift_multiplier = 1.0 / (f64)((s64)1 << binary_orders_of_magnitude);
+            set_trackable_value_range(h, h->current_lowest_value * shift_multiplier, h->current_highest_value_limit * shift_multiplier);
+            return true;
+        }
+
+        // Covering higher values, the integer values are shifted down so they keep converting
+        // to the same double values.
+        static bool shift_covered_range_to_the_left(hdr_dbl_histogram* h, s32 binary_orders_of_magnitude)
+        {
+            if (0 != hdr_shift_values_right(h->values, binary_orders_of_magnitude))
+            {
+                return false;
+            }
+            const f64 shift_multiplier = (f64)((s64)1 << binary_orders_of_magnitude);
+            set_trackable_value_range(h, h->current_lowest_value * shift_multiplier, h->current_highest_value_limit * shift_multiplier);
+            return true;
+        }
+
+        static bool auto_adjust_range_for_value(hdr_dbl_histogram* h, f64 value)
+        {
+            if (0.0 == value)
+            {
+                return true;
+            }
+
+            if (value < h->current_lowest_value)
+            {
+                do
+                {
+                    const s32 shift = capped_containing_binary_order_of_magnitude(h, ceil(h->current_lowest_value / value) - 1.0);
+                    if (!shift_covered_range_to_the_right(h, shift))
+                    {
+                        return false;
+                    }
+                } while (value < h->current_lowest_value);
+            }
+            else if (value >= h->current_highest_value_limit)
+            {
+                if (value > HDR_DBL_HIGHEST_ALLOWED_VALUE)
+                {
+                    return false;
+                }
+                do
+                {
+                    // A value that is an exact multiple of the limit belongs to the next range up,
+                    // using the next larger double for the ratio shifts those (and only those) up.
+                    const s32 shift = capped_containing_binary_order_of_magnitude(h, ceil(nextafter(value, HUGE_VAL) / h->current_highest_value_limit) - 1.0);
+                    if (!shift_covered_range_to_the_left(h, shift))
+                    {
+                        return false;
+                    }
+                } while (value >= h->current_highest_value_limit);
+            }
+            return true;
+        }
+
+        s32 hdr_dbl_init(s64 highest_to_lowest_value_ratio, s32 significant_figures, hdr_dbl_histogram** result)
+        {
+            return hdr_dbl_init(highest_to_lowest_value_ratio, significant_figures, context_t::system_alloc(), result);
+        }
+
+        s32 hdr_dbl_init(s64 highest_to_lowest_value_ratio, s32 significant_figures, alloc_t* allocator, hdr_dbl_histogram** result)
+        {
+            if (highest_to_lowest_value_ratio < 2 || significant_figures < 1 || 5 < significant_figures)
+            {
+                return EINVAL;
+            }
+            if ((f64)highest_to_lowest_value_ratio * pow(10.0, significant_figures) >= (f64)((s64)1 << 61))
+            {
+                return EINVAL;
+            }
+
+            // The lowest half of the first bucket lacks the precision to hold double values, the
+            // covered range is placed in the upper halves of the buckets.  It needs one binary
+            // order of magnitude more than the range itself since the range rarely starts at a
+            // power of two.
+            struct hdr_histogram_bucket_config cfg;
+            s32                                r = hdr_calculate_bucket_config(1, 2, significant_figures, &cfg);
+            if (r)
+            {
+                return r;
+            }
+            const s64 internal_ratio      = (s64)1 << (containing_binary_order_of_magnitude(highest_to_lowest_value_ratio) + 1);
+            const s64 integer_value_range = (s64)cfg.sub_bucket_half_count * internal_ratio;
+
+            hdr_dbl_histogram* h = (hdr_dbl_histogram*)allocator->allocate(sizeof(hdr_dbl_histogram), sizeof(f64));
+            if (!h)
+            {
+                return ENOMEM;
+            }
+
+            r = hdr_init(1, integer_value_range - 1, significant_figures, allocator, &h->values);
+            if (r)
+            {
+                allocator->deallocate(h);
+                return r;
+            }
+
+            h->highest_to_lowest_value_ratio = highest_to_lowest_value_ratio;
+            h->allocator                     = allocator;
+            set_trackable_value_range(h, HDR_DBL_INITIAL_LOWEST_VALUE, HDR_DBL_INITIAL_LOWEST_VALUE * internal_ratio);
+
+            *result = h;
+            return 0;
+        }
+
+        void hdr_dbl_close(hdr_dbl_histogram* h)
+        {
+            if (h)
+            {
+                hdr_close(h->values);
+                h->allocator->deallocate(h);
+            }
+        }
+
+        void hdr_dbl_reset(hdr_dbl_histogram* h)
+        {
+            const f64 range = h->current_highest_value_limit / h->current_lowest_value;
+            hdr_reset(h->values);
+            set_trackable_value_range(h, HDR_DBL_INITIAL_LOWEST_VALUE, HDR_DBL_INITIAL_LOWEST_VALUE * range);
+        }
+
+        bool hdr_dbl_record_value(hdr_dbl_histogram* h, f64 value) { return hdr_dbl_record_values(h, value, 1); }
+
+        bool hdr_dbl_record_values(hdr_dbl_histogram* h, f64 value, s64 count)
+        {
+            if (value < h->current_lowest_value || value >= h->current_highest_value_limit)
+            {
+                if (!(value >= 0.0) || !auto_adjust_range_for_value(h, value))
+                {
+                    return false;
+                }
+            }
+
+            return hdr_record_values(h->values, (s64)(value * h->dbl_to_int_conversion_ratio), count);
+        }
+
+        s64 hdr_dbl_add(hdr_dbl_histogram* h, const hdr_dbl_histogram* from)
+        {
+            struct hdr_iter iter;
+            s64             dropped = 0;
+            hdr_iter_recorded_init(&iter, from->values);
+
+            while (hdr_iter_next(&iter))
+            {
+                if (!hdr_dbl_record_values(h, iter.value * from->int_to_dbl_conversion_ratio, iter.count))
+                {
+                    dropped += iter.count;
+                }
+            }
+
+            return dropped;
+        }
+
+        f64 hdr_dbl_min(const hdr_dbl_histogram* h) { return hdr_min(h->values) * h->int_to_dbl_conversion_ratio; }
+
+        f64 hdr_dbl_max(const hdr_dbl_histogram* h) { return hdr_max(h->values) * h->int_to_dbl_conversion_ratio; }
+
+        f64 hdr_dbl_value_at_percentile(const hdr_dbl_histogram* h, f64 percentile) { return hdr_value_at_percentile(h->values, percentile) * h->int_to_dbl_conversion_ratio; }
+
+        f64 hdr_dbl_mean(const hdr_dbl_histogram* h) { return hdr_mean(h->values) * h->int_to_dbl_conversion_ratio; }
+
+        f64 hdr_dbl_stddev(const hdr_dbl_histogram* h) { return hdr_stddev(h->values) * h->int_to_dbl_conversion_ratio; }
+
+        s64 hdr_dbl_count_at_value(const hdr_dbl_histogram* h, f64 value)
+        {
+            if (!(value >= 0.0) || value >= h->current_highest_value_limit)
+            {
+                return 0;
+            }
+            return hdr_count_at_value(h->values, (s64)(value * h->dbl_to_int_conversion_ratio));
+        }
+
+        bool hdr_dbl_values_are_equivalent(const hdr_dbl_histogram* h, f64 a, f64 b)
+        {
+            return hdr_values_are_equivalent(h->values, (s64)(a * h->dbl_to_int_conversion_ratio), (s64)(b * h->dbl_to_int_conversion_ratio));
+        }
+
+        /* #### ######## ######## ########     ###    ########  #######  ########   ######  */
+        /*  ##     ##    ##       ##     ##   ## ##      ##    ##     ## ##     ## ##    ## */
+        /*  ##     ##    ##       ##     ##  ##   ##     ##    ##     ## ##     ## ##       */
+        /*  ##     ##    ######   ########  ##     ##    ##    ##     ## ########   ######  */
+        /*  ##     ##    ##       ##   ##   #########    ##    ##     ## ##   ##         ## */
+        /*  ##     ##    ##       ##    ##  ##     ##    ##    ##     ## ##    ##  ##    ## */
+        /* ####    ##    ######## ##     ## ##     ##    ##     #######  ##     ##  ######  */
+
+        static void dbl_iter_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h)
+        {
+            iter->int_to_dbl_conversion_ratio = h->int_to_dbl_conversion_ratio;
+            iter->count                       = 0;
+            iter->cumulative_count            = 0;
+            iter->value                       = 0.0;
+            iter->highest_equivalent_value    = 0.0;
+            iter->lowest_equivalent_value     = 0.0;
+            iter->median_equivalent_value     = 0.0;
+            iter->value_iterated_from         = 0.0;
+            iter->value_iterated_to           = 0.0;
+        }
+
+        void hdr_dbl_iter_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h)
+        {
+            dbl_iter_init(iter, h);
+            hdr_iter_init(&iter->iter, h->values);
+        }
+
+        void hdr_dbl_iter_percentile_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h, s32 ticks_per_half_distance)
+        {
+            dbl_iter_init(iter, h);
+            hdr_iter_percentile_init(&iter->iter, h->values, ticks_per_half_distance);
+        }
+
+        void hdr_dbl_iter_recorded_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h)
+        {
+            dbl_iter_init(iter, h);
+            hdr_iter_recorded_init(&iter->iter, h->values);
+        }
+
+        void hdr_dbl_iter_linear_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h, f64 value_units_per_bucket)
+        {
+            dbl_iter_init(iter, h);
+            hdr_iter_linear_init(&iter->iter, h->values, (s64)(value_units_per_bucket * h->dbl_to_int_conversion_ratio));
+        }
+
+        void hdr_dbl_iter_log_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h, f64 value_units_first_bucket, f64 log_base)
+        {
+            dbl_iter_init(iter, h);
+            hdr_iter_log_init(&iter->iter, h->values, (s64)(value_units_first_bucket * h->dbl_to_int_conversion_ratio), log_base);
+        }
+
+        bool hdr_dbl_iter_next(struct hdr_dbl_iter* iter)
+        {
+            if (!hdr_iter_next(&iter->iter))
+            {
+                return false;
+            }
+
+            const f64 ratio                = iter->int_to_dbl_conversion_ratio;
+            iter->count                    = iter->iter.count;
+            iter->cumulative_count         = iter->iter.cumulative_count;
+            iter->value                    = iter->iter.value * ratio;
+            iter->highest_equivalent_value = iter->iter.highest_equivalent_value * ratio;
+            iter->lowest_equivalent_value  = iter->iter.lowest_equivalent_value * ratio;
+            iter->median_equivalent_value  = iter->iter.median_equivalent_value * ratio;
+            iter->value_iterated_from      = iter->iter.value_iterated_from * ratio;
+            iter->value_iterated_to        = iter->iter.value_iterated_to * ratio;
+            return true;
+        }
+
+    } // namespace nhdr
+}; // namespace ncore
@@ -0,0 +1,273 @@
+#include "ccore/c_target.h"
+#include "cbase/c_memory.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_encoding.h"
+#include "chistogram/private/c_histogram_common.h"
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        // The low nibble of the second to last byte holds the word size, 0x10 for the V2
+        // LEB128 payload, decoders ignore it like the reference implementations do.
+        const s32 V2_ENCODING_COOKIE      = 0x1c849313;
+        const s32 V2_ENCODING_COOKIE_BASE = 0x1c849303;
+        const s32 V2_ENCODING_COOKIE_MASK = ~0xf0;
+        const s32 V2_HEADER_SIZE          = 40;
+        const s32 V2_MAX_WORD_SIZE        = 9;
+
+        /* ######## ##    ##  ######   #######  ########  #### ##    ##  ######   */
+        /* ##       ###   ## ##    ## ##     ## ##     ##  ##  ###   ## ##    ##  */
+        /* ##       ####  ## ##       ##     ## ##     ##  ##  ####  ## ##        */
+        /* ######   ## ## ## ##       ##     ## ##     ##  ##  ## ## ## ##   #### */
+        /* ##       ##  #### ##       ##     ## ##     ##  ##  ##  #### ##    ##  */
+        /* ##       ##   ### ##    ## ##     ## ##     ##  ##  ##   ### ##    ##  */
+        /* ######## ##    ##  ######   #######  ########  #### ##    ##  ######   */
+
+        static void write_be32(u8* buffer, u32 value)
+        {
+            buffer[0] = (u8)(value >> 24);
+            buffer[1] = (u8)(value >> 16);
+            buffer[2] = (u8)(value >> 8);
+            buffer[3] = (u8)(value);
+        }
+
+        static void write_be64(u8* buffer, u64 value)
+        {
+            write_be32(buffer, (u32)(value >> 32));
+            write_be32(buffer + 4, (u32)value);
+        }
+
+        static u32 read_be32(const u8* buffer) { return ((u32)buffer[0] << 24) | ((u32)buffer[1] << 16) | ((u32)buffer[2] << 8) | (u32)buffer[3]; }
+
+        static u64 read_be64(const u8* buffer) { return ((u64)read_be32(buffer) << 32) | (u64)read_be32(buffer + 4); }
+
+        // LEB128-64b9B variant as used by HdrHistogram, 7 bits per byte for the first 8 bytes
+        // and all 8 bits in the 9th byte, so a 64 bit value never takes more than 9 bytes.
+        static s32 zig_zag_encode_i64(u8* buffer, s64 signed_value)
+        {
+            u64 value = ((u64)signed_value << 1) ^ (u64)(signed_value >> 63);
+            s32 i     = 0;
+            while (i < 8 && (value >> 7) != 0)
+            {
+                buffer[i++] = (u8)((value & 0x7F) | 0x80);
+                value >>= 7;
+            }
+            buffer[i++] = (u8)value;
+            return i;
+        }
+
+        static s32 zig_zag_decode_i64(const u8* buffer, const u8* end, s64* signed_value)
+        {
+            u64 value = 0;
+            s32 i     = 0;
+            for (;;)
+            {
+                if (buffer + i >= end)
+                {
+                    return 0;
+                }
+                const u8 b = buffer[i];
+                if (i == 8)
+                {
+                    value |= (u64)b << 56;
+                    i++;
+                    break;
+                }
+                value |= (u64)(b & 0x7F) << (7 * i);
+                i++;
+                if (0 == (b & 0x80))
+                {
+                    break;
+                }
+            }
+            *signed_value = (s64)((value >> 1) ^ (~(value & 1) + 1));
+            return i;
+        }
+
+        u64 hdr_encode_size_bound(const hdr_histogram* h)
+        {
+            // Every populated index takes at most one word, and so does every run of empty
+            // indices in between, which bounds the payload by one word per index up to the max.
+            const s32 counts_limit = (0 == h->total_count) ? 0 : hdr_counts_index_for(h, hdr_max(h)) + 1;
+            return (u64)V2_HEADER_SIZE + (u64)counts_limit * V2_MAX_WORD_SIZE;
+        }
+
+        s32 hdr_encode(const hdr_histogram* h, u8* buffer, u64 buffer_size, u64* encoded_size)
+        {
+            if (buffer_size < (u64)V2_HEADER_SIZE)
+            {
+                return ENOMEM;
+            }
+
+            u8*       payload     = buffer + V2_HEADER_SIZE;
+            const u8* payload_end = buffer + buffer_size;
+
+            // The counts are walked index by index, a negative count (left by a subtraction)
+            // can't be encoded since the format writes a negative word for a run of zeros.
+            const s32 counts_limit = (0 == h->total_count) ? 0 : hdr_counts_index_for(h, hdr_max(h)) + 1;
+            s32       next_index   = 0;
+            for (s32 i = 0; i < counts_limit; i++)
+            {
+                const s64 count = hdr_count_at_index(h, i);
+                if (count < 0)
+                {
+                    return EINVAL;
+                }
+                if (0 == count)
+                {
+                    continue;
+                }
+
+                // A run of empty indices takes one word for at least one index, so the words
+                // needed never exceed the words hdr_encode_size_bound allows for the indices
+                const s32 zeros = i - next_index;
+                if ((u64)(payload_end - payload) < (u64)(zeros > 0 ? 2 : 1) * V2_MAX_WORD_SIZE)
+                {
+                    return ENOMEM;
+                }
+
+                if (zeros > 0)
+                {
+                    payload += zig_zag_encode_i64(payload, -(s64)zeros);
+                }
+                payload += zig_zag_encode_i64(payload, count);
+                next_index = i + 1;
+            }
+
+            f64 conversion_ratio = h->conversion_ratio;
+            u64 conversion_ratio_bits;
+            nmem::memcpy(&conversion_ratio_bits, &conversion_ratio, sizeof(u64));
+
+            const u64 payload_len = (u64)(payload - (buffer + V2_HEADER_SIZE));
+            write_be32(buffer + 0, (u32)V2_ENCODING_COOKIE);
+            write_be32(buffer + 4, (u32)payload_len);
+            write_be32(buffer + 8, 0); // counts are written in logical order, normalizing index offset is 0
+            write_be32(buffer + 12, (u32)h->significant_figures);
+            write_be64(buffer + 16, (u64)h->lowest_discernible_value);
+            write_be64(buffer + 24, (u64)h->highest_trackable_value);
+            write_be64(buffer + 32, conversion_ratio_bits);
+
+            *encoded_size = (u64)V2_HEADER_SIZE + payload_len;
+            return 0;
+        }
+
+        /* ########  ########  ######   #######  ########  #### ##    ##  ######   */
+        /* ##     ## ##       ##    ## ##     ## ##     ##  ##  ###   ## ##    ##  */
+        /* ##     ## ##       ##       ##     ## ##     ##  ##  ####  ## ##        */
+        /* ##     ## ######   ##       ##     ## ##     ##  ##  ## ## ## ##   #### */
+        /* ##     ## ##       ##       ##     ## ##     ##  ##  ##  #### ##    ##  */
+        /* ##     ## ##       ##    ## ##     ## ##     ##  ##  ##   ### ##    ##  */
+        /* ########  ########  ######   #######  ########  #### ##    ##  ######   */
+
+        s32 hdr_decode_config(const u8* buffer, u64 length, struct hdr_histogram_bucket_config* cfg)
+        {
+            if (nullptr == buffer || length < (u64)V2_HEADER_SIZE || V2_ENCODING_COOKIE_BASE != ((s32)read_be32(buffer) & V2_ENCODING_COOKIE_MASK))
+            {
+                return EINVAL;
+            }
+
+            const u64 payload_len = read_be32(buffer + 4);
+            if (payload_len > length - V2_HEADER_SIZE)
+            {
+                return EINVAL;
+            }
+
+            const s32 significant_figures      = (s32)read_be32(buffer + 12);
+            const s64 lowest_discernible_value = (s64)read_be64(buffer + 16);
+            const s64 highest_trackable_value  = (s64)read_be64(buffer + 24);
+            return hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, cfg);
+        }
+
+        // Walks the counts in the payload, which are in logical order, the normalizing index
+        // offset in the header only describes how the sender stored them.  Returns the lowest
+        // and highest value with a count, -1 when there are none, and records the counts in
+        // 'h' unless it is nullptr.
+        static s32 decode_payload(const hdr_histogram* encoded, const u8* payload, const u8* payload_end, hdr_histogram* h, s64* lowest_value, s64* highest_value)
+        {
+            *lowest_value  = -1;
+            *highest_value = -1;
+
+            s64 index = 0;
+            while (payload < payload_end)
+            {
+                s64       count;
+                const s32 read = zig_zag_decode_i64(payload, payload_end, &count);
+                if (0 == read)
+                {
+                    return EINVAL;
+                }
+                payload += read;
+
+                if (count < 0)
+                {
+                    // A run of -count empty indices, which has to end within the counts
+                    if (count < index - encoded->counts_len)
+                    {
+                        return EINVAL;
+                    }
+                    index -= count;
+                    continue;
+                }
+
+                if (index >= encoded->counts_len)
+                {
+                    return EINVAL;
+                }
+
+                if (count > 0)
+                {
+                    const s64 value = hdr_value_at_index(encoded, (s32)index);
+                    if (h && !hdr_record_values(h, value, count))
+                    {
+                        return EINVAL;
+                    }
+                    *lowest_value  = (*lowest_value < 0) ? value : *lowest_value;
+                    *highest_value = value;
+                }
+                index++;
+            }
+
+            return 0;
+        }
+
+        s32 hdr_decode(hdr_histogram* h, const u8* buffer, u64 length)
+        {
+            struct hdr_histogram_bucket_config cfg;
+            s32                                r = hdr_decode_config(buffer, length, &cfg);
+            if (r)
+            {
+                return r;
+            }
+
+            // The counts indices in the payload are relative to the encoded configuration,
+            // a header-only histogram translates them back to values.
+            hdr_histogram encoded;
+            hdr_init_preallocated(&encoded, &cfg);
+
+            const u8* payload     = buffer + V2_HEADER_SIZE;
+            const u8* payload_end = payload + read_be32(buffer + 4);
+
+            // The whole payload is checked before anything is recorded, a malformed buffer or
+            // a value that 'h' can't hold leaves 'h' untouched.
+            s64 lowest_value, highest_value;
+            r = decode_payload(&encoded, payload, payload_end, nullptr, &lowest_value, &highest_value);
+            if (r)
+            {
+                return r;
+            }
+            if (lowest_value < 0)
+            {
+                return 0;
+            }
+            if (hdr_counts_index_for(h, lowest_value) < 0 || (0 == (h->flags & HDR_AUTO_RESIZE) && hdr_counts_index_for(h, highest_value) >= h->counts_len))
+            {
+                return EINVAL;
+            }
+
+            return decode_payload(&encoded, payload, payload_end, h, &lowest_value, &highest_value);
+        }
+
+    } // namespace nhdr
+}; // namespace ncore
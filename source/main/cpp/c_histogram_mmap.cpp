@@ -0,0 +1,562 @@
+#include "ccore/c_target.h"
+#include "cbase/c_limits.h"
+#include "cbase/c_memory.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_mmap.h"
+#include "chistogram/private/c_histogram_atomic.h"
+#include "chistogram/private/c_histogram_common.h"
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        // The file starts with a header on a cache line of its own, followed by the histogram
+        // block and a counter of finished records for every page of 64 counts:
+        //   [hdr_mmap_header][hdr_histogram][side tables][counts][page counters]
+        // The block holds the raw hdr_histogram struct, the version (and the size of the struct)
+        // must change whenever its layout changes.
+        const u32 HDR_MMAP_COOKIE      = 0x4d524448; // "HDRM"
+        const u32 HDR_MMAP_VERSION     = 2;
+        const u32 HDR_MMAP_CLOSED      = 0;
+        const u32 HDR_MMAP_OPEN        = 1;
+        const u64 HDR_MMAP_HEADER_SIZE = 64;
+        const s32 HDR_MMAP_PAGE_SHIFT  = 6;
+
+        struct hdr_mmap_header
+        {
+            u32 cookie;
+            u32 version;
+            u32 histogram_size; // sizeof(hdr_histogram) of the writer
+            u32 flags;
+            s64 lowest_discernible_value;
+            s64 highest_trackable_value;
+            s32 significant_figures;
+            s32 counts_len;
+            u64 file_size;
+            u32 checksum; // FNV-1a over all the fields above
+            u32 state;    // HDR_MMAP_OPEN while a writer has the file mapped
+        };
+
+        /* ######## #### ##       ########  */
+        /* ##        ##  ##       ##        */
+        /* ##        ##  ##       ##        */
+        /* ######    ##  ##       ######    */
+        /* ##        ##  ##       ##        */
+        /* ##        ##  ##       ##        */
+        /* ##       #### ######## ########  */
+
+        static bool file_open(const char* path, bool writable, s64* file)
+        {
+#if defined(_WIN32)
+            HANDLE handle = CreateFileA(path, writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            *file         = (s64)handle;
+            return INVALID_HANDLE_VALUE != handle;
+#else
+            const int fd = writable ? ::open(path, O_RDWR | O_CREAT, 0644) : ::open(path, O_RDONLY);
+            *file        = fd;
+            return fd >= 0;
+#endif
+        }
+
+        static void file_close(s64 file)
+        {
+#if defined(_WIN32)
+            if (INVALID_HANDLE_VALUE != (HANDLE)file)
+            {
+                CloseHandle((HANDLE)file);
+            }
+#else
+            ::close((int)file);
+#endif
+        }
+
+        static s64 file_size(s64 file)
+        {
+#if defined(_WIN32)
+            LARGE_INTEGER size;
+            return GetFileSizeEx((HANDLE)file, &size) ? (s64)size.QuadPart : -1;
+#else
+            struct stat st;
+            return 0 == ::fstat((int)file, &st) ? (s64)st.st_size : -1;
+#endif
+        }
+
+        static bool file_resize(s64 file, u64 size)
+        {
+#if defined(_WIN32)
+            LARGE_INTEGER position;
+            position.QuadPart = (LONGLONG)size;
+            return SetFilePointerEx((HANDLE)file, position, nullptr, FILE_BEGIN) && SetEndOfFile((HANDLE)file);
+#else
+            return 0 == ::ftruncate((int)file, (off_t)size);
+#endif
+        }
+
+        static u8* file_map(s64 file, u64 size, bool writable, s64* mapping)
+        {
+#if defined(_WIN32)
+            HANDLE handle = CreateFileMappingA((HANDLE)file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(size >> 32), (DWORD)size, nullptr);
+            if (nullptr == handle)
+            {
+                return nullptr;
+            }
+            void* view = MapViewOfFile(handle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)size);
+            if (nullptr == view)
+            {
+                CloseHandle(handle);
+                return nullptr;
+            }
+            *mapping = (s64)handle;
+            return (u8*)view;
+#else
+            void* view = ::mmap(nullptr, (size_t)size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, (int)file, 0);
+            *mapping   = 0;
+            return MAP_FAILED == view ? nullptr : (u8*)view;
+#endif
+        }
+
+        static s32 shared_map(const char* name, u64 size, s64* file, s64* mapping, bool* created, u8** base)
+        {
+#if defined(_WIN32)
+            HANDLE handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, name);
+            if (nullptr == handle)
+            {
+                return EIO;
+            }
+            *created   = ERROR_ALREADY_EXISTS != GetLastError();
+            void* view = MapViewOfFile(handle, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+            if (nullptr == view)
+            {
+                CloseHandle(handle);
+                return EIO;
+            }
+            *file    = (s64)INVALID_HANDLE_VALUE;
+            *mapping = (s64)handle;
+            *base    = (u8*)view;
+            return 0;
+#else
+            int fd   = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+            *created = fd >= 0;
+            if (fd < 0)
+            {
+                fd = ::shm_open(name, O_RDWR, 0644);
+            }
+            if (fd < 0)
+            {
+                return EIO;
+            }
+            *file = fd;
+
+            if (*created ? !file_resize(fd, size) : file_size(fd) != (s64)size)
+            {
+                file_close(fd);
+                return *created ? EIO : EINVAL;
+            }
+            *base = file_map(fd, size, true, mapping);
+            if (nullptr == *base)
+            {
+                file_close(fd);
+                return EIO;
+            }
+            return 0;
+#endif
+        }
+
+        static bool file_sync(u8* base, u64 size, s64 file)
+        {
+#if defined(_WIN32)
+            return FlushViewOfFile(base, (SIZE_T)size) && FlushFileBuffers((HANDLE)file);
+#else
+            (void)file;
+            return 0 == ::msync(base, (size_t)size, MS_SYNC);
+#endif
+        }
+
+        static void file_unmap(u8* base, u64 size, s64 mapping)
+        {
+#if defined(_WIN32)
+            (void)size;
+            UnmapViewOfFile(base);
+            CloseHandle((HANDLE)mapping);
+#else
+            (void)mapping;
+            ::munmap(base, (size_t)size);
+#endif
+        }
+
+        /* ##     ## ########    ###    ########  ######## ########  */
+        /* ##     ## ##         ## ##   ##     ## ##       ##     ## */
+        /* ##     ## ##        ##   ##  ##     ## ##       ##     ## */
+        /* ######### ######   ##     ## ##     ## ######   ########  */
+        /* ##     ## ##       ######### ##     ## ##       ##   ##   */
+        /* ##     ## ##       ##     ## ##     ## ##       ##    ##  */
+        /* ##     ## ######## ##     ## ########  ######## ##     ## */
+
+        // A page copied while its counter did not change holds every record into it that
+        // finished before the copy, see hdr_mmap_snapshot.
+        static u64 page_counters_size(s32 counts_len) { return ((((u64)counts_len + 63) >> HDR_MMAP_PAGE_SHIFT) * sizeof(s64) + 63) & ~(u64)63; }
+
+        static u64 mapping_size(const struct hdr_histogram_bucket_config* cfg, u32 flags) { return HDR_MMAP_HEADER_SIZE + hdr_get_preallocated_size(cfg, flags) + page_counters_size(cfg->counts_len); }
+
+        static s64* page_counters(const hdr_mmap_histogram* m) { return (s64*)(m->base + m->size - page_counters_size(m->h->counts_len)); }
+
+        static u32 header_checksum(const hdr_mmap_header* header)
+        {
+            const u8* bytes = (const u8*)header;
+            const u64 size  = (u64)((const u8*)&header->checksum - bytes);
+            u32       hash  = 2166136261u;
+            for (u64 i = 0; i < size; i++)
+            {
+                hash = (hash ^ bytes[i]) * 16777619u;
+            }
+            return hash;
+        }
+
+        static bool header_valid(const u8* base, u64 size)
+        {
+            const hdr_mmap_header* header = (const hdr_mmap_header*)base;
+            if (size < HDR_MMAP_HEADER_SIZE + sizeof(hdr_histogram) || HDR_MMAP_COOKIE != header->cookie || HDR_MMAP_VERSION != header->version || sizeof(hdr_histogram) != header->histogram_size)
+            {
+                return false;
+            }
+            if (header_checksum(header) != header->checksum || header->file_size != size)
+            {
+                return false;
+            }
+
+            struct hdr_histogram_bucket_config cfg;
+            if (0 != hdr_calculate_bucket_config(header->lowest_discernible_value, header->highest_trackable_value, header->significant_figures, &cfg) || cfg.counts_len != header->counts_len)
+            {
+                return false;
+            }
+
+            const hdr_histogram* h = (const hdr_histogram*)(base + HDR_MMAP_HEADER_SIZE);
+            return size == mapping_size(&cfg, header->flags) && h->counts_len == header->counts_len;
+        }
+
+        static bool header_matches(const u8* base, u64 size, s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, u32 flags)
+        {
+            const hdr_mmap_header* header = (const hdr_mmap_header*)base;
+            return header_valid(base, size) && header->flags == flags && header->lowest_discernible_value == lowest_discernible_value && header->highest_trackable_value == highest_trackable_value &&
+                   header->significant_figures == significant_figures;
+        }
+
+        static hdr_histogram* header_init(u8* base, u64 size, struct hdr_histogram_bucket_config* cfg, u32 flags)
+        {
+            hdr_histogram* h = hdr_init_preallocated(base + HDR_MMAP_HEADER_SIZE, size - HDR_MMAP_HEADER_SIZE - page_counters_size(cfg->counts_len), cfg, flags);
+
+            hdr_mmap_header* header = (hdr_mmap_header*)base;
+            nmem::memset(base, 0, HDR_MMAP_HEADER_SIZE);
+            header->version                  = HDR_MMAP_VERSION;
+            header->histogram_size           = sizeof(hdr_histogram);
+            header->flags                    = flags;
+            header->lowest_discernible_value = cfg->lowest_discernible_value;
+            header->highest_trackable_value  = cfg->highest_trackable_value;
+            header->significant_figures      = (s32)cfg->significant_figures;
+            header->counts_len               = cfg->counts_len;
+            header->file_size                = size;
+            header->cookie                   = HDR_MMAP_COOKIE;
+            header->checksum                 = header_checksum(header);
+            header->state                    = HDR_MMAP_OPEN;
+            return h;
+        }
+
+        // Binds a process local copy of the mapped header to this process' mapping
+        static void view_bind(hdr_mmap_histogram* m)
+        {
+            nmem::memcpy(&m->view, m->base + HDR_MMAP_HEADER_SIZE, sizeof(hdr_histogram));
+            hdr_bind_preallocated(&m->view, m->base + HDR_MMAP_HEADER_SIZE);
+            m->h = &m->view;
+        }
+
+        /*  #######  ########  ######## ##    ## */
+        /* ##     ## ##     ## ##       ###   ## */
+        /* ##     ## ##     ## ##       ####  ## */
+        /* ##     ## ########  ######   ## ## ## */
+        /* ##     ## ##        ##       ##  #### */
+        /* ##     ## ##        ##       ##   ### */
+        /*  #######  ##        ######## ##    ## */
+
+        s32 hdr_mmap_open(hdr_mmap_histogram* m, const char* path, s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, u32 flags)
+        {
+            struct hdr_histogram_bucket_config cfg;
+            if (0 != (flags & (HDR_AUTO_PROMOTE | HDR_AUTO_RESIZE | HDR_COUNTS_PACKED | HDR_COUNTS_PAGED)) || 0 != hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg))
+            {
+                return EINVAL;
+            }
+
+            const u64 size = mapping_size(&cfg, flags);
+            if (!file_open(path, true, &m->file))
+            {
+                return EIO;
+            }
+
+            const s64 existing_size = file_size(m->file);
+            if (existing_size < 0 || (0 == existing_size && !file_resize(m->file, size)))
+            {
+                file_close(m->file);
+                return EIO;
+            }
+            if (0 != existing_size && (u64)existing_size != size)
+            {
+                file_close(m->file);
+                return EINVAL;
+            }
+
+            m->base = file_map(m->file, size, true, &m->mapping);
+            if (nullptr == m->base)
+            {
+                file_close(m->file);
+                return EIO;
+            }
+            m->size      = size;
+            m->read_only = false;
+            m->shared    = false;
+
+            hdr_mmap_header* header = (hdr_mmap_header*)m->base;
+            if (0 == existing_size || 0 == header->cookie)
+            {
+                // A new file, or one that was sized but never got its header
+                m->h = header_init(m->base, size, &cfg, flags);
+                return 0;
+            }
+
+            if (!header_matches(m->base, size, lowest_discernible_value, highest_trackable_value, significant_figures, flags))
+            {
+                file_unmap(m->base, size, m->mapping);
+                file_close(m->file);
+                m->base = nullptr;
+                return EINVAL;
+            }
+
+            m->h = (hdr_histogram*)(m->base + HDR_MMAP_HEADER_SIZE);
+            hdr_bind_preallocated(m->h, m->h);
+
+            // Not closed by the last writer, the counts are the truth and the rest is derived from them
+            if (HDR_MMAP_OPEN == header->state)
+            {
+                hdr_reset_internal_counters(m->h);
+            }
+            header->state = HDR_MMAP_OPEN;
+            return 0;
+        }
+
+        s32 hdr_mmap_open_read_only(hdr_mmap_histogram* m, const char* path)
+        {
+            if (!file_open(path, false, &m->file))
+            {
+                return EIO;
+            }
+
+            const s64 size = file_size(m->file);
+            if (size < (s64)(HDR_MMAP_HEADER_SIZE + sizeof(hdr_histogram)))
+            {
+                file_close(m->file);
+                return size < 0 ? EIO : EINVAL;
+            }
+
+            m->base = file_map(m->file, (u64)size, false, &m->mapping);
+            if (nullptr == m->base)
+            {
+                file_close(m->file);
+                return EIO;
+            }
+            if (!header_valid(m->base, (u64)size))
+            {
+                file_unmap(m->base, (u64)size, m->mapping);
+                file_close(m->file);
+                m->base = nullptr;
+                return EINVAL;
+            }
+
+            m->size      = (u64)size;
+            m->read_only = true;
+            m->shared    = false;
+            view_bind(m);
+            return 0;
+        }
+
+        void hdr_mmap_refresh(hdr_mmap_histogram* m)
+        {
+            if (m->read_only)
+            {
+                view_bind(m);
+            }
+        }
+
+        /*  ######  ##     ##    ###    ########  ######## ########  */
+        /* ##    ## ##     ##   ## ##   ##     ## ##       ##     ## */
+        /* ##       ##     ##  ##   ##  ##     ## ##       ##     ## */
+        /*  ######  ######### ##     ## ########  ######   ##     ## */
+        /*       ## ##     ## ######### ##   ##   ##       ##     ## */
+        /* ##    ## ##     ## ##     ## ##    ##  ##       ##     ## */
+        /*  ######  ##     ## ##     ## ##     ## ######## ########  */
+
+        s32 hdr_mmap_open_shared(hdr_mmap_histogram* m, const char* name, s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, u32 flags)
+        {
+            struct hdr_histogram_bucket_config cfg;
+            // The running sums live in the process local header, they would only sum up the
+            // records of the process itself
+            if (0 != (flags & (HDR_AUTO_PROMOTE | HDR_AUTO_RESIZE | HDR_COUNTS_PACKED | HDR_COUNTS_PAGED | HDR_RUNNING_SUMS)) || 0 != hdr_calculate_bucket_config(lowest_discernible_value, highest_trackable_value, significant_figures, &cfg))
+            {
+                return EINVAL;
+            }
+
+            const u64 size    = mapping_size(&cfg, flags);
+            bool      created = false;
+            const s32 rc      = shared_map(name, size, &m->file, &m->mapping, &created, &m->base);
+            if (0 != rc)
+            {
+                m->base = nullptr;
+                return rc;
+            }
+            m->size      = size;
+            m->read_only = false;
+            m->shared    = true;
+
+            if (created)
+            {
+                header_init(m->base, size, &cfg, flags);
+            }
+            else if (!header_matches(m->base, size, lowest_discernible_value, highest_trackable_value, significant_figures, flags))
+            {
+                file_unmap(m->base, size, m->mapping);
+                file_close(m->file);
+                m->base = nullptr;
+                return EINVAL;
+            }
+
+            view_bind(m);
+            return 0;
+        }
+
+        s32 hdr_mmap_unlink_shared(const char* name)
+        {
+#if defined(_WIN32)
+            // The segment goes away with the last handle to it
+            return 0;
+#else
+            return 0 == ::shm_unlink(name) ? 0 : EIO;
+#endif
+        }
+
+        bool hdr_mmap_record_value(hdr_mmap_histogram* m, s64 value) { return hdr_mmap_record_values(m, value, 1); }
+
+        bool hdr_mmap_record_values(hdr_mmap_histogram* m, s64 value, s64 count)
+        {
+            if (!hdr_record_values_atomic(m->h, value, count))
+            {
+                return false;
+            }
+
+            // Published after the count, a snapshot that sees the new counter sees the count
+            hdr_atomic_add_fetch_64(page_counters(m) + (hdr_counts_index_for(m->h, value) >> HDR_MMAP_PAGE_SHIFT), 1);
+            return true;
+        }
+
+        // Other processes write the counts with atomic read-modify-writes.  The counts of a
+        // shared histogram are never shifted, the index needs no normalizing.
+        static s64 count_load_relaxed(const hdr_histogram* h, s32 index)
+        {
+            switch (h->counts_word_size)
+            {
+                case sizeof(s16): return hdr_atomic_load_relaxed_16(&h->counts16[index]);
+                case sizeof(s32): return hdr_atomic_load_relaxed_32(&h->counts32[index]);
+                default: return hdr_atomic_load_relaxed_64(&h->counts[index]);
+            }
+        }
+
+        s32 hdr_mmap_snapshot(hdr_mmap_histogram* m, hdr_histogram* out, s32 max_attempts)
+        {
+            hdr_histogram* h = m->h;
+            if (out->counts_len != h->counts_len || out->unit_magnitude != h->unit_magnitude || out->sub_bucket_half_count_magnitude != h->sub_bucket_half_count_magnitude || sizeof(s64) != out->counts_word_size)
+            {
+                return EINVAL;
+            }
+
+            // Every page is copied until no record into it finished during the copy.  The copy
+            // then holds all the records that finished before it, and those still in flight are
+            // either in or out, as if they happened after it.  Only the counts are copied, the
+            // rest is derived from them.
+            s64* counters = page_counters(m);
+            hdr_reset(out);
+            for (s32 begin = 0; begin < h->counts_len; begin += 1 << HDR_MMAP_PAGE_SHIFT)
+            {
+                const s32 page    = begin >> HDR_MMAP_PAGE_SHIFT;
+                const s32 end     = begin + (1 << HDR_MMAP_PAGE_SHIFT) < h->counts_len ? begin + (1 << HDR_MMAP_PAGE_SHIFT) : h->counts_len;
+                s32       attempt = 0;
+                for (; attempt < max_attempts; attempt++)
+                {
+                    const s64 finished = hdr_atomic_load_64(&counters[page]);
+                    if (nullptr != h->occupancy && 0 == hdr_atomic_load_64((volatile s64*)&h->occupancy[page]))
+                    {
+                        // No finished record in the page, the page is empty
+                        nmem::memset(out->counts + begin, 0, (u64)(end - begin) * sizeof(s64));
+                    }
+                    else
+                    {
+                        for (s32 i = begin; i < end; i++)
+                        {
+                            out->counts[i] = count_load_relaxed(h, i);
+                        }
+                    }
+
+                    // The copy has to be complete before the counter is read again
+                    hdr_atomic_fence_acquire();
+                    if (finished == hdr_atomic_load_64(&counters[page]))
+                    {
+                        break;
+                    }
+                    hdr_atomic_pause();
+                }
+                if (attempt == max_attempts)
+                {
+                    return EBUSY;
+                }
+            }
+
+            hdr_reset_internal_counters(out);
+            return 0;
+        }
+
+        s32 hdr_mmap_sync(hdr_mmap_histogram* m)
+        {
+            if (m->read_only || m->shared)
+            {
+                return 0;
+            }
+            return file_sync(m->base, m->size, m->file) ? 0 : EIO;
+        }
+
+        void hdr_mmap_close(hdr_mmap_histogram* m)
+        {
+            if (nullptr == m->base)
+            {
+                return;
+            }
+
+            if (!m->read_only && !m->shared)
+            {
+                ((hdr_mmap_header*)m->base)->state = HDR_MMAP_CLOSED;
+                file_sync(m->base, m->size, m->file);
+            }
+            file_unmap(m->base, m->size, m->mapping);
+            file_close(m->file);
+            m->base = nullptr;
+            m->h    = nullptr;
+        }
+
+    } // namespace nhdr
+
+}; // namespace ncore
@@ -0,0 +1,153 @@
+#include "ccore/c_target.h"
+#include "cbase/c_limits.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_recorder.h"
+#include "chistogram/private/c_histogram_atomic.h"
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        /* ########  ##     ##    ###     ######  ######## ########  */
+        /* ##     ## ##     ##   ## ##   ##    ## ##       ##     ## */
+        /* ##     ## ##     ##  ##   ##  ##       ##       ##     ## */
+        /* ########  ######### ##     ##  ######  ######   ########  */
+        /* ##        ##     ## #########       ## ##       ##   ##   */
+        /* ##        ##     ## ##     ## ##    ## ##       ##    ##  */
+        /* ##        ##     ## ##     ##  ######  ######## ##     ## */
+
+        void hdr_phaser_init(hdr_writer_reader_phaser* p)
+        {
+            p->start_epoch    = 0;
+            p->even_end_epoch = 0;
+            p->odd_end_epoch  = limits_t<s64>::minimum();
+        }
+
+        // The sign of the start epoch identifies the phase a writer entered in, the end
+        // epoch of that phase is incremented on exit.
+        s64 hdr_phaser_writer_enter(hdr_writer_reader_phaser* p) { return hdr_atomic_add_fetch_64(&p->start_epoch, 1); }
+
+        void hdr_phaser_writer_exit(hdr_writer_reader_phaser* p, s64 critical_value_at_enter)
+        {
+            s64* end_epoch = (critical_value_at_enter < 0) ? &p->odd_end_epoch : &p->even_end_epoch;
+            hdr_atomic_add_fetch_64(end_epoch, 1);
+        }
+
+        void hdr_phaser_flip_phase(hdr_writer_reader_phaser* p)
+        {
+            const bool next_phase_is_even = hdr_atomic_load_64(&p->start_epoch) < 0;
+
+            s64 initial_start_value;
+            if (next_phase_is_even)
+            {
+                initial_start_value = 0;
+                hdr_atomic_store_64(&p->even_end_epoch, initial_start_value);
+            }
+            else
+            {
+                initial_start_value = limits_t<s64>::minimum();
+                hdr_atomic_store_64(&p->odd_end_epoch, initial_start_value);
+            }
+
+            const s64 start_value_at_flip = hdr_atomic_exchange_64(&p->start_epoch, initial_start_value);
+
+            s64* end_epoch = next_phase_is_even ? &p->odd_end_epoch : &p->even_end_epoch;
+            while (hdr_atomic_load_64(end_epoch) != start_value_at_flip)
+            {
+                hdr_atomic_pause();
+            }
+        }
+
+        /* ########  ########  ######   #######  ########  ########  ######## ########  */
+        /* ##     ## ##       ##    ## ##     ## ##     ## ##     ## ##       ##     ## */
+        /* ##     ## ##       ##       ##     ## ##     ## ##     ## ##       ##     ## */
+        /* ########  ######   ##       ##     ## ########  ##     ## ######   ########  */
+        /* ##   ##   ##       ##       ##     ## ##   ##   ##     ## ##       ##   ##   */
+        /* ##    ##  ##       ##    ## ##     ## ##    ##  ##     ## ##       ##    ##  */
+        /* ##     ## ########  ######   #######  ##     ## ########  ######## ##     ## */
+
+        s32 hdr_interval_recorder_init(hdr_interval_recorder* r, s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, alloc_t* allocator)
+        {
+            r->active   = nullptr;
+            r->inactive = nullptr;
+            hdr_phaser_init(&r->phaser);
+
+            s32 rc = hdr_init(lowest_discernible_value, highest_trackable_value, significant_figures, allocator, &r->active);
+            if (rc)
+            {
+                return rc;
+            }
+
+            rc = hdr_init(lowest_discernible_value, highest_trackable_value, significant_figures, allocator, &r->inactive);
+            if (rc)
+            {
+                hdr_close(r->active);
+                r->active = nullptr;
+            }
+            return rc;
+        }
+
+        void hdr_interval_recorder_destroy(hdr_interval_recorder* r)
+        {
+            hdr_close(r->active);
+            hdr_close(r->inactive);
+            r->active   = nullptr;
+            r->inactive = nullptr;
+        }
+
+        static hdr_histogram* active_histogram(hdr_interval_recorder* r) { return (hdr_histogram*)hdr_atomic_load_pointer((void* const volatile*)&r->active); }
+
+        bool hdr_interval_recorder_record_value(hdr_interval_recorder* r, s64 value) { return hdr_interval_recorder_record_values(r, value, 1); }
+
+        bool hdr_interval_recorder_record_values(hdr_interval_recorder* r, s64 value, s64 count)
+        {
+            const s64  critical_value = hdr_phaser_writer_enter(&r->phaser);
+            const bool result         = hdr_record_values(active_histogram(r), value, count);
+            hdr_phaser_writer_exit(&r->phaser, critical_value);
+            return result;
+        }
+
+        bool hdr_interval_recorder_record_corrected_value(hdr_interval_recorder* r, s64 value, s64 expected_interval)
+        {
+            const s64  critical_value = hdr_phaser_writer_enter(&r->phaser);
+            const bool result         = hdr_record_corrected_value(active_histogram(r), value, expected_interval);
+            hdr_phaser_writer_exit(&r->phaser, critical_value);
+            return result;
+        }
+
+        bool hdr_interval_recorder_record_value_atomic(hdr_interval_recorder* r, s64 value) { return hdr_interval_recorder_record_values_atomic(r, value, 1); }
+
+        bool hdr_interval_recorder_record_values_atomic(hdr_interval_recorder* r, s64 value, s64 count)
+        {
+            const s64  critical_value = hdr_phaser_writer_enter(&r->phaser);
+            const bool result         = hdr_record_values_atomic(active_histogram(r), value, count);
+            hdr_phaser_writer_exit(&r->phaser, critical_value);
+            return result;
+        }
+
+        bool hdr_interval_recorder_record_corrected_value_atomic(hdr_interval_recorder* r, s64 value, s64 expected_interval)
+        {
+            const s64  critical_value = hdr_phaser_writer_enter(&r->phaser);
+            const bool result         = hdr_record_corrected_value_atomic(active_histogram(r), value, expected_interval);
+            hdr_phaser_writer_exit(&r->phaser, critical_value);
+            return result;
+        }
+
+        hdr_histogram* hdr_interval_recorder_sample(hdr_interval_recorder* r)
+        {
+            // The previously sampled histogram is no longer referenced by any writer, it
+            // becomes the new active histogram once it has been emptied.
+            hdr_histogram* empty = r->inactive;
+            hdr_reset(empty);
+
+            r->inactive = (hdr_histogram*)hdr_atomic_exchange_pointer((void* volatile*)&r->active, empty);
+
+            // Wait for all writers that may still be recording into the swapped out histogram
+            hdr_phaser_flip_phase(&r->phaser);
+
+            return r->inactive;
+        }
+
+    } // namespace nhdr
+}; // namespace ncore
@@ -0,0 +1,206 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+#include "cbase/c_limits.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_sharded.h"
+#include "chistogram/private/c_histogram_common.h"
+
+#include <math.h>
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        // The percentile query merges the shards with an iterator per shard kept on the stack.
+        const s32 HDR_MAX_SHARDS = 256;
+
+        s32 hdr_sharded_init(hdr_sharded_histogram* s, struct hdr_histogram_bucket_config* cfg, s32 shard_count, alloc_t* allocator)
+        {
+            if (shard_count < 1 || shard_count > HDR_MAX_SHARDS)
+            {
+                return EINVAL;
+            }
+
+            // [shard pointers][shard 0][shard 1]...[shard n-1], every shard padded to a cache line
+            const u64 pointers_size = align_to_cache_line((u64)shard_count * sizeof(hdr_histogram*));
+            const u64 shard_size    = align_to_cache_line(hdr_get_preallocated_size(cfg));
+            const u64 size          = pointers_size + shard_size * (u64)shard_count;
+            u8*       mem           = (size > 0xFFFFFFFF) ? nullptr : (u8*)allocator->allocate((u32)size, HDR_CACHE_LINE_SIZE);
+            if (!mem)
+            {
+                return ENOMEM;
+            }
+
+            s->shards      = (hdr_histogram**)mem;
+            s->shard_count = shard_count;
+            s->allocator   = allocator;
+            for (s32 i = 0; i < shard_count; i++)
+            {
+                s->shards[i] = hdr_init_preallocated(mem + pointers_size + shard_size * i, shard_size, cfg);
+            }
+            return 0;
+        }
+
+        void hdr_sharded_destroy(hdr_sharded_histogram* s)
+        {
+            if (s->shards)
+            {
+                s->allocator->deallocate(s->shards);
+                s->shards      = nullptr;
+                s->shard_count = 0;
+            }
+        }
+
+        void hdr_sharded_reset(hdr_sharded_histogram* s)
+        {
+            for (s32 i = 0; i < s->shard_count; i++)
+            {
+                hdr_reset(s->shards[i]);
+            }
+        }
+
+        bool hdr_sharded_record_value(hdr_sharded_histogram* s, s32 shard, s64 value) { return hdr_sharded_record_values(s, shard, value, 1); }
+
+        bool hdr_sharded_record_values(hdr_sharded_histogram* s, s32 shard, s64 value, s64 count)
+        {
+            if (shard < 0 || shard >= s->shard_count)
+            {
+                return false;
+            }
+            return hdr_record_values(s->shards[shard], value, count);
+        }
+
+        s64 hdr_sharded_merge(const hdr_sharded_histogram* s, hdr_histogram* h)
+        {
+            s64 dropped = 0;
+            for (s32 i = 0; i < s->shard_count; i++)
+            {
+                dropped += hdr_add(h, s->shards[i]);
+            }
+            return dropped;
+        }
+
+        s64 hdr_sharded_total_count(const hdr_sharded_histogram* s)
+        {
+            s64 total_count = 0;
+            for (s32 i = 0; i < s->shard_count; i++)
+            {
+                total_count += s->shards[i]->total_count;
+            }
+            return total_count;
+        }
+
+        s64 hdr_sharded_min(const hdr_sharded_histogram* s)
+        {
+            s64 min = limits_t<s64>::maximum();
+            for (s32 i = 0; i < s->shard_count; i++)
+            {
+                const s64 shard_min = hdr_min(s->shards[i]);
+                min                 = shard_min < min ? shard_min : min;
+            }
+            return min;
+        }
+
+        s64 hdr_sharded_max(const hdr_sharded_histogram* s)
+        {
+            s64 max = 0;
+            for (s32 i = 0; i < s->shard_count; i++)
+            {
+                const s64 shard_max = hdr_max(s->shards[i]);
+                max                 = shard_max > max ? shard_max : max;
+            }
+            return max;
+        }
+
+        s64 hdr_sharded_value_at_percentile(const hdr_sharded_histogram* s, f64 percentile)
+        {
+            // K-way merge of the recorded iterators of the shards, visiting the recorded
+            // buckets in ascending counts index order until the cumulative count is reached.
+            hdr_iter  iters[HDR_MAX_SHARDS];
+            bool      valid[HDR_MAX_SHARDS];
+            const s32 shard_count = s->shard_count;
+
+            const f64 requested_percentile = percentile < 100.0 ? percentile : 100.0;
+            s64       count_at_percentile  = (s64)(((requested_percentile / 100) * hdr_sharded_total_count(s)) + 0.5);
+            count_at_percentile            = 0 < count_at_percentile ? count_at_percentile : 1;
+
+            for (s32 i = 0; i < shard_count; i++)
+            {
+                hdr_iter_recorded_init(&iters[i], s->shards[i]);
+                valid[i] = hdr_iter_next(&iters[i]);
+            }
+
+            const hdr_histogram* h     = s->shards[0];
+            s64                  total = 0;
+            for (;;)
+            {
+                s32 lowest = -1;
+                for (s32 i = 0; i < shard_count; i++)
+                {
+                    if (valid[i] && (lowest < 0 || iters[i].counts_index < iters[lowest].counts_index))
+                    {
+                        lowest = i;
+                    }
+                }
+                if (lowest < 0)
+                {
+                    return 0;
+                }
+
+                const s32 counts_index = iters[lowest].counts_index;
+                for (s32 i = 0; i < shard_count; i++)
+                {
+                    if (valid[i] && iters[i].counts_index == counts_index)
+                    {
+                        total += iters[i].count;
+                        valid[i] = hdr_iter_next(&iters[i]);
+                    }
+                }
+
+                if (total >= count_at_percentile)
+                {
+                    const s64 value = hdr_value_at_index(h, counts_index);
+                    if (percentile == 0.0)
+                    {
+                        return hdr_lowest_equivalent_value(h, value);
+                    }
+                    return hdr_next_non_equivalent_value(h, value) - 1;
+                }
+            }
+        }
+
+        f64 hdr_sharded_mean(const hdr_sharded_histogram* s)
+        {
+            s64 total = 0;
+            for (s32 i = 0; i < s->shard_count; i++)
+            {
+                hdr_iter iter;
+                hdr_iter_recorded_init(&iter, s->shards[i]);
+                while (hdr_iter_next(&iter))
+                {
+                    total += iter.count * iter.median_equivalent_value;
+                }
+            }
+            return (total * 1.0) / hdr_sharded_total_count(s);
+        }
+
+        f64 hdr_sharded_stddev(const hdr_sharded_histogram* s)
+        {
+            const f64 mean                = hdr_sharded_mean(s);
+            f64       geometric_dev_total = 0.0;
+            for (s32 i = 0; i < s->shard_count; i++)
+            {
+                hdr_iter iter;
+                hdr_iter_recorded_init(&iter, s->shards[i]);
+                while (hdr_iter_next(&iter))
+                {
+                    f64 dev = (iter.median_equivalent_value * 1.0) - mean;
+                    geometric_dev_total += (dev * dev) * iter.count;
+                }
+            }
+            return sqrt(geometric_dev_total / hdr_sharded_total_count(s));
+        }
+
+    } // namespace nhdr
+}; // namespace ncore
@@ -0,0 +1,83 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_window.h"
+#include "chistogram/private/c_histogram_common.h"
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        s32 hdr_window_init(hdr_window_histogram* w, struct hdr_histogram_bucket_config* cfg, s32 interval_count, alloc_t* allocator)
+        {
+            if (interval_count < 1)
+            {
+                return EINVAL;
+            }
+
+            // [slot pointers][window][slot 0][slot 1]...[slot n], every histogram padded to a cache line
+            const u64 slot_count     = (u64)interval_count + 1;
+            const u64 pointers_size  = align_to_cache_line(slot_count * sizeof(hdr_histogram*));
+            const u64 histogram_size = align_to_cache_line(hdr_get_preallocated_size(cfg));
+            const u64 size           = pointers_size + histogram_size * (slot_count + 1);
+            u8*       mem            = (size > 0xFFFFFFFF) ? nullptr : (u8*)allocator->allocate((u32)size, HDR_CACHE_LINE_SIZE);
+            if (!mem)
+            {
+                return ENOMEM;
+            }
+
+            w->slots      = (hdr_histogram**)mem;
+            w->window     = hdr_init_preallocated(mem + pointers_size, histogram_size, cfg);
+            w->slot_count = (s32)slot_count;
+            w->current    = 0;
+            w->allocator  = allocator;
+            for (s32 i = 0; i < w->slot_count; i++)
+            {
+                w->slots[i] = hdr_init_preallocated(mem + pointers_size + histogram_size * (i + 1), histogram_size, cfg);
+            }
+            return 0;
+        }
+
+        void hdr_window_destroy(hdr_window_histogram* w)
+        {
+            if (w->slots)
+            {
+                w->allocator->deallocate(w->slots);
+                w->slots      = nullptr;
+                w->window     = nullptr;
+                w->slot_count = 0;
+            }
+        }
+
+        void hdr_window_reset(hdr_window_histogram* w)
+        {
+            for (s32 i = 0; i < w->slot_count; i++)
+            {
+                hdr_reset(w->slots[i]);
+            }
+            hdr_reset(w->window);
+            w->current = 0;
+        }
+
+        bool hdr_window_record_value(hdr_window_histogram* w, s64 value) { return hdr_window_record_values(w, value, 1); }
+
+        bool hdr_window_record_values(hdr_window_histogram* w, s64 value, s64 count) { return hdr_record_values(w->slots[w->current], value, count); }
+
+        void hdr_window_rotate(hdr_window_histogram* w)
+        {
+            hdr_add(w->window, w->slots[w->current]);
+
+            w->current             = (w->current + 1) % w->slot_count;
+            hdr_histogram* expired = w->slots[w->current];
+            hdr_subtract(w->window, expired);
+            hdr_reset(expired);
+        }
+
+        s64 hdr_window_total_count(const hdr_window_histogram* w) { return w->window->total_count; }
+
+        s64 hdr_window_value_at_percentile(const hdr_window_histogram* w, f64 percentile) { return hdr_value_at_percentile(w->window, percentile); }
+
+    } // namespace nhdr
+
+}; // namespace ncore
@@ -7,6 +7,8 @@
 
 namespace ncore
 {
+    class alloc_t;
+
     namespace nhdr
     {
         // URL: https://github.com/HdrHistogram/HdrHistogram_c
@@ -15,24 +17,96 @@ namespace ncore
         // Refactored mainly to control memory allocations and to make it easier to use by other packages.
         // This is not a complete port of the original C version.
 
+        struct hdr_packed_block;
+
+        struct hdr_u128
+        {
+            u64 lo;
+            u64 hi;
+        };
+
         struct  hdr_histogram
         {
-            s64  lowest_discernible_value;
-            s64  highest_trackable_value;
-            s32  unit_magnitude;
-            s32  significant_figures;
-            s32  sub_bucket_half_count_magnitude;
-            s32  sub_bucket_half_count;
-            s64  sub_bucket_mask;
-            s32  sub_bucket_count;
-            s32  bucket_count;
-            s64  min_value;
-            s64  max_value;
-            f64  conversion_ratio;
-            s32  normalizing_index_offset;
-            s32  counts_len;
-            s64  total_count;
-            s64* counts;
+            s64      lowest_discernible_value;
+            s64      highest_trackable_value;
+            s32      unit_magnitude;
+            s32      significant_figures;
+            s32      sub_bucket_half_count_magnitude;
+            s32      sub_bucket_half_count;
+            s64      sub_bucket_mask;
+            s32      sub_bucket_count;
+            s32      bucket_count;
+            s64      min_value;
+            s64      max_value;
+            f64      conversion_ratio;
+            s32      normalizing_index_offset;
+            s32      counts_len;
+            s64      total_count;
+            s64      version;          // bumped by every change that may leave total_count unchanged
+            s32      counts_word_size; // size in bytes of a single count, 2, 4 or 8, 0 for packed and -1 for paged counts
+            u32      flags;            // hdr_init_flags
+            union
+            {
+                s64* counts;
+                s32* counts32;
+                s16* counts16;
+                hdr_packed_block* packed; // HDR_COUNTS_PACKED, one block per 64 counts
+                s64**             pages;  // HDR_COUNTS_PAGED, one pointer per page of counts, nullptr until written
+            };
+            u64*     occupancy;        // one bit per count that may be non-zero, nullptr when the counts are preallocated
+            s64*     percentile_index; // cumulative count index, nullptr unless HDR_PERCENTILE_INDEX
+            hdr_u128 running_sum;         // sum of count * median equivalent value, HDR_RUNNING_SUMS only
+            hdr_u128 running_sum_squares; // sum of count * median equivalent value^2, HDR_RUNNING_SUMS only
+            s32      dirty_lo;    // lowest (logical) counts index written since the last reset, counts_len when clean
+            s32      dirty_hi;    // highest (logical) counts index written since the last reset, -1 when clean
+            u64      dirty_pages; // one bit per 1/64th of the counts (at least 64 counts) written since the last reset
+            alloc_t* allocator; // owner of the memory, nullptr when preallocated by the caller
+        };
+
+        /**
+         * Flags that can be passed to hdr_init to select the layout of the counts.
+         *
+         * By default counts are 64 bit.  With 16 or 32 bit counts a record that would
+         * overflow a count fails, unless HDR_AUTO_PROMOTE is set in which case the counts
+         * array is widened to the next word size that can hold the count.
+         *
+         * HDR_PERCENTILE_INDEX maintains a cumulative count index (a Fenwick tree) while
+         * recording, at the cost of one extra s64 per count and O(log n) work per record,
+         * which makes hdr_value_at_percentile(s) and hdr_count_between_values O(log n).
+         *
+         * HDR_AUTO_RESIZE grows the counts when a value above highest_trackable_value is
+         * recorded, instead of rejecting it.  Resizing is not supported by the atomic record
+         * functions, nor by histograms placed in caller provided memory.
+         *
+         * HDR_RUNNING_SUMS maintains 128 bit sums of the (median equivalent) values and of
+         * their squares while recording, which makes hdr_mean and hdr_stddev O(1).  Once a
+         * count is negative both walk the buckets again, until the next reset.
+         *
+         * HDR_COUNTS_PACKED only stores the counts that were written.  Every block of 64
+         * counts holds a bitmap of its populated counts and an array with just those, each
+         * 1, 2, 4 or 8 bytes wide as needed by the largest of them, which is indexed by the
+         * number of populated counts below.  This costs less than half a byte per count plus
+         * the populated ones, instead of 8 bytes per count, at a slower record.  The blocks
+         * grow from the allocator of the histogram, packed counts need a histogram created by
+         * hdr_init and are not supported by the atomic record functions.
+         *
+         * HDR_COUNTS_PAGED splits the 64 bit counts into pages of a half bucket (at most 1024
+         * counts) that are allocated from the allocator of the histogram when first written,
+         * an unwritten page reads as zeros.  The counts keep their dense indexing, values
+         * that stay within a few buckets only cost the pages of those buckets.  Like packed
+         * counts, paged counts need a histogram created by hdr_init and are not supported by
+         * the atomic record functions.
+         */
+        enum hdr_init_flags
+        {
+            HDR_COUNTS_16_BIT    = 0x0001,
+            HDR_COUNTS_32_BIT    = 0x0002,
+            HDR_AUTO_PROMOTE     = 0x0004,
+            HDR_PERCENTILE_INDEX = 0x0008,
+            HDR_AUTO_RESIZE      = 0x0010,
+            HDR_RUNNING_SUMS     = 0x0020,
+            HDR_COUNTS_PACKED    = 0x0040,
+            HDR_COUNTS_PAGED     = 0x0080,
         };
 
         /**
@@ -57,6 +131,37 @@ namespace ncore
          */
         s32 hdr_init(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, hdr_histogram** result);
 
+        /**
+         * Allocate the memory from 'allocator' and initialise the hdr_histogram.
+         *
+         * The histogram header and the counts array are placed in a single, cache line
+         * aligned, allocation.  The memory is returned to the same allocator by hdr_close.
+         * hdr_init without an allocator uses the system allocator of the context.
+         *
+         * @param allocator The allocator to obtain the memory from.
+         * @return 0 on success, EINVAL on invalid parameters, ENOMEM if the allocation failed.
+         */
+        s32 hdr_init(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, alloc_t* allocator, hdr_histogram** result);
+
+        /**
+         * Allocate the memory from 'allocator' and initialise the hdr_histogram using
+         * the layout selected by 'flags' (see hdr_init_flags).
+         *
+         * An auto-promoting histogram keeps its counts in an allocation separate from
+         * the header, so the counts can be replaced when they are widened.
+         */
+        s32 hdr_init(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, alloc_t* allocator, u32 flags, hdr_histogram** result);
+
+        /**
+         * Allocate a histogram with the configuration of 'from' and the layout selected by
+         * 'flags', and add the counts of 'from' to it.  E.g. converts dense counts to packed
+         * counts (HDR_COUNTS_PACKED or HDR_COUNTS_PAGED) and back (0).
+         *
+         * @return 0 on success, EINVAL if not every count could be copied (a count too large
+         * for 16 or 32 bit counts), ENOMEM if an allocation failed.
+         */
+        s32 hdr_init_copy(const hdr_histogram* from, alloc_t* allocator, u32 flags, hdr_histogram** result);
+
         /**
          * Free the memory and close the hdr_histogram.
          *
@@ -76,7 +181,9 @@ namespace ncore
          * Reset a histogram to zero - empty out a histogram and re-initialise it
          *
          * If you want to re-use an existing histogram, but reset everything back to zero, this
-         * is the routine to use.
+         * is the routine to use.  Only the counts written since the last reset (the dirty range
+         * and pages) are cleared, counts written directly must be followed by
+         * hdr_reset_internal_counters first.
          *
          * @param h The histogram you want to reset to empty.
          *
@@ -98,7 +205,7 @@ namespace ncore
          * @param h "This" pointer
          * @param value Value to add to the histogram
          * @return false if the value is larger than the highest_trackable_value and can't be recorded,
-         * true otherwise.
+         * or if the count would overflow a 16 or 32 bit count that can not be promoted, true otherwise.
          */
         bool hdr_record_value(hdr_histogram* h, s64 value);
 
@@ -139,6 +246,9 @@ namespace ncore
          * when read concurrently with this update.  Do NOT mix calls to this method with calls
          * to non-atomic updates.
          *
+         * With 16 or 32 bit counts a count that would overflow is rejected, counts are never
+         * promoted by the atomic functions.
+         *
          * @param h "This" pointer
          * @param value Value to add to the histogram
          * @param count Number of 'value's to add to the histogram
@@ -147,6 +257,30 @@ namespace ncore
          */
         bool hdr_record_values_atomic(hdr_histogram* h, s64 value, s64 count);
 
+        /**
+         * Records a batch of values in the histogram, equivalent to calling hdr_record_value
+         * for each of them but considerably cheaper for large batches.  The counts indices
+         * are computed for a block of values at a time (vectorized when compiled with AVX2)
+         * and min/max are updated once per block.
+         *
+         * @param h "This" pointer
+         * @param values The values to add to the histogram
+         * @param length Number of values
+         * @return The number of values that could not be recorded.
+         */
+        s64 hdr_record_values_batch(hdr_histogram* h, const s64* values, u64 length);
+
+        /**
+         * Records a batch of weighted values, values[i] is recorded counts[i] times.
+         *
+         * @param h "This" pointer
+         * @param values The values to add to the histogram
+         * @param counts The number of times each value is added
+         * @param length Number of values and counts
+         * @return The sum of the counts of values that could not be recorded.
+         */
+        s64 hdr_record_values_batch(hdr_histogram* h, const s64* values, const s64* counts, u64 length);
+
         /**
          * Record a value in the histogram and backfill based on an expected interval.
          *
@@ -220,12 +354,56 @@ namespace ncore
          * if they around outside of h.lowest_discernible_value and
          * h.highest_trackable_value.
          *
+         * When both histograms share the bucket layout (and 'h' has 64 bit counts) the
+         * counts are added index by index instead of value by value.
+         *
          * @param h "This" pointer
          * @param from Histogram to copy values from.
          * @return The number of values dropped when copying.
          */
         s64 hdr_add(hdr_histogram* h, const hdr_histogram* from);
 
+        /**
+         * Removes all of the values of 'from' from 'this' histogram, the inverse of hdr_add.
+         * 'from' is expected to hold a subset of the values recorded in 'h', other values
+         * are left behind as negative counts.  The min and max are only searched for again
+         * when 'from' may have held them.
+         *
+         * Uses the same index by index path as hdr_add when the bucket layouts match.
+         *
+         * @param h "This" pointer
+         * @param from Histogram with the values to remove.
+         * @return The number of values that could not be removed.
+         */
+        s64 hdr_subtract(hdr_histogram* h, const hdr_histogram* from);
+
+        /**
+         * Set 'out' to the values recorded in 'newer' but not (yet) in 'older', e.g. the
+         * interval histogram between two snapshots of a cumulative histogram.  'out' is
+         * reset first and should share the bucket layout of both inputs.  When a count went
+         * down from 'older' to 'newer' the cumulative histogram was reset in between (e.g. a
+         * restart of the process it was scraped from) and 'out' is set to 'newer'.
+         *
+         * @return The number of values dropped.
+         */
+        s64 hdr_delta(hdr_histogram* out, const hdr_histogram* newer, const hdr_histogram* older);
+
+        /**
+         * Adds all of the values from 'from' to 'this' histogram.  Will return the
+         * number of values that are dropped when copying.  Values will be dropped
+         * if they around outside of h.lowest_discernible_value and
+         * h.highest_trackable_value.
+         *
+         * Will add the values atomically, 'from' is read non-atomically and should not
+         * be recorded into concurrently.  Do NOT mix calls to this method with calls
+         * to non-atomic updates on 'h'.
+         *
+         * @param h "This" pointer
+         * @param from Histogram to copy values from.
+         * @return The number of values dropped when copying.
+         */
+        s64 hdr_add_atomic(hdr_histogram* h, const hdr_histogram* from);
+
         /**
          * Adds all of the values from 'from' to 'this' histogram.  Will return the
          * number of values that are dropped when copying.  Values will be dropped
@@ -238,6 +416,28 @@ namespace ncore
          */
         s64 hdr_add_while_correcting_for_coordinated_omission(hdr_histogram* h, hdr_histogram* from, s64 expected_interval);
 
+        /**
+         * Multiply all recorded values by 2^binary_orders_of_magnitude.  The counts are not
+         * moved, the normalizing_index_offset is rotated instead.
+         *
+         * @param h "This" pointer
+         * @param binary_orders_of_magnitude The number of binary orders of magnitude to shift by.
+         * @return 0 on success, EINVAL if binary_orders_of_magnitude is out of range or the
+         * shifted values would exceed highest_trackable_value (and the histogram can't resize).
+         */
+        s32 hdr_shift_values_left(hdr_histogram* h, s32 binary_orders_of_magnitude);
+
+        /**
+         * Divide all recorded values by 2^binary_orders_of_magnitude.  The counts are not
+         * moved, the normalizing_index_offset is rotated instead.
+         *
+         * @param h "This" pointer
+         * @param binary_orders_of_magnitude The number of binary orders of magnitude to shift by.
+         * @return 0 on success, EINVAL if binary_orders_of_magnitude is out of range or a
+         * value would be shifted into the lowest half bucket and lose precision.
+         */
+        s32 hdr_shift_values_right(hdr_histogram* h, s32 binary_orders_of_magnitude);
+
         /**
          * Get minimum value from the histogram.  Will return 2^63-1 if the histogram
          * is empty.
@@ -277,6 +477,9 @@ namespace ncore
         /**
          * Gets the standard deviation for the values in the histogram.
          *
+         * With HDR_RUNNING_SUMS the deviation is computed from the exact 128 bit sums instead
+         * of by walking the buckets, the two can differ in the last bits of the result.
+         *
          * @param h "This" pointer
          * @return The standard deviation
          */
@@ -290,6 +493,56 @@ namespace ncore
          */
         f64 hdr_mean(const hdr_histogram* h);
 
+        enum
+        {
+            HDR_STATS_MAX_PERCENTILES = 32
+        };
+
+        /**
+         * Statistics of a histogram, computed by hdr_summary.  The struct also caches the
+         * results, hdr_summary returns immediately when it is asked for the same percentiles
+         * of an unchanged histogram.  Initialise it with hdr_stats_init before first use.
+         */
+        struct hdr_stats
+        {
+            const hdr_histogram* h;           // the histogram the results belong to
+            s64                  version;     // h->version at the time of the results
+            s64                  total_count; // also part of the cache key, recording changes it
+            s64                  min;
+            s64                  max;
+            f64                  mean;
+            f64                  stddev;
+            u64                  length;
+            f64                  percentiles[HDR_STATS_MAX_PERCENTILES];
+            s64                  values[HDR_STATS_MAX_PERCENTILES];
+        };
+
+        void hdr_stats_init(struct hdr_stats* stats);
+
+        /**
+         * Get the count, min, max, mean, standard deviation and the values at 'percentiles'
+         * with a single pass over the recorded values.  The percentiles can be in any order,
+         * out->values[i] holds the value at percentiles[i].
+         *
+         * @param h "This" pointer.
+         * @param percentiles The percentiles to get the values for.
+         * @param length Number of percentiles, at most HDR_STATS_MAX_PERCENTILES.
+         * @param out The statistics, and the cached results of a previous call.
+         * @return 0 on success, EINVAL if there are too many percentiles or they are null.
+         */
+        s32 hdr_summary(const hdr_histogram* h, const f64* percentiles, u64 length, struct hdr_stats* out);
+
+        /**
+         * Get the total count of recorded values in the range [low_value, high_value],
+         * to within the histogram resolution at either end.
+         *
+         * @param h "This" pointer
+         * @param low_value The lower value bound of the range
+         * @param high_value The higher value bound of the range
+         * @return The total count of values recorded in the histogram within the range
+         */
+        s64 hdr_count_between_values(const hdr_histogram* h, s64 low_value, s64 high_value);
+
         /**
          * Determine if two values are equivalent with the histogram's resolution.
          * Where "equivalent" means that value samples recorded for any two
@@ -330,6 +583,7 @@ namespace ncore
         {
             bool seen_last_value;
             s32  ticks_per_half_distance;
+            s64  half_distance;
             f64  percentile_to_iterate_to;
             f64  percentile;
         };
@@ -433,9 +687,61 @@ namespace ncore
         typedef enum
         {
             CLASSIC,
-            CSV
+            CSV,
+            JSON
         } format_type;
 
+        /**
+         * Receives the output of a hdr_writer each time its buffer fills up and when it is
+         * flushed.  Returns 0 on success, anything else stops the writer.
+         */
+        typedef s32 (*hdr_sink_fn)(void* user, const char* data, u32 length);
+
+        /**
+         * The target of hdr_percentiles_write, a caller supplied buffer that either holds the
+         * whole output or is a staging area that is drained into a sink.  The writer never
+         * allocates, the buffer is not null terminated.
+         */
+        struct hdr_writer
+        {
+            char*       buffer;
+            u32         capacity;
+            u32         length;   // bytes in the buffer, not yet passed to the sink
+            u64         written;  // bytes written since init, including those passed to the sink
+            hdr_sink_fn sink;
+            void*       user;
+            s32         error;    // 0, ENOMEM when the buffer overflowed or EIO when the sink failed
+        };
+
+        /**
+         * Write into 'buffer' only, output that doesn't fit is dropped and flagged as ENOMEM.
+         */
+        void hdr_writer_init_buffer(hdr_writer* w, char* buffer, u32 capacity);
+
+        /**
+         * Stage the output in 'buffer' and pass it on to 'sink' whenever the buffer is full,
+         * a few hundred bytes are plenty.
+         */
+        void hdr_writer_init_sink(hdr_writer* w, char* buffer, u32 capacity, hdr_sink_fn sink, void* user);
+        s32  hdr_writer_flush(hdr_writer* w);
+
+        /**
+         * Write a percentile based histogram, in the same layout as hdr_percentiles_print, to
+         * the writer.  The percentile lines and the footer of the CLASSIC and JSON formats come
+         * from a single walk over the counts, and the numbers are formatted without printf.
+         * JSON writes one object holding the percentiles followed by the summary, values that
+         * are not finite (e.g. the mean of an empty histogram) are written as null.
+         *
+         * @param h 'This' pointer
+         * @param w The writer, flushed when it has a sink
+         * @param ticks_per_half_distance The number of iteration steps per half-distance to 100%
+         * @param value_scale Scale the output values by this amount
+         * @param format Format to use, e.g. CSV.
+         * @return 0 on success, ENOMEM if the output didn't fit in the buffer of a writer without
+         * a sink, EIO if the sink failed.
+         */
+        s32 hdr_percentiles_write(const hdr_histogram* h, hdr_writer* w, s32 ticks_per_half_distance, f64 value_scale, format_type format);
+
         /**
          * Print out a percentile based histogram to the supplied stream.  Note that
          * this call will not flush the FILE, this is left up to the user.
@@ -469,6 +775,39 @@ namespace ncore
 
         s32  hdr_calculate_bucket_config(s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, struct hdr_histogram_bucket_config* cfg);
         void hdr_init_preallocated(hdr_histogram* h, struct hdr_histogram_bucket_config* cfg);
+
+        /**
+         * The number of bytes needed to place a histogram (header and counts) with
+         * the given bucket configuration in a caller provided buffer.
+         */
+        u64 hdr_get_preallocated_size(const struct hdr_histogram_bucket_config* cfg);
+        u64 hdr_get_preallocated_size(const struct hdr_histogram_bucket_config* cfg, u32 flags);
+
+        /**
+         * Place and initialise a histogram in a caller provided buffer of at least
+         * hdr_get_preallocated_size(cfg) bytes, aligned to at least 8 bytes (a cache
+         * line is recommended).  The buffer remains owned by the caller, hdr_close
+         * is a no-op for such a histogram.
+         *
+         * @return The histogram, located at the start of the buffer, or nullptr if the
+         * buffer is too small or misaligned, or if the flags select packed or paged counts.
+         */
+        hdr_histogram* hdr_init_preallocated(void* mem, u64 mem_size, struct hdr_histogram_bucket_config* cfg);
+        hdr_histogram* hdr_init_preallocated(void* mem, u64 mem_size, struct hdr_histogram_bucket_config* cfg, u32 flags);
+
+        /**
+         * Bind the counts and side table pointers of 'h' to a block laid out by
+         * hdr_init_preallocated that now lives at 'mem', e.g. the same bytes mapped from
+         * a file at another address.  'h' can be the header in the block itself or a copy
+         * of it, the counts and the other fields are left untouched.
+         */
+        void hdr_bind_preallocated(hdr_histogram* h, void* mem);
+
+        /**
+         * The logical index of the count that 'value' is recorded in, the inverse of
+         * hdr_value_at_index.
+         */
+        s32  hdr_counts_index_for(const hdr_histogram* h, s64 value);
         s64  hdr_size_of_equivalent_value_range(const hdr_histogram* h, s64 value);
         s64  hdr_next_non_equivalent_value(const hdr_histogram* h, s64 value);
         s64  hdr_median_equivalent_value(const hdr_histogram* h, s64 value);
@@ -0,0 +1,101 @@
+#ifndef __CHISTOGRAM_DOUBLE_H__
+#define __CHISTOGRAM_DOUBLE_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "chistogram/c_histogram.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nhdr
+    {
+        /**
+         * Histogram of floating point values, port of the DoubleHistogram from HdrHistogram.
+         *
+         * The values are recorded in an integer histogram as value * dbl_to_int_conversion_ratio.
+         * Only the dynamic range (the ratio between the highest and the lowest value that can be
+         * tracked at the same time) is fixed, the range of values covered moves with the values
+         * recorded by shifting the integer histogram and adjusting the conversion ratio.
+         */
+        struct hdr_dbl_histogram
+        {
+            f64            current_lowest_value;        // lowest value of the currently covered range
+            f64            current_highest_value_limit; // values must be below this limit to be covered
+            s64            highest_to_lowest_value_ratio;
+            f64            int_to_dbl_conversion_ratio;
+            f64            dbl_to_int_conversion_ratio;
+            hdr_histogram* values;
+            alloc_t*       allocator;
+        };
+
+        /**
+         * Allocate and initialise a double histogram.
+         *
+         * @param highest_to_lowest_value_ratio The dynamic range, must be >= 2.
+         * @param significant_figures The precision, between 1 and 5 (inclusive).
+         * @return 0 on success, EINVAL on invalid parameters (including a range and precision
+         * that together need more than 61 bits), ENOMEM if the allocation failed.
+         */
+        s32  hdr_dbl_init(s64 highest_to_lowest_value_ratio, s32 significant_figures, hdr_dbl_histogram** result);
+        s32  hdr_dbl_init(s64 highest_to_lowest_value_ratio, s32 significant_figures, alloc_t* allocator, hdr_dbl_histogram** result);
+        void hdr_dbl_close(hdr_dbl_histogram* h);
+        void hdr_dbl_reset(hdr_dbl_histogram* h);
+
+        /**
+         * Record a value, shifting the covered range when the value is outside of it.
+         *
+         * @return false if the value is negative, not a number, or too far from the values
+         * already recorded to fit in the dynamic range.
+         */
+        bool hdr_dbl_record_value(hdr_dbl_histogram* h, f64 value);
+        bool hdr_dbl_record_values(hdr_dbl_histogram* h, f64 value, s64 count);
+
+        /**
+         * Adds all of the values from 'from' to 'h'.
+         *
+         * @return The number of values dropped when copying.
+         */
+        s64 hdr_dbl_add(hdr_dbl_histogram* h, const hdr_dbl_histogram* from);
+
+        f64 hdr_dbl_min(const hdr_dbl_histogram* h);
+        f64 hdr_dbl_max(const hdr_dbl_histogram* h);
+        f64 hdr_dbl_value_at_percentile(const hdr_dbl_histogram* h, f64 percentile);
+        f64 hdr_dbl_mean(const hdr_dbl_histogram* h);
+        f64 hdr_dbl_stddev(const hdr_dbl_histogram* h);
+        s64 hdr_dbl_count_at_value(const hdr_dbl_histogram* h, f64 value);
+        bool hdr_dbl_values_are_equivalent(const hdr_dbl_histogram* h, f64 a, f64 b);
+
+        /**
+         * Iterator over a double histogram, a thin wrapper around an iterator over the
+         * integer values that converts the values of each step.
+         */
+        struct hdr_dbl_iter
+        {
+            struct hdr_iter iter;
+            f64             int_to_dbl_conversion_ratio;
+            s64             count;
+            s64             cumulative_count;
+            f64             value;
+            f64             highest_equivalent_value;
+            f64             lowest_equivalent_value;
+            f64             median_equivalent_value;
+            f64             value_iterated_from;
+            f64             value_iterated_to;
+        };
+
+        void hdr_dbl_iter_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h);
+        void hdr_dbl_iter_percentile_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h, s32 ticks_per_half_distance);
+        void hdr_dbl_iter_recorded_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h);
+        void hdr_dbl_iter_linear_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h, f64 value_units_per_bucket);
+        void hdr_dbl_iter_log_init(struct hdr_dbl_iter* iter, const hdr_dbl_histogram* h, f64 value_units_first_bucket, f64 log_base);
+        bool hdr_dbl_iter_next(struct hdr_dbl_iter* iter);
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __CHISTOGRAM_ENCODING_H__
+#define __CHISTOGRAM_ENCODING_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "chistogram/c_histogram.h"
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        // Binary encoding of a histogram to and from memory buffers, using the HdrHistogram
+        // V2 layout (cookie 0x1c849313): a 40 byte big-endian header followed by the counts
+        // in logical order as ZigZag LEB128 values, where a run of N empty buckets is written
+        // as -N.  Payloads written by the Java and C implementations decode as they are.
+        //
+        // The DEFLATE wrapped variant (cookie 0x1c849304) is not supported, neither encoding
+        // nor decoding allocates any memory.
+
+        /**
+         * Get an upper bound of the number of bytes hdr_encode will write for this histogram.
+         *
+         * @param h "This" pointer
+         * @return The maximum size in bytes of the encoded histogram.
+         */
+        u64 hdr_encode_size_bound(const hdr_histogram* h);
+
+        /**
+         * Encode the histogram into the caller provided buffer.
+         *
+         * @param h "This" pointer
+         * @param buffer Destination buffer
+         * @param buffer_size Size of the destination buffer in bytes
+         * @param encoded_size Output parameter receiving the number of bytes written
+         * @return 0 on success, ENOMEM if the buffer is too small, EINVAL if the histogram
+         * holds a negative count.
+         */
+        s32 hdr_encode(const hdr_histogram* h, u8* buffer, u64 buffer_size, u64* encoded_size);
+
+        /**
+         * Read the bucket configuration from an encoded histogram, which can be used to
+         * create (or place) a histogram that is able to hold all of the encoded values.
+         *
+         * @param buffer The encoded histogram
+         * @param length Size of the encoded histogram in bytes
+         * @param cfg Output parameter receiving the bucket configuration
+         * @return 0 on success, EINVAL if the buffer does not hold a V2 encoded histogram.
+         */
+        s32 hdr_decode_config(const u8* buffer, u64 length, struct hdr_histogram_bucket_config* cfg);
+
+        /**
+         * Decode an encoded histogram, adding its values to 'h'.
+         *
+         * @param h The histogram to add the decoded values to
+         * @param buffer The encoded histogram
+         * @param length Size of the encoded histogram in bytes
+         * @return 0 on success, EINVAL if the buffer is malformed or holds a value outside
+         * the range of 'h', in which case 'h' is left unchanged.  Only a count that doesn't
+         * fit the counts of 'h' or a failed allocation (EINVAL too) can leave part of the
+         * decoded values recorded.
+         */
+        s32 hdr_decode(hdr_histogram* h, const u8* buffer, u64 length);
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
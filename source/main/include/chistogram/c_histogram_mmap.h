@@ -0,0 +1,119 @@
+#ifndef __CHISTOGRAM_MMAP_H__
+#define __CHISTOGRAM_MMAP_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "chistogram/c_histogram.h"
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        /**
+         * A histogram that lives in a memory mapped file, the counts survive a restart (or a
+         * crash) of the process and other processes can map the file read-only to look at
+         * the live counts without copying them.
+         *
+         * The file holds a versioned header with the bucket configuration followed by the
+         * histogram block as placed by hdr_init_preallocated.  The counts can not move, so
+         * HDR_AUTO_PROMOTE, HDR_AUTO_RESIZE, HDR_COUNTS_PACKED and HDR_COUNTS_PAGED are not
+         * supported.
+         *
+         * The same layout can live in a named shared memory segment (hdr_mmap_open_shared) that
+         * several processes record into with atomic increments, see hdr_mmap_record_values.
+         */
+        struct hdr_mmap_histogram
+        {
+            hdr_histogram* h;         // inside the mapping, or 'view' for read-only and shared mappings
+            u8*            base;      // start of the mapping
+            u64            size;      // size of the mapping (and of the file) in bytes
+            s64            file;      // file descriptor or handle
+            s64            mapping;   // mapping handle where the platform has one
+            bool           read_only;
+            bool           shared;
+            hdr_histogram  view;      // copy of the mapped header bound to this process' mapping
+        };
+
+        /**
+         * Open the histogram stored in 'path', creating the file if it does not exist.  An
+         * existing file must hold a histogram with the same configuration and flags.  When
+         * the file was not closed by hdr_mmap_close (e.g. after a crash) the totals, min, max
+         * and side tables are recomputed from the counts.
+         *
+         * @return 0 on success, EINVAL if the configuration or flags are invalid or don't match
+         * the file, EIO if the file can't be opened, sized or mapped.
+         */
+        s32 hdr_mmap_open(hdr_mmap_histogram* m, const char* path, s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, u32 flags);
+
+        /**
+         * Map an existing histogram file read-only, e.g. from a monitoring tool.  The counts
+         * are live, the header fields (total_count, min, max, ...) are a copy taken when
+         * opening and updated by hdr_mmap_refresh.
+         *
+         * @return 0 on success, EINVAL if the file does not hold a valid histogram, EIO if the
+         * file can't be opened or mapped.
+         */
+        s32  hdr_mmap_open_read_only(hdr_mmap_histogram* m, const char* path);
+        void hdr_mmap_refresh(hdr_mmap_histogram* m);
+
+        /**
+         * Open the named shared memory segment holding a histogram, creating it if it does
+         * not exist yet.  Create it before starting (forking) the processes that open it, an
+         * existing segment must hold a histogram with the same configuration and flags.
+         *
+         * Every process maps the segment at its own address, so 'h' is a process local view
+         * of which only the counts and side tables are shared.  Record with
+         * hdr_mmap_record_values and read with hdr_mmap_snapshot.  HDR_RUNNING_SUMS is not
+         * supported, the sums are kept in the process local view.
+         *
+         * @return 0 on success, EINVAL if the configuration or flags are invalid or don't match
+         * the segment, EIO if the segment can't be opened, sized or mapped.
+         */
+        s32 hdr_mmap_open_shared(hdr_mmap_histogram* m, const char* name, s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, u32 flags);
+        s32 hdr_mmap_unlink_shared(const char* name);
+
+        /**
+         * Record atomically into a shared histogram.  The finished records are counted per
+         * page of 64 counts, so that hdr_mmap_snapshot can detect the pages it raced with.
+         *
+         * @return false if the value can't be recorded.
+         */
+        bool hdr_mmap_record_value(hdr_mmap_histogram* m, s64 value);
+        bool hdr_mmap_record_values(hdr_mmap_histogram* m, s64 value, s64 count);
+
+        /**
+         * Copy a snapshot of a shared histogram into 'out', a histogram created with the same
+         * configuration and 64 bit counts.  The counts are copied a page of 64 at a time, a
+         * page that a record finished in during its copy is copied again, at most
+         * 'max_attempts' times.  Every page holds the records that finished before its copy,
+         * the records in flight are either in or out.
+         *
+         * Writers are never waited for, so a writer that dies in the middle of a record does
+         * not hold up the snapshots.  Its count went in with a single atomic add or not at
+         * all, there is nothing to recover.
+         *
+         * @return 0 on success, EINVAL if 'out' has a different layout, EBUSY (-4) if every
+         * attempt at a page raced with a writer.
+         */
+        s32 hdr_mmap_snapshot(hdr_mmap_histogram* m, hdr_histogram* out, s32 max_attempts);
+
+        /**
+         * Flush the mapped histogram to the file.
+         *
+         * @return 0 on success, EIO if the flush failed.
+         */
+        s32 hdr_mmap_sync(hdr_mmap_histogram* m);
+
+        /**
+         * Flush (when writable), mark the file as cleanly closed and unmap it.  A shared
+         * segment is only unmapped, it is removed with hdr_mmap_unlink_shared.
+         */
+        void hdr_mmap_close(hdr_mmap_histogram* m);
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __CHISTOGRAM_RECORDER_H__
+#define __CHISTOGRAM_RECORDER_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "chistogram/c_histogram.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nhdr
+    {
+        /**
+         * Writer-reader phaser, lets writers enter and exit a critical section without
+         * blocking while a reader can wait for all writers that entered before a phase flip
+         * to have exited.  Port of the WriterReaderPhaser from HdrHistogram.
+         *
+         * Writers never wait, the reader spins until the writers of the previous phase have
+         * left.  Only a single reader at a time is supported, serialising readers is left to
+         * the caller.
+         */
+        struct hdr_writer_reader_phaser
+        {
+            s64 start_epoch;
+            s64 even_end_epoch;
+            s64 odd_end_epoch;
+        };
+
+        void hdr_phaser_init(hdr_writer_reader_phaser* p);
+        s64  hdr_phaser_writer_enter(hdr_writer_reader_phaser* p);
+        void hdr_phaser_writer_exit(hdr_writer_reader_phaser* p, s64 critical_value_at_enter);
+        void hdr_phaser_flip_phase(hdr_writer_reader_phaser* p);
+
+        /**
+         * Interval recorder, writers record into the active histogram while a reader
+         * periodically swaps in an empty histogram and takes the completed interval.
+         * Writers are never blocked by the reader and no values are lost in the swap.
+         */
+        struct hdr_interval_recorder
+        {
+            hdr_histogram*           active;
+            hdr_histogram*           inactive;
+            hdr_writer_reader_phaser phaser;
+        };
+
+        /**
+         * Initialise the recorder, allocating both interval histograms from 'allocator'.
+         *
+         * @return 0 on success, EINVAL on invalid parameters, ENOMEM if the allocation failed.
+         */
+        s32 hdr_interval_recorder_init(hdr_interval_recorder* r, s64 lowest_discernible_value, s64 highest_trackable_value, s32 significant_figures, alloc_t* allocator);
+
+        /**
+         * Release both interval histograms.
+         */
+        void hdr_interval_recorder_destroy(hdr_interval_recorder* r);
+
+        /**
+         * Record into the active histogram from a single writer thread, there must be no
+         * other writer recording into the same recorder concurrently.
+         */
+        bool hdr_interval_recorder_record_value(hdr_interval_recorder* r, s64 value);
+        bool hdr_interval_recorder_record_values(hdr_interval_recorder* r, s64 value, s64 count);
+        bool hdr_interval_recorder_record_corrected_value(hdr_interval_recorder* r, s64 value, s64 expected_interval);
+
+        /**
+         * Record into the active histogram, safe to call from any number of writer threads.
+         */
+        bool hdr_interval_recorder_record_value_atomic(hdr_interval_recorder* r, s64 value);
+        bool hdr_interval_recorder_record_values_atomic(hdr_interval_recorder* r, s64 value, s64 count);
+        bool hdr_interval_recorder_record_corrected_value_atomic(hdr_interval_recorder* r, s64 value, s64 expected_interval);
+
+        /**
+         * Swap in an empty histogram and return the histogram holding all values recorded
+         * since the previous sample.  The returned histogram remains owned by the recorder
+         * and stays valid until the next call to hdr_interval_recorder_sample.
+         *
+         * Only one thread may sample a recorder at a time.
+         */
+        hdr_histogram* hdr_interval_recorder_sample(hdr_interval_recorder* r);
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
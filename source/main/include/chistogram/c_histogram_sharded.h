@@ -0,0 +1,74 @@
+#ifndef __CHISTOGRAM_SHARDED_H__
+#define __CHISTOGRAM_SHARDED_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "chistogram/c_histogram.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nhdr
+    {
+        /**
+         * A set of identically configured histograms, one per recording thread (or CPU).
+         *
+         * Each shard is only ever recorded into by its owner using the plain, non-atomic,
+         * record functions, and every shard starts on its own cache line so shards never
+         * share a cache line.  Queries either merge the shards into a scratch histogram or
+         * combine the shards on the fly.  Queries are not synchronised with the recording
+         * threads, run them when recording is quiescent or accept a slightly torn view.
+         */
+        struct hdr_sharded_histogram
+        {
+            hdr_histogram** shards;
+            s32             shard_count;
+            alloc_t*        allocator;
+        };
+
+        /**
+         * Allocate and initialise 'shard_count' histograms with the given bucket configuration,
+         * all shards are placed in a single allocation.  At most 256 shards are supported.
+         *
+         * @return 0 on success, EINVAL if shard_count < 1 or > 256, ENOMEM if the allocation
+         * failed or would exceed 4 GiB.
+         */
+        s32  hdr_sharded_init(hdr_sharded_histogram* s, struct hdr_histogram_bucket_config* cfg, s32 shard_count, alloc_t* allocator);
+        void hdr_sharded_destroy(hdr_sharded_histogram* s);
+        void hdr_sharded_reset(hdr_sharded_histogram* s);
+
+        /**
+         * Record into the shard owned by the calling thread.
+         *
+         * @return false if the shard index is invalid or the value can't be recorded.
+         */
+        bool hdr_sharded_record_value(hdr_sharded_histogram* s, s32 shard, s64 value);
+        bool hdr_sharded_record_values(hdr_sharded_histogram* s, s32 shard, s64 value, s64 count);
+
+        /**
+         * Add the values of all shards to 'h', which can be a scratch histogram
+         * created with the same bucket configuration.
+         *
+         * @return The number of values dropped when adding.
+         */
+        s64 hdr_sharded_merge(const hdr_sharded_histogram* s, hdr_histogram* h);
+
+        /**
+         * Queries across all shards that do not materialise the merged histogram, they
+         * return the same results as the equivalent query on the merged histogram.
+         */
+        s64 hdr_sharded_total_count(const hdr_sharded_histogram* s);
+        s64 hdr_sharded_min(const hdr_sharded_histogram* s);
+        s64 hdr_sharded_max(const hdr_sharded_histogram* s);
+        s64 hdr_sharded_value_at_percentile(const hdr_sharded_histogram* s, f64 percentile);
+        f64 hdr_sharded_mean(const hdr_sharded_histogram* s);
+        f64 hdr_sharded_stddev(const hdr_sharded_histogram* s);
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef __CHISTOGRAM_TEMPLATE_H__
+#define __CHISTOGRAM_TEMPLATE_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cbase/c_memory.h"
+#include "chistogram/c_histogram.h"
+
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#endif
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        /**
+         * The bucket configuration of hdr_calculate_bucket_config computed at compile time,
+         * with integer logarithms instead of floating point ones.
+         */
+        namespace nconfig
+        {
+            constexpr s64 power_of_10(s32 exponent) { return 0 == exponent ? 1 : 10 * power_of_10(exponent - 1); }
+
+            // Smallest m with 2^m >= value, and largest m with 2^m <= value
+            constexpr s32 ceil_log2(s64 value, s32 m = 0) { return ((s64)1 << m) >= value ? m : ceil_log2(value, m + 1); }
+            constexpr s32 floor_log2(s64 value) { return value <= 1 ? 0 : 1 + floor_log2(value >> 1); }
+
+            constexpr s32 buckets_needed_to_cover_value(s64 value, s64 smallest_untrackable_value, s32 buckets_needed = 1)
+            {
+                return smallest_untrackable_value > value                 ? buckets_needed
+                       : smallest_untrackable_value > 0x3fffffffffffffffLL ? buckets_needed + 1
+                                                                           : buckets_needed_to_cover_value(value, smallest_untrackable_value << 1, buckets_needed + 1);
+            }
+        } // namespace nconfig
+
+        inline s32 hdr_count_leading_zeros_64(u64 value)
+        {
+#if defined(_MSC_VER) && defined(_WIN64) && !(defined(__clang__) && (defined(_M_ARM) || defined(_M_ARM64)))
+            unsigned long leading_zero = 0;
+            _BitScanReverse64(&leading_zero, value);
+            return 63 - (s32)leading_zero;
+#elif defined(_MSC_VER) && !defined(__clang__)
+            unsigned long leading_zero = 0;
+            if (_BitScanReverse(&leading_zero, (unsigned long)(value >> 32)))
+            {
+                return 31 - (s32)leading_zero;
+            }
+            _BitScanReverse(&leading_zero, (unsigned long)value);
+            return 63 - (s32)leading_zero;
+#else
+            return __builtin_clzll(value);
+#endif
+        }
+
+        /**
+         * A histogram with a bucket configuration fixed at compile time and the counts embedded
+         * in the object, e.g. hdr_histogram_t<1, 3600000000, 3> for latencies in microseconds.
+         *
+         * record() is inlined with all the configuration as constants, down to a couple of
+         * shifts, the increment of the count and the updates of the totals.  The object converts
+         * to a hdr_histogram* so that all the C-style queries, iterators, merges and hdr_reset
+         * work on it as usual.  It holds no occupancy bitmap nor percentile index and never
+         * allocates, auto promotion and auto resizing do not apply and hdr_close must not be
+         * called on it.
+         */
+        template <s64 LowestDiscernible, s64 HighestTrackable, s32 SigFigs> struct hdr_histogram_t
+        {
+            static_assert(LowestDiscernible >= 1 && LowestDiscernible * 2 <= HighestTrackable, "invalid value range");
+            static_assert(SigFigs >= 1 && SigFigs <= 5, "significant figures must be in [1, 5]");
+
+            static constexpr s32 SUB_BUCKET_COUNT_MAGNITUDE      = nconfig::ceil_log2(2 * nconfig::power_of_10(SigFigs));
+            static constexpr s32 SUB_BUCKET_HALF_COUNT_MAGNITUDE = (SUB_BUCKET_COUNT_MAGNITUDE > 1 ? SUB_BUCKET_COUNT_MAGNITUDE : 1) - 1;
+            static constexpr s32 UNIT_MAGNITUDE                  = nconfig::floor_log2(LowestDiscernible);
+            static constexpr s32 SUB_BUCKET_COUNT                = 1 << (SUB_BUCKET_HALF_COUNT_MAGNITUDE + 1);
+            static constexpr s32 SUB_BUCKET_HALF_COUNT           = SUB_BUCKET_COUNT / 2;
+            static constexpr s64 SUB_BUCKET_MASK                 = ((s64)SUB_BUCKET_COUNT - 1) << UNIT_MAGNITUDE;
+            static constexpr s32 BUCKET_COUNT                    = nconfig::buckets_needed_to_cover_value(HighestTrackable, (s64)SUB_BUCKET_COUNT << UNIT_MAGNITUDE);
+            static constexpr s32 COUNTS_LEN                      = (BUCKET_COUNT + 1) * SUB_BUCKET_HALF_COUNT;
+            static constexpr s32 DIRTY_PAGE_SHIFT                = nconfig::ceil_log2(COUNTS_LEN) - 6 > 6 ? nconfig::ceil_log2(COUNTS_LEN) - 6 : 6;
+
+            static_assert(UNIT_MAGNITUDE + SUB_BUCKET_HALF_COUNT_MAGNITUDE <= 61, "value range too large for the significant figures");
+
+            hdr_histogram h;
+            s64           counts[COUNTS_LEN];
+
+            hdr_histogram_t()
+            {
+                nmem::memset(&h, 0, sizeof(h));
+                nmem::memset(counts, 0, sizeof(counts));
+
+                struct hdr_histogram_bucket_config cfg;
+                cfg.lowest_discernible_value        = LowestDiscernible;
+                cfg.highest_trackable_value         = HighestTrackable;
+                cfg.unit_magnitude                  = UNIT_MAGNITUDE;
+                cfg.significant_figures             = SigFigs;
+                cfg.sub_bucket_half_count_magnitude = SUB_BUCKET_HALF_COUNT_MAGNITUDE;
+                cfg.sub_bucket_half_count           = SUB_BUCKET_HALF_COUNT;
+                cfg.sub_bucket_mask                 = SUB_BUCKET_MASK;
+                cfg.sub_bucket_count                = SUB_BUCKET_COUNT;
+                cfg.bucket_count                    = BUCKET_COUNT;
+                cfg.counts_len                      = COUNTS_LEN;
+                hdr_init_preallocated(&h, &cfg);
+                h.counts = counts;
+            }
+
+            // The header points at the embedded counts
+            hdr_histogram_t(const hdr_histogram_t&)            = delete;
+            hdr_histogram_t& operator=(const hdr_histogram_t&) = delete;
+
+            operator hdr_histogram*() { return &h; }
+            operator const hdr_histogram*() const { return &h; }
+
+            static inline s32 counts_index_for(s64 value)
+            {
+                const s32 pow2ceiling      = 64 - hdr_count_leading_zeros_64((u64)value | SUB_BUCKET_MASK);
+                const s32 bucket_index     = pow2ceiling - UNIT_MAGNITUDE - (SUB_BUCKET_HALF_COUNT_MAGNITUDE + 1);
+                const s32 sub_bucket_index = (s32)(value >> (bucket_index + UNIT_MAGNITUDE));
+                return ((bucket_index + 1) << SUB_BUCKET_HALF_COUNT_MAGNITUDE) + sub_bucket_index - SUB_BUCKET_HALF_COUNT;
+            }
+
+            inline bool record(s64 value) { return record(value, 1); }
+
+            inline bool record(s64 value, s64 count)
+            {
+                if (0 != h.normalizing_index_offset)
+                {
+                    // Shifted with hdr_shift_values_*, the counts are no longer at their plain index
+                    return hdr_record_values(&h, value, count);
+                }
+
+                if (value < 0)
+                {
+                    return false;
+                }
+                const s32 index = counts_index_for(value);
+                if (index >= COUNTS_LEN)
+                {
+                    return false;
+                }
+
+                counts[index] += count;
+                h.total_count += count;
+                if (count < 0)
+                {
+                    // A removal followed by a record leaves the total as it was, see hdr_summary
+                    h.version++;
+                }
+                h.min_value = (value < h.min_value && value != 0) ? value : h.min_value;
+                h.max_value = (value > h.max_value) ? value : h.max_value;
+                h.dirty_lo  = index < h.dirty_lo ? index : h.dirty_lo;
+                h.dirty_hi  = index > h.dirty_hi ? index : h.dirty_hi;
+                h.dirty_pages |= (u64)1 << (index >> DIRTY_PAGE_SHIFT);
+                return true;
+            }
+        };
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
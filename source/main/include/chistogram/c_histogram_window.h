@@ -0,0 +1,69 @@
+#ifndef __CHISTOGRAM_WINDOW_H__
+#define __CHISTOGRAM_WINDOW_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "chistogram/c_histogram.h"
+
+namespace ncore
+{
+    class alloc_t;
+
+    namespace nhdr
+    {
+        /**
+         * A sliding window over the last 'interval_count' completed intervals (e.g. the last
+         * 60 seconds with a rotation every second).
+         *
+         * Values are recorded into the current interval slot of a ring of interval_count + 1
+         * identically configured histograms.  hdr_window_rotate completes the current interval,
+         * adds it to the 'window' histogram and subtracts the interval that falls out of the
+         * window, so 'window' always holds the sum of the completed intervals and any read-only
+         * hdr_* query on it costs the same as on a single histogram.
+         */
+        struct hdr_window_histogram
+        {
+            hdr_histogram** slots;      // ring of interval histograms, slots[current] is being recorded
+            hdr_histogram*  window;     // sum of all the other (completed) slots
+            s32             slot_count; // interval_count + 1
+            s32             current;
+            alloc_t*        allocator;
+        };
+
+        /**
+         * Allocate and initialise the window, all histograms are placed in a single allocation.
+         *
+         * @return 0 on success, EINVAL if interval_count < 1, ENOMEM if the allocation failed or
+         * would exceed 4 GiB.
+         */
+        s32  hdr_window_init(hdr_window_histogram* w, struct hdr_histogram_bucket_config* cfg, s32 interval_count, alloc_t* allocator);
+        void hdr_window_destroy(hdr_window_histogram* w);
+        void hdr_window_reset(hdr_window_histogram* w);
+
+        /**
+         * Record into the current interval, the value shows up in the window after the next rotation.
+         *
+         * @return false if the value can't be recorded.
+         */
+        bool hdr_window_record_value(hdr_window_histogram* w, s64 value);
+        bool hdr_window_record_values(hdr_window_histogram* w, s64 value, s64 count);
+
+        /**
+         * Complete the current interval and start the next one, dropping the oldest interval
+         * from the window.  Only the counts touched by the oldest interval are cleared.
+         */
+        void hdr_window_rotate(hdr_window_histogram* w);
+
+        /**
+         * Queries over the completed intervals in the window.
+         */
+        s64 hdr_window_total_count(const hdr_window_histogram* w);
+        s64 hdr_window_value_at_percentile(const hdr_window_histogram* w, f64 percentile);
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef __CHISTOGRAM_ATOMIC_H__
+#define __CHISTOGRAM_ATOMIC_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#    include <intrin.h>
+#endif
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        // Minimal set of sequentially consistent atomic primitives used by the atomic
+        // recording functions, mirrors hdr_atomic.h from HdrHistogram_c.
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+        inline s64 hdr_atomic_load_64(const volatile s64* field) { return _InterlockedCompareExchange64((volatile __int64*)field, 0, 0); }
+        inline s64 hdr_atomic_load_relaxed_64(const volatile s64* field) { return __iso_volatile_load64((const volatile __int64*)field); }
+        inline s32 hdr_atomic_load_relaxed_32(const volatile s32* field) { return __iso_volatile_load32((const volatile int*)field); }
+        inline s16 hdr_atomic_load_relaxed_16(const volatile s16* field) { return __iso_volatile_load16((const volatile short*)field); }
+        inline void hdr_atomic_store_64(volatile s64* field, s64 value) { _InterlockedExchange64((volatile __int64*)field, value); }
+        inline s64 hdr_atomic_add_fetch_64(volatile s64* field, s64 value) { return _InterlockedExchangeAdd64((volatile __int64*)field, value) + value; }
+        inline s64 hdr_atomic_or_64(volatile s64* field, s64 value) { return _InterlockedOr64((volatile __int64*)field, value); }
+        inline s64 hdr_atomic_exchange_64(volatile s64* field, s64 value) { return _InterlockedExchange64((volatile __int64*)field, value); }
+
+        inline void* hdr_atomic_load_pointer(void* const volatile* field) { return _InterlockedCompareExchangePointer((void* volatile*)field, nullptr, nullptr); }
+        inline void* hdr_atomic_exchange_pointer(void* volatile* field, void* value) { return _InterlockedExchangePointer(field, value); }
+
+        inline void hdr_atomic_pause()
+        {
+#    if defined(_M_IX86) || defined(_M_X64)
+            _mm_pause();
+#    endif
+        }
+
+        // Orders the loads before it with the loads after it, like a seqlock reader needs
+        inline void hdr_atomic_fence_acquire()
+        {
+#    if defined(_M_ARM) || defined(_M_ARM64)
+            __dmb(0xB); // ISH
+#    else
+            _ReadWriteBarrier();
+#    endif
+        }
+
+        inline bool hdr_atomic_compare_exchange_64(volatile s64* field, s64* expected, s64 desired)
+        {
+            const s64 comparand = *expected;
+            const s64 previous  = _InterlockedCompareExchange64((volatile __int64*)field, desired, comparand);
+            if (previous == comparand)
+            {
+                return true;
+            }
+            *expected = previous;
+            return false;
+        }
+
+        inline bool hdr_atomic_compare_exchange_32(volatile s32* field, s32* expected, s32 desired)
+        {
+            const s32 comparand = *expected;
+            const s32 previous  = (s32)_InterlockedCompareExchange((volatile long*)field, (long)desired, (long)comparand);
+            if (previous == comparand)
+            {
+                return true;
+            }
+            *expected = previous;
+            return false;
+        }
+
+        inline bool hdr_atomic_compare_exchange_16(volatile s16* field, s16* expected, s16 desired)
+        {
+            const s16 comparand = *expected;
+            const s16 previous  = _InterlockedCompareExchange16((volatile short*)field, desired, comparand);
+            if (previous == comparand)
+            {
+                return true;
+            }
+            *expected = previous;
+            return false;
+        }
+
+#else
+
+        inline s64 hdr_atomic_load_64(const volatile s64* field) { return __atomic_load_n(field, __ATOMIC_SEQ_CST); }
+        inline s64 hdr_atomic_load_relaxed_64(const volatile s64* field) { return __atomic_load_n(field, __ATOMIC_RELAXED); }
+        inline s32 hdr_atomic_load_relaxed_32(const volatile s32* field) { return __atomic_load_n(field, __ATOMIC_RELAXED); }
+        inline s16 hdr_atomic_load_relaxed_16(const volatile s16* field) { return __atomic_load_n(field, __ATOMIC_RELAXED); }
+        inline void hdr_atomic_store_64(volatile s64* field, s64 value) { __atomic_store_n(field, value, __ATOMIC_SEQ_CST); }
+        inline s64 hdr_atomic_add_fetch_64(volatile s64* field, s64 value) { return __atomic_add_fetch(field, value, __ATOMIC_SEQ_CST); }
+        inline s64 hdr_atomic_or_64(volatile s64* field, s64 value) { return __atomic_fetch_or(field, value, __ATOMIC_SEQ_CST); }
+        inline s64 hdr_atomic_exchange_64(volatile s64* field, s64 value) { return __atomic_exchange_n(field, value, __ATOMIC_SEQ_CST); }
+
+        inline void* hdr_atomic_load_pointer(void* const volatile* field) { return __atomic_load_n(field, __ATOMIC_SEQ_CST); }
+        inline void* hdr_atomic_exchange_pointer(void* volatile* field, void* value) { return __atomic_exchange_n(field, value, __ATOMIC_SEQ_CST); }
+
+        inline void hdr_atomic_pause()
+        {
+#    if defined(__i386__) || defined(__x86_64__)
+            __builtin_ia32_pause();
+#    elif defined(__aarch64__)
+            __asm__ __volatile__("yield");
+#    endif
+        }
+        inline void hdr_atomic_fence_acquire() { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+
+        inline bool hdr_atomic_compare_exchange_64(volatile s64* field, s64* expected, s64 desired) { return __atomic_compare_exchange_n(field, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+        inline bool hdr_atomic_compare_exchange_32(volatile s32* field, s32* expected, s32 desired) { return __atomic_compare_exchange_n(field, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+        inline bool hdr_atomic_compare_exchange_16(volatile s16* field, s16* expected, s16 desired) { return __atomic_compare_exchange_n(field, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+
+#endif
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
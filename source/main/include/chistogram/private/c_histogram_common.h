@@ -0,0 +1,28 @@
+#ifndef __CHISTOGRAM_COMMON_H__
+#define __CHISTOGRAM_COMMON_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+namespace ncore
+{
+    namespace nhdr
+    {
+        // Error codes returned by the histogram functions, the negated errno values that
+        // HdrHistogram_c returns.
+        const s32 EINVAL = -1;
+        const s32 ENOMEM = -2;
+        const s32 EIO    = -3;
+        const s32 EBUSY  = -4;
+
+        // Every allocation, and every part placed inside an allocation, starts at a cache line.
+        const u32 HDR_CACHE_LINE_SIZE = 64;
+
+        inline u64 align_to_cache_line(u64 size) { return (size + (HDR_CACHE_LINE_SIZE - 1)) & ~((u64)HDR_CACHE_LINE_SIZE - 1); }
+
+    } // namespace nhdr
+
+}; // namespace ncore
+
+#endif
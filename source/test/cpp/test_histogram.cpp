@@ -1,9 +1,47 @@
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
 #include "cunittest/cunittest.h"
 
 #include "chistogram/c_histogram.h"
 
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
 using namespace ncore;
 
+// The percentile lines as hdr_percentiles_print wrote them with printf
+static u32 print_percentiles_reference(nhdr::hdr_histogram* h, char* str, u32 capacity, s32 ticks_per_half_distance, f64 value_scale, bool csv)
+{
+	const char* line = csv ? "%.*f,%f,%lld,%.2f\n" : "%12.*f %12f %12lld %12.2f\n";
+	u32         length = (u32)snprintf(str, capacity, csv ? "%s,%s,%s,%s\n" : "%12s %12s %12s %12s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+	nhdr::hdr_iter iter;
+	nhdr::hdr_iter_percentile_init(&iter, h, ticks_per_half_distance);
+	while (nhdr::hdr_iter_next(&iter))
+	{
+		const f64 percentile = iter.specifics.percentiles.percentile / 100.0;
+		length += (u32)snprintf(str + length, capacity - length, line, h->significant_figures, iter.highest_equivalent_value / value_scale, percentile, (long long)iter.cumulative_count, 1.0 / (1.0 - percentile));
+	}
+
+	if (!csv)
+	{
+		length += (u32)snprintf(str + length, capacity - length, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n#[Max     = %12.3f, Total count    = %12lld]\n#[Buckets = %12d, SubBuckets     = %12d]\n", nhdr::hdr_mean(h) / value_scale,
+		                        nhdr::hdr_stddev(h) / value_scale, nhdr::hdr_max(h) / value_scale, (long long)h->total_count, h->bucket_count, h->sub_bucket_count);
+	}
+	return length;
+}
+
+static s32 append_sink(void* user, const char* data, u32 length)
+{
+	nhdr::hdr_writer* target = (nhdr::hdr_writer*)user;
+	memcpy(target->buffer + target->length, data, length);
+	target->length += length;
+	return 0;
+}
+
 UNITTEST_SUITE_BEGIN(test_histogram)
 {
 	UNITTEST_FIXTURE(main)
@@ -20,7 +58,1041 @@ UNITTEST_SUITE_BEGIN(test_histogram)
 		{
 		}
 
+		UNITTEST_TEST(init_with_allocator)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), &h));
+			CHECK_NOT_NULL(h);
+			CHECK_EQUAL(0, (s32)((u64)h->counts & 63));
+			CHECK_TRUE((u8*)h->counts > (u8*)h);
+			CHECK_TRUE((u8*)h->counts < (u8*)h + nhdr::hdr_get_memory_size(h));
+
+			CHECK_TRUE(nhdr::hdr_record_value(h, 1000));
+			CHECK_TRUE(nhdr::hdr_record_value(h, 2000));
+			CHECK_EQUAL(2, h->total_count);
+			CHECK_EQUAL(1000, nhdr::hdr_min(h));
+
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 3600000000LL, 3, &cfg));
+			CHECK_EQUAL(nhdr::hdr_get_preallocated_size(&cfg), nhdr::hdr_get_memory_size(h));
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(init_preallocated_buffer)
+		{
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 100000, 2, &cfg));
+
+			const u64 size = nhdr::hdr_get_preallocated_size(&cfg);
+			static u64 buffer[4096];
+			CHECK_TRUE(size <= sizeof(buffer));
+			CHECK_NULL(nhdr::hdr_init_preallocated(buffer, size - 1, &cfg));
+			CHECK_NULL(nhdr::hdr_init_preallocated(buffer, sizeof(buffer), &cfg, nhdr::HDR_COUNTS_PACKED));
+			CHECK_NULL(nhdr::hdr_init_preallocated(buffer, sizeof(buffer), &cfg, nhdr::HDR_COUNTS_PAGED));
+
+			nhdr::hdr_histogram* h = nhdr::hdr_init_preallocated(buffer, sizeof(buffer), &cfg);
+			CHECK_EQUAL((void*)buffer, (void*)h);
+			CHECK_TRUE(nhdr::hdr_record_values(h, 500, 3));
+			CHECK_EQUAL(3, nhdr::hdr_count_at_value(h, 500));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(h, 500, nhdr::hdr_value_at_percentile(h, 50.0)));
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(narrow_counts)
+		{
+			nhdr::hdr_histogram* h16 = nullptr;
+			nhdr::hdr_histogram* h32 = nullptr;
+			nhdr::hdr_histogram* h64 = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_16_BIT, &h16));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_32_BIT, &h32));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), &h64));
+			CHECK_EQUAL(nhdr::hdr_get_memory_size(h64) - nhdr::hdr_get_memory_size(h16), (u64)h64->counts_len * 6);
+
+			for (s64 v = 1; v <= 10000; ++v)
+			{
+				CHECK_TRUE(nhdr::hdr_record_values(h16, v * 1000, 1 + (v % 3)));
+				CHECK_TRUE(nhdr::hdr_record_values(h32, v * 1000, 1 + (v % 3)));
+				CHECK_TRUE(nhdr::hdr_record_values(h64, v * 1000, 1 + (v % 3)));
+			}
+
+			CHECK_EQUAL(h64->total_count, h16->total_count);
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(h64, 99.0), nhdr::hdr_value_at_percentile(h16, 99.0));
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(h64, 50.0), nhdr::hdr_value_at_percentile(h32, 50.0));
+			CHECK_EQUAL(nhdr::hdr_mean(h64), nhdr::hdr_mean(h16));
+			CHECK_EQUAL(nhdr::hdr_stddev(h64), nhdr::hdr_stddev(h32));
+			CHECK_EQUAL(nhdr::hdr_max(h64), nhdr::hdr_max(h16));
+
+			nhdr::hdr_iter iter16, iter64;
+			nhdr::hdr_iter_percentile_init(&iter16, h16, 5);
+			nhdr::hdr_iter_percentile_init(&iter64, h64, 5);
+			while (nhdr::hdr_iter_next(&iter64))
+			{
+				CHECK_TRUE(nhdr::hdr_iter_next(&iter16));
+				CHECK_EQUAL(iter64.value, iter16.value);
+				CHECK_EQUAL(iter64.cumulative_count, iter16.cumulative_count);
+			}
+			CHECK_FALSE(nhdr::hdr_iter_next(&iter16));
+
+			// A 16 bit count that would overflow is rejected
+			CHECK_FALSE(nhdr::hdr_record_values(h16, 5, 40000));
+			CHECK_EQUAL(0, nhdr::hdr_count_at_value(h16, 5));
+
+			// Adding into a 32 bit histogram
+			CHECK_EQUAL(0, nhdr::hdr_add(h32, h16));
+			CHECK_EQUAL(2 * h64->total_count, h32->total_count);
+
+			nhdr::hdr_close(h16);
+			nhdr::hdr_close(h32);
+			nhdr::hdr_close(h64);
+		}
+
+		UNITTEST_TEST(narrow_counts_auto_promote)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000000, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_16_BIT | nhdr::HDR_AUTO_PROMOTE, &h));
+			CHECK_EQUAL(2, h->counts_word_size);
+
+			CHECK_TRUE(nhdr::hdr_record_values(h, 100, 30000));
+			CHECK_TRUE(nhdr::hdr_record_values(h, 200, 7));
+			CHECK_EQUAL(2, h->counts_word_size);
+			CHECK_TRUE(nhdr::hdr_record_values(h, 100, 30000));
+			CHECK_EQUAL(4, h->counts_word_size);
+			CHECK_EQUAL(60000, nhdr::hdr_count_at_value(h, 100));
+			CHECK_EQUAL(7, nhdr::hdr_count_at_value(h, 200));
+
+			CHECK_TRUE(nhdr::hdr_record_values(h, 300, 0x100000000LL));
+			CHECK_EQUAL(8, h->counts_word_size);
+			CHECK_EQUAL(0x100000000LL, nhdr::hdr_count_at_value(h, 300));
+			CHECK_EQUAL(60000, nhdr::hdr_count_at_value(h, 100));
+			CHECK_EQUAL(60007 + 0x100000000LL, h->total_count);
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(record_values_batch)
+		{
+			nhdr::hdr_histogram* batched = nullptr;
+			nhdr::hdr_histogram* single  = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1LL << 56, 3, &batched));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1LL << 56, 3, &single));
+
+			const s32 n = 1000;
+			s64       values[n];
+			s64       counts[n];
+			u64       x = 0x9E3779B97F4A7C15ULL;
+			for (s32 i = 0; i < n; ++i)
+			{
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+				values[i] = (s64)(x >> (8 + (i % 50)));
+				counts[i] = 1 + (i % 4);
+			}
+			values[10] = -5;
+			values[77] = 0;
+			values[78] = (1LL << 53) + 12345;
+			values[79] = 1LL << 60;
+
+			s64 dropped = 0;
+			for (s32 i = 0; i < n; ++i)
+			{
+				if (!nhdr::hdr_record_value(single, values[i]))
+					dropped++;
+			}
+			CHECK_EQUAL(2, dropped);
+			CHECK_EQUAL(dropped, nhdr::hdr_record_values_batch(batched, values, n));
+
+			for (s32 i = 0; i < single->counts_len; ++i)
+				CHECK_EQUAL(nhdr::hdr_count_at_index(single, i), nhdr::hdr_count_at_index(batched, i));
+			CHECK_EQUAL(single->total_count, batched->total_count);
+			CHECK_EQUAL(single->min_value, batched->min_value);
+			CHECK_EQUAL(single->max_value, batched->max_value);
+
+			nhdr::hdr_reset(single);
+			nhdr::hdr_reset(batched);
+			for (s32 i = 0; i < n; ++i)
+				nhdr::hdr_record_values(single, values[i], counts[i]);
+			CHECK_EQUAL(4 + 3, nhdr::hdr_record_values_batch(batched, values, counts, n));
+			CHECK_EQUAL(single->total_count, batched->total_count);
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(single, 90.0), nhdr::hdr_value_at_percentile(batched, 90.0));
+
+			// Blocks holding only zeros or only dropped values leave min and max alone
+			const s64 zeros[3]        = {0, 0, 0};
+			const s64 out_of_range[3] = {-1, 1LL << 60, -7};
+			nhdr::hdr_reset(batched);
+			CHECK_EQUAL(3, nhdr::hdr_record_values_batch(batched, out_of_range, 3));
+			CHECK_EQUAL(0, nhdr::hdr_max(batched));
+			CHECK_EQUAL(0, nhdr::hdr_record_values_batch(batched, zeros, 3));
+			CHECK_EQUAL(3, batched->total_count);
+			CHECK_EQUAL(0, nhdr::hdr_max(batched));
+			CHECK_EQUAL(0, nhdr::hdr_min(batched));
+			CHECK_EQUAL(0, nhdr::hdr_record_values_batch(batched, values + 100, 10));
+			nhdr::hdr_reset(single);
+			for (s32 i = 0; i < 3; ++i)
+				nhdr::hdr_record_value(single, zeros[i]);
+			for (s32 i = 100; i < 110; ++i)
+				nhdr::hdr_record_value(single, values[i]);
+			CHECK_EQUAL(nhdr::hdr_min(single), nhdr::hdr_min(batched));
+			CHECK_EQUAL(nhdr::hdr_max(single), nhdr::hdr_max(batched));
+
+			nhdr::hdr_close(batched);
+			nhdr::hdr_close(single);
+		}
+
+		UNITTEST_TEST(percentile_index)
+		{
+			nhdr::hdr_histogram* indexed = nullptr;
+			nhdr::hdr_histogram* plain   = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_PERCENTILE_INDEX, &indexed));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), &plain));
+			CHECK_NOT_NULL(indexed->percentile_index);
+			CHECK_NULL(plain->percentile_index);
+
+			u64 x = 12345;
+			for (s32 i = 0; i < 20000; ++i)
+			{
+				x         = x * 6364136223846793005ULL + 1442695040888963407ULL;
+				s64 value = (s64)((x >> 33) % 1000000) * (1 + (i % 7));
+				nhdr::hdr_record_value(indexed, value);
+				nhdr::hdr_record_value(plain, value);
+			}
+
+			const f64 percentiles[] = {0.0, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 99.99, 100.0};
+			for (s32 i = 0; i < 9; ++i)
+				CHECK_EQUAL(nhdr::hdr_value_at_percentile(plain, percentiles[i]), nhdr::hdr_value_at_percentile(indexed, percentiles[i]));
+
+			s64 plain_values[9], indexed_values[9];
+			CHECK_EQUAL(0, nhdr::hdr_value_at_percentiles(plain, percentiles, plain_values, 9));
+			CHECK_EQUAL(0, nhdr::hdr_value_at_percentiles(indexed, percentiles, indexed_values, 9));
+			for (s32 i = 0; i < 9; ++i)
+				CHECK_EQUAL(plain_values[i], indexed_values[i]);
+
+			CHECK_EQUAL(indexed->total_count, nhdr::hdr_count_between_values(indexed, 0, 3600000000LL));
+			CHECK_EQUAL(nhdr::hdr_count_between_values(plain, 1000, 500000), nhdr::hdr_count_between_values(indexed, 1000, 500000));
+			CHECK_EQUAL(nhdr::hdr_count_between_values(plain, 77777, 77777), nhdr::hdr_count_between_values(indexed, 77777, 77777));
+
+			nhdr::hdr_reset(indexed);
+			CHECK_EQUAL(0, nhdr::hdr_count_between_values(indexed, 0, 3600000000LL));
+			nhdr::hdr_record_value(indexed, 42);
+			CHECK_EQUAL(42, nhdr::hdr_value_at_percentile(indexed, 50.0));
+
+			nhdr::hdr_close(indexed);
+			nhdr::hdr_close(plain);
+		}
+
+		UNITTEST_TEST(iterators_skip_empty_buckets)
+		{
+			// A histogram without an occupancy bitmap walks every bucket, the results
+			// of all iterators must be identical to a histogram that skips empty ones.
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 3600000000LL, 3, &cfg));
+			alloc_t*            allocator = context_t::system_alloc();
+			nhdr::hdr_histogram walked;
+			walked.counts = (s64*)allocator->allocate(cfg.counts_len * sizeof(s64), sizeof(s64));
+			for (s32 i = 0; i < cfg.counts_len; ++i)
+				walked.counts[i] = 0;
+			nhdr::hdr_init_preallocated(&walked, &cfg);
+			CHECK_NULL(walked.occupancy);
+
+			nhdr::hdr_histogram* skipped = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &skipped));
+			CHECK_NOT_NULL(skipped->occupancy);
+
+			const s64 values[] = {0, 1, 7, 1000, 1001, 5000, 123456, 123457, 9999999, 2000000000LL};
+			for (s32 i = 0; i < 10; ++i)
+			{
+				nhdr::hdr_record_values(&walked, values[i], 1 + i);
+				nhdr::hdr_record_values(skipped, values[i], 1 + i);
+			}
+
+			for (s32 type = 0; type < 4; ++type)
+			{
+				nhdr::hdr_iter a, b;
+				switch (type)
+				{
+					case 0:
+						nhdr::hdr_iter_recorded_init(&a, &walked);
+						nhdr::hdr_iter_recorded_init(&b, skipped);
+						break;
+					case 1:
+						nhdr::hdr_iter_percentile_init(&a, &walked, 5);
+						nhdr::hdr_iter_percentile_init(&b, skipped, 5);
+						break;
+					case 2:
+						nhdr::hdr_iter_linear_init(&a, &walked, 100000);
+						nhdr::hdr_iter_linear_init(&b, skipped, 100000);
+						break;
+					default:
+						nhdr::hdr_iter_log_init(&a, &walked, 1, 2.0);
+						nhdr::hdr_iter_log_init(&b, skipped, 1, 2.0);
+						break;
+				}
+
+				s32 steps = 0;
+				while (nhdr::hdr_iter_next(&a))
+				{
+					CHECK_TRUE(nhdr::hdr_iter_next(&b));
+					CHECK_EQUAL(a.value, b.value);
+					CHECK_EQUAL(a.count, b.count);
+					CHECK_EQUAL(a.cumulative_count, b.cumulative_count);
+					CHECK_EQUAL(a.value_iterated_to, b.value_iterated_to);
+					if (type == 2)
+						CHECK_EQUAL(a.specifics.linear.count_added_in_this_iteration_step, b.specifics.linear.count_added_in_this_iteration_step);
+					if (type == 3)
+						CHECK_EQUAL(a.specifics.log.count_added_in_this_iteration_step, b.specifics.log.count_added_in_this_iteration_step);
+					steps++;
+				}
+				CHECK_FALSE(nhdr::hdr_iter_next(&b));
+				CHECK_TRUE(steps > 0);
+			}
+
+			CHECK_EQUAL(nhdr::hdr_mean(&walked), nhdr::hdr_mean(skipped));
+			CHECK_EQUAL(nhdr::hdr_stddev(&walked), nhdr::hdr_stddev(skipped));
+
+			allocator->deallocate(walked.counts);
+			nhdr::hdr_close(skipped);
+		}
+
+		UNITTEST_TEST(add_same_config)
+		{
+			// 'narrow' and 'indexed' share the bucket layout of 'into' and are added index by
+			// index, 'reference' has 32 bit counts and is added value by value.
+			nhdr::hdr_histogram* narrow    = nullptr;
+			nhdr::hdr_histogram* indexed   = nullptr;
+			nhdr::hdr_histogram* into      = nullptr;
+			nhdr::hdr_histogram* reference = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000000, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_16_BIT, &narrow));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_PERCENTILE_INDEX, &indexed));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_PERCENTILE_INDEX, &into));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_32_BIT, &reference));
+			CHECK_TRUE(narrow->counts_len < into->counts_len);
+
+			u64 x = 4321;
+			for (s32 i = 0; i < 10000; ++i)
+			{
+				x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+				nhdr::hdr_record_value(narrow, (s64)((x >> 33) % 1000000));
+				nhdr::hdr_record_value(indexed, (s64)((x >> 20) % 3600000000LL));
+			}
+
+			CHECK_EQUAL(0, nhdr::hdr_add(into, narrow));
+			CHECK_EQUAL(0, nhdr::hdr_add(into, indexed));
+			CHECK_EQUAL(0, nhdr::hdr_add(reference, narrow));
+			CHECK_EQUAL(0, nhdr::hdr_add(reference, indexed));
+
+			CHECK_EQUAL(reference->total_count, into->total_count);
+			CHECK_EQUAL(nhdr::hdr_min(reference), nhdr::hdr_min(into));
+			CHECK_EQUAL(nhdr::hdr_max(reference), nhdr::hdr_max(into));
+			CHECK_EQUAL(nhdr::hdr_mean(reference), nhdr::hdr_mean(into));
+
+			const f64 percentiles[] = {0.0, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 100.0};
+			for (s32 i = 0; i < 8; ++i)
+				CHECK_EQUAL(nhdr::hdr_value_at_percentile(reference, percentiles[i]), nhdr::hdr_value_at_percentile(into, percentiles[i]));
+			CHECK_EQUAL(nhdr::hdr_count_between_values(reference, 1000, 500000), nhdr::hdr_count_between_values(into, 1000, 500000));
+
+			nhdr::hdr_close(reference);
+			nhdr::hdr_close(into);
+			nhdr::hdr_close(indexed);
+			nhdr::hdr_close(narrow);
+		}
+
+		UNITTEST_TEST(record_corrected_values_per_bucket)
+		{
+			// The corrected histogram adds the missing values per bucket, 'expected' records
+			// every missing value on its own.
+			nhdr::hdr_histogram* corrected = nullptr;
+			nhdr::hdr_histogram* expected  = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &corrected));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &expected));
+
+			const s64 values[]    = {1, 999, 1000, 1001, 4096, 30000000, 123456789};
+			const s64 intervals[] = {1, 7, 1000, 1000, 1000, 1000, 333333};
+			for (s32 i = 0; i < 7; ++i)
+			{
+				CHECK_TRUE(nhdr::hdr_record_corrected_values(corrected, values[i], 3, intervals[i]));
+				nhdr::hdr_record_values(expected, values[i], 3);
+				for (s64 missing = values[i] - intervals[i]; missing >= intervals[i]; missing -= intervals[i])
+					nhdr::hdr_record_values(expected, missing, 3);
+			}
+
+			CHECK_EQUAL(expected->total_count, corrected->total_count);
+			CHECK_EQUAL(nhdr::hdr_min(expected), nhdr::hdr_min(corrected));
+			CHECK_EQUAL(nhdr::hdr_max(expected), nhdr::hdr_max(corrected));
+			for (s32 i = 0; i < expected->counts_len; ++i)
+				CHECK_EQUAL(expected->counts[i], corrected->counts[i]);
+
+			nhdr::hdr_histogram* added = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &added));
+			nhdr::hdr_reset(expected);
+			nhdr::hdr_reset(corrected);
+			for (s32 i = 0; i < 7; ++i)
+			{
+				// hdr_add_while_correcting_for_coordinated_omission corrects from the bucket value
+				const s64 value = nhdr::hdr_lowest_equivalent_value(added, values[i]);
+				nhdr::hdr_record_value(added, values[i]);
+				nhdr::hdr_record_value(expected, value);
+				for (s64 missing = value - 1000; missing >= 1000; missing -= 1000)
+					nhdr::hdr_record_value(expected, missing);
+			}
+			CHECK_EQUAL(0, nhdr::hdr_add_while_correcting_for_coordinated_omission(corrected, added, 1000));
+			CHECK_EQUAL(expected->total_count, corrected->total_count);
+			for (s32 i = 0; i < expected->counts_len; ++i)
+				CHECK_EQUAL(expected->counts[i], corrected->counts[i]);
+
+			nhdr::hdr_close(added);
+			nhdr::hdr_close(expected);
+			nhdr::hdr_close(corrected);
+		}
+
+		UNITTEST_TEST(shift_values)
+		{
+			nhdr::hdr_histogram* h       = nullptr;
+			nhdr::hdr_histogram* shifted = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_PERCENTILE_INDEX, &h));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &shifted));
+
+			// 5 and 700 are in the lowest half bucket, they are re-recorded by a left shift
+			const s64 values[] = {0, 0, 5, 700, 1000, 5000, 123456, 3000000};
+			for (s32 i = 0; i < 8; ++i)
+			{
+				nhdr::hdr_record_value(h, values[i]);
+				nhdr::hdr_record_value(shifted, values[i] << 3);
+			}
+
+			CHECK_EQUAL(-1, nhdr::hdr_shift_values_left(h, -1));
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(h, 3));
+			CHECK_EQUAL(shifted->total_count, h->total_count);
+			CHECK_EQUAL(2, nhdr::hdr_count_at_value(h, 0));
+			CHECK_EQUAL(nhdr::hdr_min(shifted), nhdr::hdr_min(h));
+			CHECK_EQUAL(nhdr::hdr_max(shifted), nhdr::hdr_max(h));
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(shifted, 50.0), nhdr::hdr_value_at_percentile(h, 50.0));
+
+			nhdr::hdr_iter iter, expected;
+			nhdr::hdr_iter_recorded_init(&iter, h);
+			nhdr::hdr_iter_recorded_init(&expected, shifted);
+			while (nhdr::hdr_iter_next(&expected))
+			{
+				CHECK_TRUE(nhdr::hdr_iter_next(&iter));
+				CHECK_EQUAL(expected.value, iter.value);
+				CHECK_EQUAL(expected.count, iter.count);
+			}
+			CHECK_FALSE(nhdr::hdr_iter_next(&iter));
+
+			// Recording into a shifted histogram
+			CHECK_TRUE(nhdr::hdr_record_value(h, 77777));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(h, 77777));
+
+			// A right shift can't move values into the lowest half bucket
+			CHECK_EQUAL(-1, nhdr::hdr_shift_values_right(h, 3));
+			nhdr::hdr_reset(h);
+			nhdr::hdr_record_values(h, 0, 4);
+			nhdr::hdr_record_value(h, 1000000);
+			nhdr::hdr_record_value(h, 2000000);
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_right(h, 4));
+			CHECK_EQUAL(4, nhdr::hdr_count_at_value(h, 0));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(h, 1000000 >> 4));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(h, 2000000 >> 4));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(h, 2000000 >> 4, nhdr::hdr_max(h)));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(h, 2000000 >> 4, nhdr::hdr_value_at_percentile(h, 100.0)));
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(h, 4));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(h, 1000000));
+			CHECK_EQUAL(6, nhdr::hdr_count_between_values(h, 0, 3600000000LL));
+
+			// Shifting past highest_trackable_value fails without auto-resizing
+			CHECK_EQUAL(-1, nhdr::hdr_shift_values_left(h, 12));
+
+			nhdr::hdr_close(shifted);
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(auto_resize)
+		{
+			nhdr::hdr_histogram* fixed   = nullptr;
+			nhdr::hdr_histogram* resized = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000, 3, context_t::system_alloc(), &fixed));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000, 3, context_t::system_alloc(), nhdr::HDR_AUTO_RESIZE | nhdr::HDR_PERCENTILE_INDEX, &resized));
+			const s32 counts_len = resized->counts_len;
+
+			CHECK_FALSE(nhdr::hdr_record_value(fixed, 1000000000));
+			CHECK_TRUE(nhdr::hdr_record_value(resized, 10));
+			CHECK_TRUE(nhdr::hdr_record_value(resized, 1000000000));
+			CHECK_TRUE(resized->counts_len > counts_len);
+			CHECK_TRUE(resized->highest_trackable_value >= 1000000000);
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(resized, 10));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(resized, 1000000000));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(resized, 1000000000, nhdr::hdr_value_at_percentile(resized, 100.0)));
+
+			const s64 values[] = {3, 2000000000000LL, 5};
+			CHECK_EQUAL(0, nhdr::hdr_record_values_batch(resized, values, 3));
+			CHECK_EQUAL(5, resized->total_count);
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(resized, 2000000000000LL));
+
+			// A left shift grows the counts as well
+			nhdr::hdr_reset(resized);
+			nhdr::hdr_record_value(resized, 1500);
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(resized, 40));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(resized, 1500LL << 40));
+			CHECK_TRUE(nhdr::hdr_record_value(resized, 1500));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(resized, 1500));
+
+			nhdr::hdr_close(resized);
+			nhdr::hdr_close(fixed);
+		}
+
+		UNITTEST_TEST(summary)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &h));
+
+			u64 x = 777;
+			for (s32 i = 0; i < 10000; ++i)
+			{
+				x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+				nhdr::hdr_record_value(h, (s64)((x >> 33) % 100000000));
+			}
+
+			const f64       percentiles[] = {99.9, 50.0, 0.0, 100.0, 90.0, 25.0};
+			nhdr::hdr_stats stats;
+			nhdr::hdr_stats_init(&stats);
+			CHECK_EQUAL(0, nhdr::hdr_summary(h, percentiles, 6, &stats));
+			CHECK_EQUAL(h->total_count, stats.total_count);
+			CHECK_EQUAL(nhdr::hdr_min(h), stats.min);
+			CHECK_EQUAL(nhdr::hdr_max(h), stats.max);
+			CHECK_EQUAL(nhdr::hdr_mean(h), stats.mean);
+			CHECK_TRUE(fabs(nhdr::hdr_stddev(h) - stats.stddev) < nhdr::hdr_stddev(h) * 1e-9);
+			for (s32 i = 0; i < 6; ++i)
+				CHECK_EQUAL(nhdr::hdr_value_at_percentile(h, percentiles[i]), stats.values[i]);
+
+			// An unchanged histogram returns the cached results
+			stats.mean = -1.0;
+			CHECK_EQUAL(0, nhdr::hdr_summary(h, percentiles, 6, &stats));
+			CHECK_EQUAL(-1.0, stats.mean);
+
+			// Recording, or a reset that ends at the same count, invalidates them
+			nhdr::hdr_record_value(h, 5);
+			CHECK_EQUAL(0, nhdr::hdr_summary(h, percentiles, 6, &stats));
+			CHECK_EQUAL(nhdr::hdr_mean(h), stats.mean);
+
+			const s64 total_count = h->total_count;
+			nhdr::hdr_reset(h);
+			nhdr::hdr_record_values(h, 1000, total_count);
+			CHECK_EQUAL(0, nhdr::hdr_summary(h, percentiles, 6, &stats));
+			CHECK_EQUAL(nhdr::hdr_mean(h), stats.mean);
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(h, 50.0), stats.values[1]);
+
+			// A subtraction followed by a record ends at the same count with other values
+			nhdr::hdr_histogram* removed = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &removed));
+			nhdr::hdr_record_value(removed, 1000);
+			CHECK_EQUAL(0, nhdr::hdr_subtract(h, removed));
+			nhdr::hdr_record_value(h, 90000);
+			CHECK_EQUAL(0, nhdr::hdr_summary(h, percentiles, 6, &stats));
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(h, 50.0), stats.values[1]);
+			CHECK_EQUAL(nhdr::hdr_max(h), stats.max);
+			nhdr::hdr_close(removed);
+
+			CHECK_EQUAL(-1, nhdr::hdr_summary(h, percentiles, nhdr::HDR_STATS_MAX_PERCENTILES + 1, &stats));
+			CHECK_EQUAL(-1, nhdr::hdr_summary(h, nullptr, 1, &stats));
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(running_sums)
+		{
+			nhdr::hdr_histogram* walked = nullptr;
+			nhdr::hdr_histogram* summed = nullptr;
+			nhdr::hdr_histogram* other  = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &walked));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_RUNNING_SUMS, &summed));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_RUNNING_SUMS, &other));
+
+			u64 x = 12345;
+			for (s32 i = 0; i < 10000; ++i)
+			{
+				x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+				const s64 value = (s64)((x >> 33) % 100000000);
+				nhdr::hdr_record_values(walked, value, 1 + (i & 3));
+				nhdr::hdr_record_values(i & 1 ? summed : other, value, 1 + (i & 3));
+			}
+			nhdr::hdr_record_corrected_value(walked, 250000000, 1000000);
+			nhdr::hdr_record_corrected_value(other, 250000000, 1000000);
+			CHECK_EQUAL(0, nhdr::hdr_add(summed, other));
+
+			// Same total as the bucket walk, the deviation only differs by rounding
+			CHECK_EQUAL(walked->total_count, summed->total_count);
+			CHECK_EQUAL(nhdr::hdr_mean(walked), nhdr::hdr_mean(summed));
+			f64 diff = nhdr::hdr_stddev(walked) - nhdr::hdr_stddev(summed);
+			CHECK_TRUE(diff < 1e-6 && diff > -1e-6);
+
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(walked, 2));
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(summed, 2));
+			CHECK_EQUAL(nhdr::hdr_mean(walked), nhdr::hdr_mean(summed));
+			diff = nhdr::hdr_stddev(walked) - nhdr::hdr_stddev(summed);
+			CHECK_TRUE(diff < 1e-6 && diff > -1e-6);
+
+			// The mode stays on after a reset
+			nhdr::hdr_reset(walked);
+			nhdr::hdr_reset(summed);
+			nhdr::hdr_record_values(walked, 1000, 3);
+			nhdr::hdr_record_values(summed, 1000, 3);
+			nhdr::hdr_record_value(walked, 3000);
+			nhdr::hdr_record_value(summed, 3000);
+			CHECK_EQUAL(nhdr::hdr_mean(walked), nhdr::hdr_mean(summed));
+			CHECK_EQUAL(nhdr::hdr_stddev(walked), nhdr::hdr_stddev(summed));
+			CHECK_EQUAL(1000 * 3 + 3001, summed->running_sum.lo);
+
+			// A count that goes negative falls back to the bucket walk
+			nhdr::hdr_record_values(walked, 4000, 5);
+			nhdr::hdr_record_values(summed, 4000, 5);
+			nhdr::hdr_record_values(walked, 5000, -1);
+			nhdr::hdr_record_values(summed, 5000, -1);
+			CHECK_EQUAL(nhdr::hdr_mean(walked), nhdr::hdr_mean(summed));
+			CHECK_EQUAL(nhdr::hdr_stddev(walked), nhdr::hdr_stddev(summed));
+
+			// So does a subtraction that leaves a negative count
+			nhdr::hdr_histogram* removed = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &removed));
+			nhdr::hdr_record_values(removed, 2000, 2);
+			nhdr::hdr_record_values(removed, 1000, 1);
+			CHECK_EQUAL(0, nhdr::hdr_subtract(walked, removed));
+			CHECK_EQUAL(0, nhdr::hdr_subtract(summed, removed));
+			CHECK_EQUAL(nhdr::hdr_mean(walked), nhdr::hdr_mean(summed));
+			CHECK_EQUAL(nhdr::hdr_stddev(walked), nhdr::hdr_stddev(summed));
+			nhdr::hdr_close(removed);
+
+			// Until a reset
+			nhdr::hdr_reset(summed);
+			nhdr::hdr_record_values(summed, 1000, 3);
+			CHECK_EQUAL(1000 * 3, summed->running_sum.lo);
+			CHECK_EQUAL(1000.0, nhdr::hdr_mean(summed));
+
+			nhdr::hdr_close(other);
+			nhdr::hdr_close(summed);
+			nhdr::hdr_close(walked);
+		}
+
+		UNITTEST_TEST(subtract_and_delta)
+		{
+			nhdr::hdr_histogram* older  = nullptr;
+			nhdr::hdr_histogram* newer  = nullptr;
+			nhdr::hdr_histogram* delta  = nullptr;
+			nhdr::hdr_histogram* narrow = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &older));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &newer));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_PERCENTILE_INDEX, &delta));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_32_BIT, &narrow));
+
+			// A cumulative histogram, scraped before and after the second interval
+			nhdr::hdr_record_values(older, 5, 10);
+			nhdr::hdr_record_values(older, 5000, 10);
+			CHECK_EQUAL(0, nhdr::hdr_add(newer, older));
+			nhdr::hdr_record_values(newer, 5000, 3);
+			nhdr::hdr_record_values(newer, 70000, 4);
+
+			CHECK_EQUAL(0, nhdr::hdr_delta(delta, newer, older));
+			CHECK_EQUAL(7, delta->total_count);
+			CHECK_EQUAL(0, nhdr::hdr_count_at_value(delta, 5));
+			CHECK_EQUAL(3, nhdr::hdr_count_at_value(delta, 5000));
+			CHECK_EQUAL(4, nhdr::hdr_count_at_value(delta, 70000));
+			CHECK_EQUAL(5000, nhdr::hdr_min(delta));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(delta, 70000, nhdr::hdr_max(delta)));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(delta, 70000, nhdr::hdr_value_at_percentile(delta, 90.0)));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(delta, 5000, nhdr::hdr_value_at_percentile(delta, 40.0)));
+
+			// Removing the highest values finds the new max
+			nhdr::hdr_histogram* top = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &top));
+			nhdr::hdr_record_values(top, 70000, 4);
+			CHECK_EQUAL(0, nhdr::hdr_subtract(delta, top));
+			CHECK_EQUAL(3, delta->total_count);
+			CHECK_EQUAL(nhdr::hdr_max(older), nhdr::hdr_max(delta));
+			CHECK_EQUAL(5000, nhdr::hdr_min(delta));
+
+			// The value by value path gives the same result
+			CHECK_EQUAL(0, nhdr::hdr_add(narrow, newer));
+			CHECK_EQUAL(0, nhdr::hdr_subtract(narrow, older));
+			CHECK_EQUAL(7, narrow->total_count);
+			CHECK_EQUAL(5000, nhdr::hdr_min(narrow));
+			CHECK_EQUAL(3, nhdr::hdr_count_at_value(narrow, 5000));
+
+			CHECK_EQUAL(0, nhdr::hdr_subtract(narrow, delta));
+			CHECK_EQUAL(4, narrow->total_count);
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(narrow, 70000, nhdr::hdr_min(narrow)));
+
+			nhdr::hdr_close(top);
+			nhdr::hdr_close(narrow);
+			nhdr::hdr_close(delta);
+			nhdr::hdr_close(newer);
+			nhdr::hdr_close(older);
+		}
+
+		UNITTEST_TEST(subtract_not_a_subset)
+		{
+			nhdr::hdr_histogram* newer = nullptr;
+			nhdr::hdr_histogram* older = nullptr;
+			nhdr::hdr_histogram* dense = nullptr;
+			nhdr::hdr_histogram* paged = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &newer));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &older));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &dense));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_PAGED, &paged));
+
+			// The scraped counter was reset in between, the delta is all of 'newer'
+			nhdr::hdr_record_values(newer, 5, 2);
+			nhdr::hdr_record_values(older, 70000, 5);
+			CHECK_EQUAL(0, nhdr::hdr_delta(dense, newer, older));
+			CHECK_EQUAL(2, dense->total_count);
+			CHECK_EQUAL(2, nhdr::hdr_count_at_value(dense, 5));
+			CHECK_EQUAL(0, nhdr::hdr_count_at_value(dense, 70000));
+
+			// A count going down with the total going up is a reset as well
+			nhdr::hdr_record_values(newer, 5, 10);
+			nhdr::hdr_record_values(older, 5, 1);
+			CHECK_EQUAL(0, nhdr::hdr_delta(dense, newer, older));
+			CHECK_EQUAL(12, dense->total_count);
+
+			// A plain subtraction leaves the negative counts, where a reset finds them
+			nhdr::hdr_reset(dense);
+			nhdr::hdr_record_values(dense, 5, 2);
+			nhdr::hdr_record_values(paged, 5, 2);
+			CHECK_EQUAL(0, nhdr::hdr_subtract(dense, older));
+			CHECK_EQUAL(0, nhdr::hdr_subtract(paged, older));
+			CHECK_EQUAL(-4, dense->total_count);
+			CHECK_EQUAL(-5, nhdr::hdr_count_at_value(dense, 70000));
+
+			nhdr::hdr_reset(dense);
+			nhdr::hdr_reset(paged);
+			CHECK_EQUAL(0, nhdr::hdr_count_at_value(dense, 70000));
+			CHECK_EQUAL(0, nhdr::hdr_count_at_value(dense, 5));
+
+			// Both layouts agree after the same operations
+			for (s64 value = 1; value <= 100000; value += 13)
+			{
+				nhdr::hdr_record_value(dense, value);
+				nhdr::hdr_record_value(paged, value);
+			}
+			CHECK_EQUAL(dense->total_count, paged->total_count);
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, 99.0), nhdr::hdr_value_at_percentile(paged, 99.0));
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, 50.0), nhdr::hdr_value_at_percentile(paged, 50.0));
+
+			nhdr::hdr_close(paged);
+			nhdr::hdr_close(dense);
+			nhdr::hdr_close(older);
+			nhdr::hdr_close(newer);
+		}
+
+		UNITTEST_TEST(dirty_range)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_PERCENTILE_INDEX, &h));
+			CHECK_EQUAL(h->counts_len, h->dirty_lo);
+			CHECK_EQUAL(-1, h->dirty_hi);
+			CHECK_EQUAL(0, h->dirty_pages);
+
+			nhdr::hdr_record_value(h, 1000);
+			nhdr::hdr_record_value(h, 100000);
+			CHECK_EQUAL(nhdr::hdr_counts_index_for(h, 1000), h->dirty_lo);
+			CHECK_EQUAL(nhdr::hdr_counts_index_for(h, 100000), h->dirty_hi);
 
+			nhdr::hdr_reset(h);
+			CHECK_EQUAL(h->counts_len, h->dirty_lo);
+			CHECK_EQUAL(0, h->dirty_pages);
+			for (s32 i = 0; i < h->counts_len; ++i)
+				CHECK_EQUAL(0, h->counts[i]);
+			nhdr::hdr_record_value(h, 5000);
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(h, 5000, nhdr::hdr_value_at_percentile(h, 50.0)));
+
+			// Atomic recording flags whole pages
+			nhdr::hdr_record_value_atomic(h, 7);
+			CHECK_TRUE(h->dirty_lo <= nhdr::hdr_counts_index_for(h, 7));
+			CHECK_TRUE(h->dirty_hi >= nhdr::hdr_counts_index_for(h, 5000));
+
+			// A shift flags all counts, the next reset clears everything
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(h, 3));
+			CHECK_EQUAL(0, h->dirty_lo);
+			CHECK_EQUAL(h->counts_len - 1, h->dirty_hi);
+			nhdr::hdr_reset(h);
+			for (s32 i = 0; i < h->counts_len; ++i)
+				CHECK_EQUAL(0, h->counts[i]);
+
+			// Counts written directly are found by hdr_reset_internal_counters
+			h->counts[nhdr::hdr_counts_index_for(h, 300)] = 2;
+			nhdr::hdr_reset_internal_counters(h);
+			CHECK_EQUAL(2, h->total_count);
+			CHECK_EQUAL(nhdr::hdr_counts_index_for(h, 300), h->dirty_lo);
+			CHECK_EQUAL(nhdr::hdr_counts_index_for(h, 300), h->dirty_hi);
+			nhdr::hdr_reset(h);
+			CHECK_EQUAL(0, h->counts[nhdr::hdr_counts_index_for(h, 300)]);
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(packed_counts)
+		{
+			nhdr::hdr_histogram* dense  = nullptr;
+			nhdr::hdr_histogram* packed = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 5, context_t::system_alloc(), 0, &dense));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 5, context_t::system_alloc(), nhdr::HDR_COUNTS_PACKED, &packed));
+			CHECK_EQUAL(0, packed->counts_word_size);
+			CHECK_FALSE(nhdr::hdr_record_value_atomic(packed, 1000));
+
+			// Counts that need 1, 2, 4 and 8 bytes, next to each other in the same block
+			u64 x = 7;
+			for (s32 i = 0; i < 20000; ++i)
+			{
+				x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+				const s64 value = (s64)((x >> 33) % 10000000);
+				const s64 count = (i % 1000 == 0) ? (1LL << 32) : (i % 100 == 0) ? 100000 : (i % 10 == 0) ? 300 : 1;
+				CHECK_TRUE(nhdr::hdr_record_values(packed, value, count));
+				nhdr::hdr_record_values(dense, value, count);
+			}
+			CHECK_TRUE(nhdr::hdr_get_memory_size(packed) * 4 < nhdr::hdr_get_memory_size(dense));
+
+			CHECK_EQUAL(dense->total_count, packed->total_count);
+			CHECK_EQUAL(nhdr::hdr_min(dense), nhdr::hdr_min(packed));
+			CHECK_EQUAL(nhdr::hdr_max(dense), nhdr::hdr_max(packed));
+			CHECK_EQUAL(nhdr::hdr_mean(dense), nhdr::hdr_mean(packed));
+			CHECK_EQUAL(nhdr::hdr_stddev(dense), nhdr::hdr_stddev(packed));
+			for (f64 p = 0.0; p <= 100.0; p += 12.5)
+				CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, p), nhdr::hdr_value_at_percentile(packed, p));
+
+			nhdr::hdr_iter a, b;
+			nhdr::hdr_iter_recorded_init(&a, dense);
+			nhdr::hdr_iter_recorded_init(&b, packed);
+			while (nhdr::hdr_iter_next(&a))
+			{
+				CHECK_TRUE(nhdr::hdr_iter_next(&b));
+				CHECK_EQUAL(a.value, b.value);
+				CHECK_EQUAL(a.count, b.count);
+			}
+			CHECK_FALSE(nhdr::hdr_iter_next(&b));
+
+			// Converted both ways, and merged both ways
+			nhdr::hdr_histogram* copy = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init_copy(packed, context_t::system_alloc(), 0, &copy));
+			CHECK_EQUAL(8, copy->counts_word_size);
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, 99.0), nhdr::hdr_value_at_percentile(copy, 99.0));
+			nhdr::hdr_close(copy);
+			CHECK_EQUAL(0, nhdr::hdr_init_copy(dense, context_t::system_alloc(), nhdr::HDR_COUNTS_PACKED, &copy));
+			CHECK_EQUAL(dense->total_count, copy->total_count);
+			CHECK_EQUAL(0, nhdr::hdr_add(dense, packed));
+			CHECK_EQUAL(0, nhdr::hdr_add(copy, packed));
+			CHECK_EQUAL(dense->total_count, copy->total_count);
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, 90.0), nhdr::hdr_value_at_percentile(copy, 90.0));
+			CHECK_EQUAL(0, nhdr::hdr_subtract(copy, packed));
+			CHECK_EQUAL(packed->total_count, copy->total_count);
+			nhdr::hdr_close(copy);
+
+			// A shift moves the packed counts like the dense ones
+			nhdr::hdr_reset(dense);
+			CHECK_EQUAL(0, nhdr::hdr_add(dense, packed));
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(dense, 4));
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(packed, 4));
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, 50.0), nhdr::hdr_value_at_percentile(packed, 50.0));
+			CHECK_EQUAL(nhdr::hdr_count_at_value(dense, 160000), nhdr::hdr_count_at_value(packed, 160000));
+
+			nhdr::hdr_reset(packed);
+			CHECK_EQUAL(0, packed->total_count);
+			for (s32 i = 0; i < packed->counts_len; ++i)
+				CHECK_EQUAL(0, nhdr::hdr_count_at_index(packed, i));
+			CHECK_TRUE(nhdr::hdr_record_value(packed, 1234));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(packed, 1234));
+
+			nhdr::hdr_close(packed);
+			nhdr::hdr_close(dense);
+
+			// Resizing moves the packed counts
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_PACKED | nhdr::HDR_AUTO_RESIZE, &packed));
+			CHECK_TRUE(nhdr::hdr_record_values(packed, 500, 70000));
+			CHECK_TRUE(nhdr::hdr_record_value(packed, 1000000));
+			CHECK_EQUAL(70000, nhdr::hdr_count_at_value(packed, 500));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(packed, 1000000));
+			nhdr::hdr_close(packed);
+		}
+
+		UNITTEST_TEST(paged_counts)
+		{
+			nhdr::hdr_histogram* dense = nullptr;
+			nhdr::hdr_histogram* paged = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), 0, &dense));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_PAGED, &paged));
+			CHECK_EQUAL(-1, paged->counts_word_size);
+			CHECK_EQUAL(0, nhdr::hdr_count_at_value(paged, 5000));
+			CHECK_FALSE(nhdr::hdr_record_value_atomic(paged, 5000));
+
+			// Values within a few buckets only allocate the pages of those buckets
+			const u64 empty_size = nhdr::hdr_get_memory_size(paged);
+			for (s64 value = 3000; value < 12000; value += 7)
+			{
+				CHECK_TRUE(nhdr::hdr_record_value(paged, value));
+				nhdr::hdr_record_value(dense, value);
+			}
+			CHECK_EQUAL(empty_size + 3 * 1024 * sizeof(s64), nhdr::hdr_get_memory_size(paged));
+			CHECK_TRUE(nhdr::hdr_get_memory_size(paged) * 5 < nhdr::hdr_get_memory_size(dense));
+
+			CHECK_EQUAL(dense->total_count, paged->total_count);
+			CHECK_EQUAL(nhdr::hdr_min(dense), nhdr::hdr_min(paged));
+			CHECK_EQUAL(nhdr::hdr_max(dense), nhdr::hdr_max(paged));
+			CHECK_EQUAL(nhdr::hdr_mean(dense), nhdr::hdr_mean(paged));
+			for (f64 p = 0.0; p <= 100.0; p += 12.5)
+				CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, p), nhdr::hdr_value_at_percentile(paged, p));
+
+			// Merged both ways, and converted
+			CHECK_EQUAL(0, nhdr::hdr_add(dense, paged));
+			CHECK_EQUAL(0, nhdr::hdr_add(paged, paged));
+			CHECK_EQUAL(dense->total_count, paged->total_count);
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, 75.0), nhdr::hdr_value_at_percentile(paged, 75.0));
+			nhdr::hdr_histogram* copy = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init_copy(dense, context_t::system_alloc(), nhdr::HDR_COUNTS_PAGED, &copy));
+			CHECK_EQUAL(nhdr::hdr_get_memory_size(paged), nhdr::hdr_get_memory_size(copy));
+			nhdr::hdr_close(copy);
+
+			// A shift moves the counts to other pages
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(dense, 2));
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(paged, 2));
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(dense, 50.0), nhdr::hdr_value_at_percentile(paged, 50.0));
+			CHECK_EQUAL(nhdr::hdr_count_at_value(dense, 4 * 3007), nhdr::hdr_count_at_value(paged, 4 * 3007));
+
+			nhdr::hdr_reset(paged);
+			CHECK_EQUAL(0, paged->total_count);
+			for (s32 i = 0; i < paged->counts_len; ++i)
+				CHECK_EQUAL(0, nhdr::hdr_count_at_index(paged, i));
+			CHECK_TRUE(nhdr::hdr_record_value(paged, 1234));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(paged, 1234));
+
+			nhdr::hdr_close(paged);
+			nhdr::hdr_close(dense);
+
+			// Resizing moves the pages
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 10000, 3, context_t::system_alloc(), nhdr::HDR_COUNTS_PAGED | nhdr::HDR_AUTO_RESIZE, &paged));
+			CHECK_TRUE(nhdr::hdr_record_values(paged, 5000, 3));
+			CHECK_TRUE(nhdr::hdr_record_value(paged, 1000000));
+			CHECK_EQUAL(3, nhdr::hdr_count_at_value(paged, 5000));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(paged, 1000000));
+			nhdr::hdr_close(paged);
+		}
+
+		UNITTEST_TEST(percentiles_write)
+		{
+			const u32 capacity  = 64 * 1024;
+			char*     expected  = (char*)context_t::system_alloc()->allocate(capacity);
+			char*     buffer    = (char*)context_t::system_alloc()->allocate(capacity);
+			char*     collected = (char*)context_t::system_alloc()->allocate(capacity);
+
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &h));
+			nhdr::hdr_writer w;
+
+			// Empty, only the 100% line
+			nhdr::hdr_writer_init_buffer(&w, buffer, capacity);
+			CHECK_EQUAL(0, nhdr::hdr_percentiles_write(h, &w, 5, 1.0, nhdr::CSV));
+			CHECK_EQUAL(print_percentiles_reference(h, expected, capacity, 5, 1.0, true), w.length);
+			CHECK_EQUAL(0, memcmp(expected, buffer, w.length));
+
+			u64 x = 4242;
+			for (s32 i = 0; i < 20000; ++i)
+			{
+				x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+				nhdr::hdr_record_value(h, (s64)((x >> 33) % 10000000));
+			}
+			nhdr::hdr_record_values(h, 12345678, 3);
+
+			// Same text as printf, for both the lines and the footer
+			for (s32 csv = 0; csv < 2; ++csv)
+			{
+				for (s32 ticks = 1; ticks <= 10; ticks += 3)
+				{
+					const f64 value_scale = csv ? 1.0 : 1000.0;
+					nhdr::hdr_writer_init_buffer(&w, buffer, capacity);
+					CHECK_EQUAL(0, nhdr::hdr_percentiles_write(h, &w, ticks, value_scale, csv ? nhdr::CSV : nhdr::CLASSIC));
+					const u32 length = print_percentiles_reference(h, expected, capacity, ticks, value_scale, 0 != csv);
+					CHECK_EQUAL(length, w.length);
+					CHECK_EQUAL(0, memcmp(expected, buffer, length));
+				}
+			}
+
+			// JSON holds the same lines, with the summary after them
+			nhdr::hdr_writer_init_buffer(&w, buffer, capacity);
+			CHECK_EQUAL(0, nhdr::hdr_percentiles_write(h, &w, 5, 1.0, nhdr::JSON));
+			buffer[w.length] = 0;
+			CHECK_EQUAL(0, strncmp(buffer, "{\"percentiles\":[\n{\"value\":", 26));
+			CHECK_TRUE(nullptr != strstr(buffer, "{\"value\":12353535.000,\"percentile\":1.000000,\"total_count\":20003}\n],\"mean\":"));
+			CHECK_TRUE(nullptr != strstr(buffer, ",\"total_count\":20003,\"buckets\":"));
+			CHECK_EQUAL(0, strcmp(buffer + w.length - 2, "}\n"));
+
+			// A small buffer drained into a sink gives the same output
+			char             small[48];
+			nhdr::hdr_writer target;
+			nhdr::hdr_writer_init_buffer(&target, collected, capacity);
+			nhdr::hdr_writer_init_sink(&w, small, sizeof(small), append_sink, &target);
+			CHECK_EQUAL(0, nhdr::hdr_percentiles_write(h, &w, 5, 1.0, nhdr::CLASSIC));
+			CHECK_EQUAL(print_percentiles_reference(h, expected, capacity, 5, 1.0, false), target.length);
+			CHECK_EQUAL(0, memcmp(expected, collected, target.length));
+			CHECK_EQUAL(target.length, w.written);
+
+			// Without a sink the output is cut off at the end of the buffer
+			nhdr::hdr_writer_init_buffer(&w, buffer, 100);
+			CHECK_EQUAL(-2, nhdr::hdr_percentiles_write(h, &w, 5, 1.0, nhdr::CLASSIC));
+			CHECK_EQUAL(100, w.length);
+			CHECK_EQUAL(0, memcmp(expected, buffer, 100));
+
+			// A sum beyond 64 bits, the deviation is taken from a second pass over the buckets
+			nhdr::hdr_histogram* wide = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 0x7FFFFFFFFFFFFFFFLL, 5, &wide));
+			const s64 low  = 4000000000000000000LL;
+			const s64 high = nhdr::hdr_next_non_equivalent_value(wide, low);
+			nhdr::hdr_record_values(wide, low, 1000000000);
+			nhdr::hdr_record_value(wide, high);
+			nhdr::hdr_writer_init_buffer(&w, buffer, capacity - 1);
+			CHECK_EQUAL(0, nhdr::hdr_percentiles_write(wide, &w, 5, 1.0, nhdr::CLASSIC));
+			buffer[w.length]       = 0;
+			const char* deviation  = strstr(buffer, "StdDeviation   =");
+			const f64   p          = 1.0 / 1000000001.0;
+			const f64   stddev     = (f64)(nhdr::hdr_median_equivalent_value(wide, high) - nhdr::hdr_median_equivalent_value(wide, low)) * sqrt(p * (1.0 - p));
+			CHECK_TRUE(nullptr != deviation);
+			CHECK_TRUE(fabs(strtod(deviation + 16, nullptr) - stddev) < 1.0);
+			nhdr::hdr_close(wide);
+
+			nhdr::hdr_close(h);
+			context_t::system_alloc()->deallocate(collected);
+			context_t::system_alloc()->deallocate(buffer);
+			context_t::system_alloc()->deallocate(expected);
+		}
+
+		UNITTEST_TEST(record_atomic_multi_threaded)
+		{
+			nhdr::hdr_histogram* hp = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &hp));
+			nhdr::hdr_histogram& h = *hp;
+
+			const s32 num_threads = 8;
+			const s32 num_values  = 100000;
+
+			std::thread threads[num_threads];
+			for (s32 t = 0; t < num_threads; ++t)
+			{
+				threads[t] = std::thread([&h, t]() {
+					for (s32 i = 0; i < num_values; ++i)
+					{
+						nhdr::hdr_record_value_atomic(&h, 1 + ((i + t * 7919) % num_values));
+					}
+				});
+			}
+			for (s32 t = 0; t < num_threads; ++t)
+				threads[t].join();
+
+			CHECK_EQUAL((s64)num_threads * num_values, h.total_count);
+
+			s64 sum = 0;
+			for (s32 i = 0; i < h.counts_len; ++i)
+				sum += h.counts[i];
+			CHECK_EQUAL(h.total_count, sum);
+			CHECK_EQUAL(1, nhdr::hdr_min(&h));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(&h, num_values, nhdr::hdr_max(&h)));
+
+			nhdr::hdr_close(hp);
+		}
 	}
 }
 UNITTEST_SUITE_END
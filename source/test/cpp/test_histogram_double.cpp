@@ -0,0 +1,115 @@
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+#include "cunittest/cunittest.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_double.h"
+
+#include <math.h>
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(test_histogram_double)
+{
+	UNITTEST_FIXTURE(main)
+	{
+		UNITTEST_FIXTURE_SETUP()
+		{
+		}
+
+		UNITTEST_FIXTURE_TEARDOWN()
+		{
+		}
+
+		UNITTEST_TEST(init)
+		{
+			nhdr::hdr_dbl_histogram* h = nullptr;
+			CHECK_EQUAL(-1, nhdr::hdr_dbl_init(1, 3, &h));
+			CHECK_EQUAL(-1, nhdr::hdr_dbl_init(1000, 6, &h));
+			CHECK_EQUAL(-1, nhdr::hdr_dbl_init(1LL << 50, 5, &h));
+			CHECK_EQUAL(0, nhdr::hdr_dbl_init(1000000, 3, &h));
+			CHECK_EQUAL(0, h->values->total_count);
+			nhdr::hdr_dbl_close(h);
+		}
+
+		UNITTEST_TEST(record_auto_ranging)
+		{
+			nhdr::hdr_dbl_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_dbl_init(1000000, 3, &h));
+
+			CHECK_FALSE(nhdr::hdr_dbl_record_value(h, -1.0));
+			CHECK_TRUE(nhdr::hdr_dbl_record_value(h, 0.0));
+			CHECK_TRUE(nhdr::hdr_dbl_record_value(h, 0.25));
+			CHECK_TRUE(nhdr::hdr_dbl_record_value(h, 1.5));
+			CHECK_TRUE(nhdr::hdr_dbl_record_value(h, 1500.0));
+			CHECK_TRUE(nhdr::hdr_dbl_record_value(h, 0.003));
+			CHECK_EQUAL(5, h->values->total_count);
+			CHECK_TRUE(h->current_lowest_value <= 0.003);
+			CHECK_TRUE(h->current_highest_value_limit > 1500.0);
+
+			// Beyond the dynamic range of the values already recorded
+			CHECK_FALSE(nhdr::hdr_dbl_record_value(h, 1.0e12));
+			CHECK_FALSE(nhdr::hdr_dbl_record_value(h, 1.0e-9));
+
+			CHECK_EQUAL(1, nhdr::hdr_dbl_count_at_value(h, 0.0));
+			CHECK_EQUAL(1, nhdr::hdr_dbl_count_at_value(h, 0.25));
+			CHECK_EQUAL(1, nhdr::hdr_dbl_count_at_value(h, 1500.0));
+			CHECK_EQUAL(0.0, nhdr::hdr_dbl_min(h));
+			CHECK_TRUE(nhdr::hdr_dbl_values_are_equivalent(h, 1500.0, nhdr::hdr_dbl_max(h)));
+			CHECK_TRUE(nhdr::hdr_dbl_values_are_equivalent(h, 0.25, nhdr::hdr_dbl_value_at_percentile(h, 50.0)));
+			CHECK_TRUE(nhdr::hdr_dbl_values_are_equivalent(h, 1500.0, nhdr::hdr_dbl_value_at_percentile(h, 100.0)));
+
+			const f64 mean = (0.0 + 0.25 + 1.5 + 1500.0 + 0.003) / 5;
+			CHECK_TRUE(fabs(nhdr::hdr_dbl_mean(h) - mean) < mean * 0.001);
+
+			nhdr::hdr_dbl_close(h);
+		}
+
+		UNITTEST_TEST(iterate_and_add)
+		{
+			nhdr::hdr_dbl_histogram* h    = nullptr;
+			nhdr::hdr_dbl_histogram* from = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_dbl_init(100000, 3, &h));
+			CHECK_EQUAL(0, nhdr::hdr_dbl_init(100000, 3, &from));
+
+			for (s32 i = 1; i <= 1000; ++i)
+			{
+				CHECK_TRUE(nhdr::hdr_dbl_record_value(h, i * 0.01));
+				CHECK_TRUE(nhdr::hdr_dbl_record_value(from, i * 0.1));
+			}
+
+			nhdr::hdr_dbl_iter iter;
+			nhdr::hdr_dbl_iter_recorded_init(&iter, h);
+			f64 previous = 0.0;
+			s64 total    = 0;
+			while (nhdr::hdr_dbl_iter_next(&iter))
+			{
+				CHECK_TRUE(iter.value > previous);
+				CHECK_TRUE(iter.value <= 10.0);
+				previous = iter.value;
+				total += iter.count;
+			}
+			CHECK_EQUAL(1000, total);
+
+			nhdr::hdr_dbl_iter_linear_init(&iter, h, 1.0);
+			s32 steps = 0;
+			while (nhdr::hdr_dbl_iter_next(&iter))
+				steps++;
+			CHECK_EQUAL(10, steps);
+
+			CHECK_EQUAL(0, nhdr::hdr_dbl_add(h, from));
+			CHECK_EQUAL(2000, h->values->total_count);
+			CHECK_TRUE(nhdr::hdr_dbl_values_are_equivalent(h, 100.0, nhdr::hdr_dbl_max(h)));
+			CHECK_TRUE(nhdr::hdr_dbl_values_are_equivalent(h, 0.01, nhdr::hdr_dbl_min(h)));
+
+			nhdr::hdr_dbl_reset(h);
+			CHECK_EQUAL(0, h->values->total_count);
+			CHECK_TRUE(nhdr::hdr_dbl_record_value(h, 1.0e9));
+			CHECK_TRUE(nhdr::hdr_dbl_values_are_equivalent(h, 1.0e9, nhdr::hdr_dbl_value_at_percentile(h, 50.0)));
+
+			nhdr::hdr_dbl_close(from);
+			nhdr::hdr_dbl_close(h);
+		}
+	}
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,246 @@
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+#include "cunittest/cunittest.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_encoding.h"
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(test_histogram_encoding)
+{
+	UNITTEST_FIXTURE(main)
+	{
+		UNITTEST_FIXTURE_SETUP()
+		{
+		}
+
+		UNITTEST_FIXTURE_TEARDOWN()
+		{
+		}
+
+		UNITTEST_TEST(encode_empty)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &h));
+
+			u8  buffer[64];
+			u64 size = 0;
+			CHECK_EQUAL(40, (s32)nhdr::hdr_encode_size_bound(h));
+			CHECK_EQUAL(0, nhdr::hdr_encode(h, buffer, sizeof(buffer), &size));
+			CHECK_EQUAL(40, (s32)size);
+			CHECK_EQUAL(0x1c, buffer[0]);
+			CHECK_EQUAL(0x84, buffer[1]);
+			CHECK_EQUAL(0x93, buffer[2]);
+			CHECK_EQUAL(0x13, buffer[3]);
+			CHECK_EQUAL(3, buffer[15]);
+
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_decode_config(buffer, size, &cfg));
+			CHECK_EQUAL(h->counts_len, cfg.counts_len);
+			CHECK_NOT_EQUAL(0, nhdr::hdr_decode_config(buffer, 39, &cfg));
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(encode_payload_words)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000, 1, &h));
+
+			// index 0 holds 1, then a run of 2 zeros, then index 3 holds 64
+			nhdr::hdr_record_values(h, 0, 1);
+			nhdr::hdr_record_values(h, 3, 64);
+
+			u8  buffer[64];
+			u64 size = 0;
+			CHECK_EQUAL(0, nhdr::hdr_encode(h, buffer, sizeof(buffer), &size));
+			CHECK_EQUAL(44, (s32)size);
+			CHECK_EQUAL(4, buffer[7]);
+			CHECK_EQUAL(0x02, buffer[40]); // 1
+			CHECK_EQUAL(0x03, buffer[41]); // -2
+			CHECK_EQUAL(0x80, buffer[42]); // 64
+			CHECK_EQUAL(0x01, buffer[43]);
+
+			// A buffer of exactly the bound is large enough
+			nhdr::hdr_reset(h);
+			nhdr::hdr_record_value(h, 0);
+			CHECK_EQUAL(49, (s32)nhdr::hdr_encode_size_bound(h));
+			CHECK_EQUAL(0, nhdr::hdr_encode(h, buffer, 49, &size));
+			CHECK_EQUAL(41, (s32)size);
+
+			nhdr::hdr_reset(h);
+			nhdr::hdr_record_values(h, 0, 1);
+			nhdr::hdr_record_values(h, 3, 64);
+			const u64 bound = nhdr::hdr_encode_size_bound(h);
+			CHECK_EQUAL(0, nhdr::hdr_encode(h, buffer, bound, &size));
+			CHECK_EQUAL(44, (s32)size);
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(decode_rejects_bad_runs)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000, 1, &h));
+			nhdr::hdr_record_values(h, 0, 1);
+
+			u8  buffer[64];
+			u64 size = 0;
+			CHECK_EQUAL(0, nhdr::hdr_encode(h, buffer, sizeof(buffer), &size));
+
+			// Replace the payload by a run of INT64_MIN empty indices, zig zag encoded as all ones
+			for (s32 i = 0; i < 9; ++i)
+				buffer[40 + i] = 0xFF;
+			buffer[7] = 9;
+			CHECK_EQUAL(-1, nhdr::hdr_decode(h, buffer, 49));
+
+			// A run past the end of the counts
+			buffer[40] = 0xCF; // -1000
+			buffer[41] = 0x0F;
+			buffer[7]  = 2;
+			CHECK_EQUAL(-1, nhdr::hdr_decode(h, buffer, 42));
+			CHECK_EQUAL(1, h->total_count);
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(decode_java_layout)
+		{
+			// Laid out the way the Java encoder writes it: the cookie with the word size bits set,
+			// a non-zero normalizing index offset (the sender's storage, the payload is logical),
+			// a single empty index written as a 0 word and longer runs as -N
+			const u8 buffer[] = {
+			  0x1c, 0x84, 0x93, 0x13,                         // cookie
+			  0x00, 0x00, 0x00, 0x07,                         // payload length
+			  0x00, 0x00, 0x00, 0x05,                         // normalizing index offset
+			  0x00, 0x00, 0x00, 0x03,                         // significant figures
+			  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, // lowest discernible value
+			  0x00, 0x00, 0x00, 0x00, 0xd6, 0x93, 0xa4, 0x00, // highest trackable value, 3600000000
+			  0x3f, 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // conversion ratio, 1.0
+			  0x00,                                           // index 0 is empty
+			  0x06,                                           // index 1 holds 3
+			  0xc3, 0x01,                                     // 98 empty indices
+			  0x04,                                           // index 100 holds 2
+			  0x00,                                           // index 101 is empty
+			  0x02,                                           // index 102 holds 1
+			};
+
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_decode_config(buffer, sizeof(buffer), &cfg));
+			CHECK_EQUAL(3600000000LL, cfg.highest_trackable_value);
+
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &h));
+			CHECK_EQUAL(0, nhdr::hdr_decode(h, buffer, sizeof(buffer)));
+			CHECK_EQUAL(6, h->total_count);
+			CHECK_EQUAL(3, nhdr::hdr_count_at_value(h, 1));
+			CHECK_EQUAL(2, nhdr::hdr_count_at_value(h, 100));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(h, 102));
+			CHECK_EQUAL(1, nhdr::hdr_min(h));
+			CHECK_EQUAL(102, nhdr::hdr_max(h));
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(decode_leaves_histogram_on_error)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &h));
+			nhdr::hdr_record_values(h, 5, 1);
+			nhdr::hdr_record_values(h, 100, 2);
+			nhdr::hdr_record_values(h, 100000, 3);
+
+			u8  buffer[128];
+			u64 size = 0;
+			CHECK_EQUAL(0, nhdr::hdr_encode(h, buffer, sizeof(buffer), &size));
+
+			nhdr::hdr_histogram* target = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &target));
+			nhdr::hdr_record_values(target, 7, 4);
+
+			// The last word is cut off after the first counts were read
+			buffer[size - 1] |= 0x80;
+			CHECK_EQUAL(-1, nhdr::hdr_decode(target, buffer, size));
+			CHECK_EQUAL(4, target->total_count);
+			CHECK_EQUAL(0, nhdr::hdr_count_at_value(target, 5));
+			CHECK_EQUAL(7, nhdr::hdr_max(target));
+			buffer[size - 1] &= 0x7F;
+
+			// A value above the range of the target
+			nhdr::hdr_histogram* narrow = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000, 3, &narrow));
+			CHECK_EQUAL(-1, nhdr::hdr_decode(narrow, buffer, size));
+			CHECK_EQUAL(0, narrow->total_count);
+
+			CHECK_EQUAL(0, nhdr::hdr_decode(target, buffer, size));
+			CHECK_EQUAL(10, target->total_count);
+
+			nhdr::hdr_close(narrow);
+			nhdr::hdr_close(target);
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(encode_rejects_negative_counts)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000, 3, &h));
+			nhdr::hdr_record_values(h, 10, 5);
+			nhdr::hdr_record_values(h, 20, -2);
+			nhdr::hdr_record_values(h, 30, 1);
+
+			u8  buffer[128];
+			u64 size = 0;
+			CHECK_EQUAL(-1, nhdr::hdr_encode(h, buffer, sizeof(buffer), &size));
+
+			nhdr::hdr_record_values(h, 20, 2);
+			CHECK_EQUAL(0, nhdr::hdr_encode(h, buffer, sizeof(buffer), &size));
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(encode_decode_round_trip)
+		{
+			nhdr::hdr_histogram* h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &h));
+
+			u64 x = 77;
+			for (s32 i = 0; i < 10000; ++i)
+			{
+				x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+				nhdr::hdr_record_values(h, (s64)((x >> 33) % 100000000), 1 + (i % 3));
+			}
+			nhdr::hdr_record_values(h, 3000000000LL, 1LL << 40);
+
+			alloc_t*  allocator = context_t::system_alloc();
+			const u64 bound     = nhdr::hdr_encode_size_bound(h);
+			u8*       buffer    = (u8*)allocator->allocate((u32)bound, 8);
+
+			u64 size = 0;
+			CHECK_NOT_EQUAL(0, nhdr::hdr_encode(h, buffer, 100, &size));
+			CHECK_EQUAL(0, nhdr::hdr_encode(h, buffer, bound, &size));
+			CHECK_TRUE(size <= bound);
+
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_decode_config(buffer, size, &cfg));
+
+			nhdr::hdr_histogram* decoded = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(cfg.lowest_discernible_value, cfg.highest_trackable_value, (s32)cfg.significant_figures, &decoded));
+			CHECK_EQUAL(0, nhdr::hdr_decode(decoded, buffer, size));
+
+			CHECK_EQUAL(h->total_count, decoded->total_count);
+			CHECK_EQUAL(nhdr::hdr_min(h), nhdr::hdr_min(decoded));
+			CHECK_EQUAL(nhdr::hdr_max(h), nhdr::hdr_max(decoded));
+			for (s32 i = 0; i < h->counts_len; ++i)
+				CHECK_EQUAL(nhdr::hdr_count_at_index(h, i), nhdr::hdr_count_at_index(decoded, i));
+
+			// Truncated payloads are rejected
+			CHECK_NOT_EQUAL(0, nhdr::hdr_decode(decoded, buffer, size - 1));
+
+			allocator->deallocate(buffer);
+			nhdr::hdr_close(decoded);
+			nhdr::hdr_close(h);
+		}
+	}
+}
+UNITTEST_SUITE_END
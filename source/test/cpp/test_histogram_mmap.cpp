@@ -0,0 +1,201 @@
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+#include "cunittest/cunittest.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_mmap.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(test_histogram_mmap)
+{
+	UNITTEST_FIXTURE(main)
+	{
+		static const char* path = "test_histogram_mmap.hdr";
+
+		UNITTEST_FIXTURE_SETUP()
+		{
+		}
+
+		UNITTEST_FIXTURE_TEARDOWN()
+		{
+		}
+
+		UNITTEST_TEST(reopen_keeps_counts)
+		{
+			::remove(path);
+			nhdr::hdr_mmap_histogram m;
+			CHECK_EQUAL(-1, nhdr::hdr_mmap_open(&m, path, 1, 3600000000LL, 3, nhdr::HDR_AUTO_RESIZE));
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open(&m, path, 1, 3600000000LL, 3, nhdr::HDR_PERCENTILE_INDEX));
+			for (s32 i = 1; i <= 1000; ++i)
+				CHECK_TRUE(nhdr::hdr_record_value(m.h, i * 1000));
+			const s64 p99 = nhdr::hdr_value_at_percentile(m.h, 99.0);
+			CHECK_EQUAL(0, nhdr::hdr_mmap_sync(&m));
+			nhdr::hdr_mmap_close(&m);
+
+			// A different configuration does not match the file
+			CHECK_EQUAL(-1, nhdr::hdr_mmap_open(&m, path, 1, 3600000000LL, 2, nhdr::HDR_PERCENTILE_INDEX));
+			CHECK_EQUAL(-1, nhdr::hdr_mmap_open(&m, path, 1, 3600000000LL, 3, 0));
+
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open(&m, path, 1, 3600000000LL, 3, nhdr::HDR_PERCENTILE_INDEX));
+			CHECK_EQUAL(1000, m.h->total_count);
+			CHECK_EQUAL(p99, nhdr::hdr_value_at_percentile(m.h, 99.0));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(m.h, 500000));
+			CHECK_TRUE(nhdr::hdr_record_value(m.h, 5));
+			CHECK_EQUAL(5, nhdr::hdr_min(m.h));
+			nhdr::hdr_mmap_close(&m);
+			::remove(path);
+		}
+
+		UNITTEST_TEST(read_only_sees_live_counts)
+		{
+			::remove(path);
+			nhdr::hdr_mmap_histogram writer;
+			nhdr::hdr_mmap_histogram reader;
+			CHECK_EQUAL(-3, nhdr::hdr_mmap_open_read_only(&reader, path));
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open(&writer, path, 1, 1000000, 3, 0));
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open_read_only(&reader, path));
+
+			nhdr::hdr_record_values(writer.h, 1234, 7);
+			CHECK_EQUAL(7, nhdr::hdr_count_at_value(reader.h, 1234));
+			CHECK_EQUAL(0, reader.h->total_count);
+			nhdr::hdr_mmap_refresh(&reader);
+			CHECK_EQUAL(7, reader.h->total_count);
+			CHECK_EQUAL(1234, nhdr::hdr_min(reader.h));
+
+			nhdr::hdr_mmap_close(&reader);
+			nhdr::hdr_mmap_close(&writer);
+			::remove(path);
+		}
+
+		UNITTEST_TEST(recover_after_crash)
+		{
+			::remove(path);
+			nhdr::hdr_mmap_histogram crashed;
+			nhdr::hdr_mmap_histogram restarted;
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open(&crashed, path, 1, 1000000, 3, 0));
+			nhdr::hdr_record_values(crashed.h, 100, 3);
+			nhdr::hdr_record_values(crashed.h, 200, 4);
+
+			// A writer that died half way through a record, without closing the file
+			crashed.h->total_count = 5;
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open(&restarted, path, 1, 1000000, 3, 0));
+			CHECK_EQUAL(7, restarted.h->total_count);
+			CHECK_EQUAL(100, nhdr::hdr_min(restarted.h));
+			CHECK_EQUAL(200, nhdr::hdr_max(restarted.h));
+
+			nhdr::hdr_mmap_close(&restarted);
+			nhdr::hdr_mmap_close(&crashed);
+			::remove(path);
+		}
+
+		UNITTEST_TEST(shared_snapshot)
+		{
+			static const char* name = "/test_histogram_mmap";
+			nhdr::hdr_mmap_unlink_shared(name);
+
+			// Two mappings of the segment, as two processes would have
+			nhdr::hdr_mmap_histogram worker;
+			nhdr::hdr_mmap_histogram exporter;
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open_shared(&worker, name, 1, 1000000, 3, 0));
+			CHECK_EQUAL(-1, nhdr::hdr_mmap_open_shared(&exporter, name, 1, 1000000, 2, 0));
+			CHECK_EQUAL(-1, nhdr::hdr_mmap_open_shared(&exporter, name, 1, 1000000, 3, nhdr::HDR_RUNNING_SUMS));
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open_shared(&exporter, name, 1, 1000000, 3, 0));
+			CHECK_TRUE(worker.base != exporter.base);
+
+			for (s32 i = 1; i <= 100; ++i)
+			{
+				CHECK_TRUE(nhdr::hdr_mmap_record_value(&worker, i * 10));
+				CHECK_TRUE(nhdr::hdr_mmap_record_value(&exporter, i * 10));
+			}
+
+			nhdr::hdr_histogram* snapshot = nullptr;
+			nhdr::hdr_histogram* other    = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000000, 3, &snapshot));
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000000, 2, &other));
+			CHECK_EQUAL(-1, nhdr::hdr_mmap_snapshot(&exporter, other, 10));
+			CHECK_EQUAL(0, nhdr::hdr_mmap_snapshot(&exporter, snapshot, 10));
+			CHECK_EQUAL(200, snapshot->total_count);
+			CHECK_EQUAL(10, nhdr::hdr_min(snapshot));
+			CHECK_EQUAL(1000, nhdr::hdr_max(snapshot));
+			CHECK_EQUAL(2, nhdr::hdr_count_at_value(snapshot, 500));
+
+			// Taking another snapshot starts from scratch
+			nhdr::hdr_mmap_record_value(&worker, 5000);
+			CHECK_EQUAL(0, nhdr::hdr_mmap_snapshot(&exporter, snapshot, 10));
+			CHECK_EQUAL(201, snapshot->total_count);
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(snapshot, 5000, nhdr::hdr_max(snapshot)));
+
+			// A writer that died after adding its count never published it, it doesn't block
+			CHECK_TRUE(nhdr::hdr_record_value_atomic(worker.h, 70));
+			CHECK_EQUAL(0, nhdr::hdr_mmap_snapshot(&exporter, snapshot, 1));
+			CHECK_EQUAL(202, snapshot->total_count);
+
+			nhdr::hdr_close(other);
+			nhdr::hdr_close(snapshot);
+			nhdr::hdr_mmap_close(&exporter);
+			nhdr::hdr_mmap_close(&worker);
+			CHECK_EQUAL(0, nhdr::hdr_mmap_unlink_shared(name));
+		}
+
+		UNITTEST_TEST(shared_snapshot_while_recording)
+		{
+			static const char* name = "/test_histogram_mmap_busy";
+			nhdr::hdr_mmap_unlink_shared(name);
+
+			nhdr::hdr_mmap_histogram exporter;
+			CHECK_EQUAL(0, nhdr::hdr_mmap_open_shared(&exporter, name, 1, 1000000, 3, 0));
+
+			const s32                num_threads = 4;
+			nhdr::hdr_mmap_histogram workers[num_threads];
+			std::thread              threads[num_threads];
+			std::atomic<bool>        stop(false);
+			for (s32 t = 0; t < num_threads; ++t)
+			{
+				CHECK_EQUAL(0, nhdr::hdr_mmap_open_shared(&workers[t], name, 1, 1000000, 3, 0));
+				nhdr::hdr_mmap_histogram* worker = &workers[t];
+				threads[t] = std::thread([worker, &stop, t]() {
+					for (s64 i = 0; !stop; ++i)
+					{
+						nhdr::hdr_mmap_record_value(worker, 1 + ((i * 7919 + t) % 5000));
+					}
+				});
+			}
+
+			// Every snapshot succeeds and sees at least what the one before it saw
+			nhdr::hdr_histogram* snapshot = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000000, 3, &snapshot));
+			s64 previous = 0;
+			s32 failed   = 0;
+			for (s32 i = 0; i < 200; ++i)
+			{
+				if (0 != nhdr::hdr_mmap_snapshot(&exporter, snapshot, 1000))
+				{
+					failed++;
+					continue;
+				}
+				CHECK_TRUE(snapshot->total_count >= previous);
+				previous = snapshot->total_count;
+			}
+			stop = true;
+			for (s32 t = 0; t < num_threads; ++t)
+				threads[t].join();
+			CHECK_EQUAL(0, failed);
+
+			CHECK_EQUAL(0, nhdr::hdr_mmap_snapshot(&exporter, snapshot, 1));
+			CHECK_TRUE(snapshot->total_count >= previous);
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(snapshot, 5000, nhdr::hdr_max(snapshot)));
+
+			nhdr::hdr_close(snapshot);
+			for (s32 t = 0; t < num_threads; ++t)
+				nhdr::hdr_mmap_close(&workers[t]);
+			nhdr::hdr_mmap_close(&exporter);
+			CHECK_EQUAL(0, nhdr::hdr_mmap_unlink_shared(name));
+		}
+	}
+}
+UNITTEST_SUITE_END
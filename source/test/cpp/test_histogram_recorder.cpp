@@ -0,0 +1,89 @@
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+#include "cunittest/cunittest.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_recorder.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(test_histogram_recorder)
+{
+	UNITTEST_FIXTURE(main)
+	{
+		UNITTEST_FIXTURE_SETUP()
+		{
+		}
+
+		UNITTEST_FIXTURE_TEARDOWN()
+		{
+		}
+
+		UNITTEST_TEST(sample_single_writer)
+		{
+			nhdr::hdr_interval_recorder r;
+			CHECK_EQUAL(0, nhdr::hdr_interval_recorder_init(&r, 1, 1000000, 3, context_t::system_alloc()));
+
+			CHECK_TRUE(nhdr::hdr_interval_recorder_record_value(&r, 100));
+			CHECK_TRUE(nhdr::hdr_interval_recorder_record_values(&r, 200, 4));
+
+			nhdr::hdr_histogram* interval = nhdr::hdr_interval_recorder_sample(&r);
+			CHECK_EQUAL(5, interval->total_count);
+			CHECK_EQUAL(4, nhdr::hdr_count_at_value(interval, 200));
+
+			CHECK_TRUE(nhdr::hdr_interval_recorder_record_value(&r, 300));
+			interval = nhdr::hdr_interval_recorder_sample(&r);
+			CHECK_EQUAL(1, interval->total_count);
+			CHECK_EQUAL(300, nhdr::hdr_min(interval));
+
+			interval = nhdr::hdr_interval_recorder_sample(&r);
+			CHECK_EQUAL(0, interval->total_count);
+
+			nhdr::hdr_interval_recorder_destroy(&r);
+		}
+
+		UNITTEST_TEST(sample_concurrent_writers)
+		{
+			nhdr::hdr_interval_recorder r;
+			CHECK_EQUAL(0, nhdr::hdr_interval_recorder_init(&r, 1, 1000000, 3, context_t::system_alloc()));
+
+			nhdr::hdr_histogram* total = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 1000000, 3, &total));
+
+			const s32        num_writers = 4;
+			const s32        num_values  = 200000;
+			std::atomic<s32> running(num_writers);
+
+			std::thread writers[num_writers];
+			for (s32 t = 0; t < num_writers; ++t)
+			{
+				writers[t] = std::thread([&r, &running, t]() {
+					for (s32 i = 0; i < num_values; ++i)
+						nhdr::hdr_interval_recorder_record_value_atomic(&r, 1 + ((i + t) % 1000));
+					running--;
+				});
+			}
+
+			s32 samples = 0;
+			while (running > 0)
+			{
+				nhdr::hdr_add(total, nhdr::hdr_interval_recorder_sample(&r));
+				samples++;
+			}
+			for (s32 t = 0; t < num_writers; ++t)
+				writers[t].join();
+			nhdr::hdr_add(total, nhdr::hdr_interval_recorder_sample(&r));
+
+			CHECK_TRUE(samples > 0);
+			CHECK_EQUAL((s64)num_writers * num_values, total->total_count);
+			CHECK_EQUAL(1, nhdr::hdr_min(total));
+
+			nhdr::hdr_close(total);
+			nhdr::hdr_interval_recorder_destroy(&r);
+		}
+	}
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,97 @@
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+#include "cunittest/cunittest.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_sharded.h"
+
+#include <thread>
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(test_histogram_sharded)
+{
+	UNITTEST_FIXTURE(main)
+	{
+		UNITTEST_FIXTURE_SETUP()
+		{
+		}
+
+		UNITTEST_FIXTURE_TEARDOWN()
+		{
+		}
+
+		UNITTEST_TEST(shards_do_not_share_cache_lines)
+		{
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 1000000, 3, &cfg));
+
+			nhdr::hdr_sharded_histogram s;
+			CHECK_EQUAL(-1, nhdr::hdr_sharded_init(&s, &cfg, 0, context_t::system_alloc()));
+			CHECK_EQUAL(-1, nhdr::hdr_sharded_init(&s, &cfg, 257, context_t::system_alloc()));
+
+			// 256 shards of the widest configuration need more than the 4 GiB an allocation can hold
+			nhdr::hdr_histogram_bucket_config wide;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 0x7FFFFFFFFFFFFFFFLL, 5, &wide));
+			CHECK_EQUAL(-2, nhdr::hdr_sharded_init(&s, &wide, 256, context_t::system_alloc()));
+			CHECK_EQUAL(0, nhdr::hdr_sharded_init(&s, &cfg, 3, context_t::system_alloc()));
+
+			const u64 shard_size = nhdr::hdr_get_preallocated_size(&cfg);
+			for (s32 i = 0; i < s.shard_count; ++i)
+			{
+				CHECK_EQUAL(0, (s32)((u64)s.shards[i] & 63));
+				if (i > 0)
+					CHECK_TRUE((u64)((u8*)s.shards[i] - (u8*)s.shards[i - 1]) >= shard_size);
+			}
+
+			CHECK_FALSE(nhdr::hdr_sharded_record_value(&s, 3, 100));
+			CHECK_FALSE(nhdr::hdr_sharded_record_value(&s, -1, 100));
+			CHECK_TRUE(nhdr::hdr_sharded_record_value(&s, 2, 100));
+			CHECK_EQUAL(1, nhdr::hdr_sharded_total_count(&s));
+
+			nhdr::hdr_sharded_reset(&s);
+			CHECK_EQUAL(0, nhdr::hdr_sharded_total_count(&s));
+
+			nhdr::hdr_sharded_destroy(&s);
+		}
+
+		UNITTEST_TEST(queries_match_merged_histogram)
+		{
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 3600000000LL, 3, &cfg));
+
+			const s32                  num_shards = 4;
+			nhdr::hdr_sharded_histogram s;
+			CHECK_EQUAL(0, nhdr::hdr_sharded_init(&s, &cfg, num_shards, context_t::system_alloc()));
+
+			std::thread writers[num_shards];
+			for (s32 t = 0; t < num_shards; ++t)
+			{
+				writers[t] = std::thread([&s, t]() {
+					for (s32 i = 0; i < 100000; ++i)
+						nhdr::hdr_sharded_record_value(&s, t, 1 + ((s64)i * (t + 1) * 7919) % 10000000);
+				});
+			}
+			for (s32 t = 0; t < num_shards; ++t)
+				writers[t].join();
+
+			nhdr::hdr_histogram* merged = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &merged));
+			CHECK_EQUAL(0, nhdr::hdr_sharded_merge(&s, merged));
+
+			CHECK_EQUAL(merged->total_count, nhdr::hdr_sharded_total_count(&s));
+			CHECK_EQUAL(nhdr::hdr_min(merged), nhdr::hdr_sharded_min(&s));
+			CHECK_EQUAL(nhdr::hdr_max(merged), nhdr::hdr_sharded_max(&s));
+			CHECK_EQUAL(nhdr::hdr_mean(merged), nhdr::hdr_sharded_mean(&s));
+			CHECK_TRUE(nhdr::hdr_stddev(merged) - nhdr::hdr_sharded_stddev(&s) < 0.001 && nhdr::hdr_sharded_stddev(&s) - nhdr::hdr_stddev(merged) < 0.001);
+
+			const f64 percentiles[] = {0.0, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 100.0};
+			for (s32 i = 0; i < 8; ++i)
+				CHECK_EQUAL(nhdr::hdr_value_at_percentile(merged, percentiles[i]), nhdr::hdr_sharded_value_at_percentile(&s, percentiles[i]));
+
+			nhdr::hdr_close(merged);
+			nhdr::hdr_sharded_destroy(&s);
+		}
+	}
+}
+UNITTEST_SUITE_END
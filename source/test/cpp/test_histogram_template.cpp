@@ -0,0 +1,108 @@
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+#include "cunittest/cunittest.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_template.h"
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(test_histogram_template)
+{
+	UNITTEST_FIXTURE(main)
+	{
+		UNITTEST_FIXTURE_SETUP()
+		{
+		}
+
+		UNITTEST_FIXTURE_TEARDOWN()
+		{
+		}
+
+		UNITTEST_TEST(config_matches_runtime)
+		{
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 3600000000LL, 3, &cfg));
+
+			typedef nhdr::hdr_histogram_t<1, 3600000000LL, 3> histogram_t;
+			CHECK_EQUAL(cfg.counts_len, histogram_t::COUNTS_LEN);
+			CHECK_EQUAL(cfg.bucket_count, histogram_t::BUCKET_COUNT);
+			CHECK_EQUAL(cfg.sub_bucket_count, histogram_t::SUB_BUCKET_COUNT);
+			CHECK_EQUAL(cfg.sub_bucket_half_count_magnitude, histogram_t::SUB_BUCKET_HALF_COUNT_MAGNITUDE);
+			CHECK_EQUAL(cfg.sub_bucket_mask, histogram_t::SUB_BUCKET_MASK);
+			CHECK_EQUAL(cfg.unit_magnitude, histogram_t::UNIT_MAGNITUDE);
+
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1000, 10000000000LL, 2, &cfg));
+			CHECK_EQUAL(cfg.counts_len, (nhdr::hdr_histogram_t<1000, 10000000000LL, 2>::COUNTS_LEN));
+			CHECK_EQUAL(cfg.unit_magnitude, (nhdr::hdr_histogram_t<1000, 10000000000LL, 2>::UNIT_MAGNITUDE));
+		}
+
+		UNITTEST_TEST(record_matches_runtime)
+		{
+			static nhdr::hdr_histogram_t<1, 3600000000LL, 3> fixed;
+			nhdr::hdr_histogram*                             h = nullptr;
+			CHECK_EQUAL(0, nhdr::hdr_init(1, 3600000000LL, 3, &h));
+
+			CHECK_FALSE(fixed.record(-1));
+			CHECK_FALSE(fixed.record(1LL << 40));
+
+			u64 x = 99;
+			for (s32 i = 0; i < 10000; ++i)
+			{
+				x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+				const s64 value = (s64)((x >> 33) % 3600000000LL);
+				CHECK_TRUE(fixed.record(value));
+				nhdr::hdr_record_value(h, value);
+				CHECK_EQUAL(nhdr::hdr_counts_index_for(h, value), fixed.counts_index_for(value));
+			}
+
+			CHECK_EQUAL(h->total_count, fixed.h.total_count);
+			CHECK_EQUAL(nhdr::hdr_min(h), nhdr::hdr_min(fixed));
+			CHECK_EQUAL(nhdr::hdr_max(h), nhdr::hdr_max(fixed));
+			CHECK_EQUAL(nhdr::hdr_mean(h), nhdr::hdr_mean(fixed));
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(h, 99.0), nhdr::hdr_value_at_percentile(fixed, 99.0));
+
+			// Merges work both ways
+			CHECK_EQUAL(0, nhdr::hdr_add(h, fixed));
+			CHECK_EQUAL(0, nhdr::hdr_add(fixed, h));
+			CHECK_EQUAL(30000, fixed.h.total_count);
+			CHECK_EQUAL(nhdr::hdr_value_at_percentile(h, 50.0), nhdr::hdr_value_at_percentile(fixed, 50.0));
+
+			// A reset through the C API leaves the template recording correctly
+			nhdr::hdr_reset(fixed);
+			CHECK_EQUAL(0, fixed.h.total_count);
+			fixed.record(1000, 2);
+			CHECK_EQUAL(2, nhdr::hdr_count_at_value(fixed, 1000));
+			nhdr::hdr_reset(fixed);
+			CHECK_EQUAL(0, nhdr::hdr_count_at_value(fixed, 1000));
+
+			// Shifted values go through the runtime path
+			fixed.record(1000);
+			CHECK_EQUAL(0, nhdr::hdr_shift_values_left(fixed, 2));
+			CHECK_TRUE(fixed.record(1000));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(fixed, 1000));
+			CHECK_EQUAL(1, nhdr::hdr_count_at_value(fixed, 4000));
+
+			nhdr::hdr_close(h);
+		}
+
+		UNITTEST_TEST(record_invalidates_summary)
+		{
+			static nhdr::hdr_histogram_t<1, 3600000000LL, 3> fixed;
+			fixed.record(1000, 2);
+
+			nhdr::hdr_stats stats;
+			nhdr::hdr_stats_init(&stats);
+			CHECK_EQUAL(0, nhdr::hdr_summary(fixed, nullptr, 0, &stats));
+			CHECK_EQUAL(1000, stats.max);
+
+			// A removal and a record that leave the total count as it was
+			fixed.record(1000, -1);
+			fixed.record(5000, 1);
+			CHECK_EQUAL(2, fixed.h.total_count);
+			CHECK_EQUAL(0, nhdr::hdr_summary(fixed, nullptr, 0, &stats));
+			CHECK_TRUE(nhdr::hdr_values_are_equivalent(fixed, 5000, stats.max));
+		}
+	}
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,121 @@
+#include "ccore/c_allocator.h"
+#include "cbase/c_context.h"
+#include "cunittest/cunittest.h"
+
+#include "chistogram/c_histogram.h"
+#include "chistogram/c_histogram_window.h"
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(test_histogram_window)
+{
+	UNITTEST_FIXTURE(main)
+	{
+		UNITTEST_FIXTURE_SETUP()
+		{
+		}
+
+		UNITTEST_FIXTURE_TEARDOWN()
+		{
+		}
+
+		UNITTEST_TEST(init)
+		{
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 1000000, 3, &cfg));
+
+			nhdr::hdr_window_histogram w;
+			CHECK_EQUAL(-1, nhdr::hdr_window_init(&w, &cfg, 0, context_t::system_alloc()));
+			CHECK_EQUAL(-2, nhdr::hdr_window_init(&w, &cfg, 0x7FFFFFFF, context_t::system_alloc()));
+			CHECK_EQUAL(0, nhdr::hdr_window_init(&w, &cfg, 4, context_t::system_alloc()));
+			CHECK_EQUAL(5, w.slot_count);
+			CHECK_EQUAL(0, nhdr::hdr_window_total_count(&w));
+
+			nhdr::hdr_window_destroy(&w);
+		}
+
+		UNITTEST_TEST(window_matches_merged_intervals)
+		{
+			const s32 interval_count = 3;
+
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 1000000, 3, &cfg));
+
+			nhdr::hdr_window_histogram w;
+			CHECK_EQUAL(0, nhdr::hdr_window_init(&w, &cfg, interval_count, context_t::system_alloc()));
+
+			nhdr::hdr_histogram* intervals[8];
+			for (s32 i = 0; i < 8; ++i)
+				CHECK_EQUAL(0, nhdr::hdr_init(1, 1000000, 3, &intervals[i]));
+
+			u64 x = 4242;
+			for (s32 i = 0; i < 8; ++i)
+			{
+				for (s32 j = 0; j < 500; ++j)
+				{
+					x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+					const s64 value = (s64)((x >> 33) % (100000 * (i + 1)));
+					CHECK_TRUE(nhdr::hdr_window_record_value(&w, value));
+					nhdr::hdr_record_value(intervals[i], value);
+				}
+				nhdr::hdr_window_rotate(&w);
+
+				// The window holds the last 'interval_count' completed intervals
+				nhdr::hdr_histogram* merged = nullptr;
+				CHECK_EQUAL(0, nhdr::hdr_init(1, 1000000, 3, &merged));
+				for (s32 k = (i + 1 > interval_count ? i + 1 - interval_count : 0); k <= i; ++k)
+					nhdr::hdr_add(merged, intervals[k]);
+
+				CHECK_EQUAL(merged->total_count, nhdr::hdr_window_total_count(&w));
+				CHECK_EQUAL(nhdr::hdr_min(merged), nhdr::hdr_min(w.window));
+				CHECK_EQUAL(nhdr::hdr_max(merged), nhdr::hdr_max(w.window));
+				CHECK_EQUAL(nhdr::hdr_value_at_percentile(merged, 50.0), nhdr::hdr_window_value_at_percentile(&w, 50.0));
+				CHECK_EQUAL(nhdr::hdr_value_at_percentile(merged, 99.0), nhdr::hdr_window_value_at_percentile(&w, 99.0));
+				nhdr::hdr_close(merged);
+			}
+
+			// Empty intervals age the recorded values out of the window
+			for (s32 i = 0; i < interval_count; ++i)
+				nhdr::hdr_window_rotate(&w);
+			CHECK_EQUAL(0, nhdr::hdr_window_total_count(&w));
+			CHECK_EQUAL(0, nhdr::hdr_max(w.window));
+
+			nhdr::hdr_window_reset(&w);
+			CHECK_EQUAL(0, w.current);
+
+			for (s32 i = 0; i < 8; ++i)
+				nhdr::hdr_close(intervals[i]);
+			nhdr::hdr_window_destroy(&w);
+		}
+
+		UNITTEST_TEST(summary_follows_rotations)
+		{
+			nhdr::hdr_histogram_bucket_config cfg;
+			CHECK_EQUAL(0, nhdr::hdr_calculate_bucket_config(1, 1000000, 3, &cfg));
+
+			nhdr::hdr_window_histogram w;
+			CHECK_EQUAL(0, nhdr::hdr_window_init(&w, &cfg, 2, context_t::system_alloc()));
+
+			// A steady rate keeps the total of the window the same after every rotation
+			const f64       percentiles[] = {50.0, 99.0};
+			nhdr::hdr_stats stats;
+			nhdr::hdr_stats_init(&stats);
+			for (s32 i = 0; i < 6; ++i)
+			{
+				for (s32 j = 0; j < 10; ++j)
+					CHECK_TRUE(nhdr::hdr_window_record_value(&w, 100 * (i + 1) + j));
+				nhdr::hdr_window_rotate(&w);
+
+				CHECK_EQUAL(0, nhdr::hdr_summary(w.window, percentiles, 2, &stats));
+				CHECK_EQUAL(nhdr::hdr_window_total_count(&w), stats.total_count);
+				CHECK_EQUAL(nhdr::hdr_max(w.window), stats.max);
+				CHECK_EQUAL(nhdr::hdr_min(w.window), stats.min);
+				CHECK_EQUAL(nhdr::hdr_window_value_at_percentile(&w, 50.0), stats.values[0]);
+				CHECK_EQUAL(nhdr::hdr_window_value_at_percentile(&w, 99.0), stats.values[1]);
+			}
+
+			nhdr::hdr_window_destroy(&w);
+		}
+	}
+}
+UNITTEST_SUITE_END
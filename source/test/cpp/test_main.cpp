@@ -7,6 +7,13 @@
 
 UNITTEST_SUITE_LIST(cUnitTest);
 UNITTEST_SUITE_DECLARE(cUnitTest, test_histogram);
+UNITTEST_SUITE_DECLARE(cUnitTest, test_histogram_double);
+UNITTEST_SUITE_DECLARE(cUnitTest, test_histogram_encoding);
+UNITTEST_SUITE_DECLARE(cUnitTest, test_histogram_mmap);
+UNITTEST_SUITE_DECLARE(cUnitTest, test_histogram_recorder);
+UNITTEST_SUITE_DECLARE(cUnitTest, test_histogram_sharded);
+UNITTEST_SUITE_DECLARE(cUnitTest, test_histogram_template);
+UNITTEST_SUITE_DECLARE(cUnitTest, test_histogram_window);
 
 namespace ncore
 {